@@ -0,0 +1,56 @@
+// A fixed-capacity queue for handing work between threads
+//	push() waits while the queue is full and pop() waits while it's empty, so a
+//	fast stage of a pipeline gets held back by a slow one instead of running
+//	ahead and piling up frames in memory. Once the producer calls close(),
+//	pop() drains what's left and then returns false.
+
+#ifndef _BOUNDED_QUEUE_H
+#define _BOUNDED_QUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+template <class T>
+class BoundedQueue {
+	deque<T> items;
+	unsigned int capacity;
+	bool closed;
+
+	mutex lock;
+	condition_variable notFull, notEmpty;
+
+public:
+	BoundedQueue(unsigned int capacity) : capacity(capacity), closed(false) {}
+
+	void push(T item) {
+		unique_lock<mutex> guard(lock);
+		notFull.wait(guard, [this] { return items.size() < capacity; });
+		items.push_back(move(item));
+		notEmpty.notify_one();
+	}
+
+	// Returns false once the queue is closed and empty
+	bool pop(T &item) {
+		unique_lock<mutex> guard(lock);
+		notEmpty.wait(guard, [this] { return closed or not items.empty(); });
+		if (items.empty()) {
+			return false;
+		}
+		item = move(items.front());
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	// No more items will be pushed
+	void close() {
+		lock_guard<mutex> guard(lock);
+		closed = true;
+		notEmpty.notify_all();
+	}
+};
+
+#endif
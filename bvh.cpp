@@ -0,0 +1,139 @@
+#include "bvh.h"
+
+#include <algorithm>
+
+// Primitive boxes are grown by this much so rounding never loses a hit on a box face
+const float BOX_PADDING = 1e-4;
+
+//////////////////////////////////// AABB //////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+
+AABB::AABB()
+	: lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX)
+{}
+
+AABB::AABB(VEC3 lo, VEC3 hi)
+	: lo(lo), hi(hi)
+{}
+
+void AABB::expand(VEC3 point) {
+	lo = lo.cwiseMin(point);
+	hi = hi.cwiseMax(point);
+}
+
+void AABB::expand(const AABB &box) {
+	lo = lo.cwiseMin(box.lo);
+	hi = hi.cwiseMax(box.hi);
+}
+
+VEC3 AABB::center() const {
+	return (lo + hi) / 2;
+}
+
+float AABB::surfaceArea() const {
+	VEC3 size = hi - lo;
+	return 2 * (size[0] * size[1] + size[1] * size[2] + size[2] * size[0]);
+}
+
+// Slab test: clip the ray against the three pairs of planes bounding the box
+bool AABB::intersects(const Ray &ray, VEC3 invD, float tMax, float &tNear) const {
+	float tEnter = 0;
+	float tExit = tMax;
+	for (int i = 0; i < 3; i++) {
+		float t0 = (lo[i] - ray.o[i]) * invD[i];
+		float t1 = (hi[i] - ray.o[i]) * invD[i];
+		if (t0 > t1) {
+			std::swap(t0, t1);
+		}
+		tEnter = max(tEnter, t0);
+		tExit = min(tExit, t1);
+		if (tEnter > tExit) {
+			return false;
+		}
+	}
+	tNear = tEnter;
+	return true;
+}
+
+//////////////////////////////////// BVH ///////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+
+void BVH::build(const vector<AABB> &boxes) {
+	nodes.clear();
+	leafOrder.resize(boxes.size());
+	if (boxes.empty()) {
+		return;
+	}
+
+	vector<VEC3> centers(boxes.size());
+	for (unsigned int i = 0; i < boxes.size(); i++) {
+		leafOrder[i] = i;
+		centers[i] = boxes[i].center();
+	}
+
+	// A binary tree has fewer than 2n nodes
+	nodes.reserve(2 * boxes.size());
+	buildNode(boxes, centers, 0, boxes.size());
+}
+
+// Splits the primitives at the median along the axis where their centers are most spread out
+int BVH::buildNode(const vector<AABB> &boxes, const vector<VEC3> &centers, int first, int count) {
+	int index = nodes.size();
+	nodes.push_back(BVHNode());
+
+	AABB box, centerBox;
+	for (int i = first; i < first + count; i++) {
+		box.expand(boxes[leafOrder[i]]);
+		centerBox.expand(centers[leafOrder[i]]);
+	}
+	box.lo -= VEC3::Constant(BOX_PADDING);
+	box.hi += VEC3::Constant(BOX_PADDING);
+
+	nodes[index].box = box;
+	nodes[index].first = first;
+	nodes[index].count = count;
+	nodes[index].rightChild = -1;
+	nodes[index].isLeaf = count <= MAX_LEAF_SIZE;
+	if (nodes[index].isLeaf) {
+		return index;
+	}
+
+	// Choose the split axis
+	VEC3 extent = centerBox.hi - centerBox.lo;
+	int axis = 0;
+	if (extent[1] > extent[axis]) axis = 1;
+	if (extent[2] > extent[axis]) axis = 2;
+
+	// Partition around the median center
+	int half = count / 2;
+	vector<int>::iterator begin = leafOrder.begin() + first;
+	nth_element(begin, begin + half, begin + count, [&](int a, int b) {
+		return centers[a][axis] < centers[b][axis];
+	});
+
+	// Left child is always the next node, so only the right child is recorded
+	buildNode(boxes, centers, first, half);
+	int right = buildNode(boxes, centers, first + half, count - half);
+	nodes[index].rightChild = right;
+	return index;
+}
+
+void BVH::refit(const vector<AABB> &boxes) {
+	// Children always come after their parent, so walking backwards
+	//	visits every child before the node that contains it
+	for (int index = nodes.size() - 1; index >= 0; index--) {
+		BVHNode &node = nodes[index];
+		AABB box;
+		if (node.isLeaf) {
+			for (int i = node.first; i < node.first + node.count; i++) {
+				box.expand(boxes[leafOrder[i]]);
+			}
+			box.lo -= VEC3::Constant(BOX_PADDING);
+			box.hi += VEC3::Constant(BOX_PADDING);
+		} else {
+			box = nodes[index + 1].box;
+			box.expand(nodes[node.rightChild].box);
+		}
+		node.box = box;
+	}
+}
@@ -0,0 +1,134 @@
+// This file defines a bounding volume hierarchy (BVH)
+//	The BVH groups primitives into a tree of axis-aligned boxes, so a ray
+//	only has to be tested against the primitives whose boxes it passes through.
+//	The BVH only knows about boxes; the caller stores its primitives in the
+//	BVH's leaf order and supplies the actual primitive intersection test.
+
+#ifndef _BVH_H
+#define _BVH_H
+
+#include <vector>
+#include <float.h>
+#include "SETTINGS.h"
+#include "ray.h"
+
+using namespace std;
+
+// Axis-aligned bounding box
+struct AABB {
+	VEC3 lo, hi;	// Lowest and highest corners of the box
+
+	// Creates an empty box, which contains nothing
+	AABB();
+	AABB(VEC3 lo, VEC3 hi);
+
+	// Grows the box to contain the point or the other box
+	void expand(VEC3 point);
+	void expand(const AABB &box);
+
+	VEC3 center() const;
+	float surfaceArea() const;
+
+	// Returns true if the ray passes through the box between t = 0 and tMax
+	//	invD is 1 / ray.d, precomputed once per ray
+	//	Sets tNear to how far along the ray it enters the box
+	bool intersects(const Ray &ray, VEC3 invD, float tMax, float &tNear) const;
+};
+
+// A node in the flattened tree
+//	Nodes are stored depth-first, so the left child of a node is always the next node
+//	and every subtree occupies one contiguous range of nodes and of primitives
+struct BVHNode {
+	AABB box;
+	int rightChild;	// Index of the right child (interior nodes only)
+	int first;		// Index of the node's first primitive, in leaf order
+	int count;		// Number of primitives under the node; leaves have count <= MAX_LEAF_SIZE
+	bool isLeaf;
+};
+
+class BVH {
+	vector<BVHNode> nodes;
+	vector<int> leafOrder;	// leafOrder[i] is the original index of the ith primitive in leaf order
+
+	// Recursively builds the node covering primitives [first, first + count) of leafOrder
+	int buildNode(const vector<AABB> &boxes, const vector<VEC3> &centers, int first, int count);
+
+public:
+	static const int MAX_LEAF_SIZE = 4;
+
+	// Builds the tree over the primitives with these bounding boxes
+	void build(const vector<AABB> &boxes);
+
+	// Recomputes every node's box from new primitive boxes, keeping the tree shape
+	//	Much cheaper than a rebuild when primitives only move a little (e.g. skinning)
+	//	boxes are indexed by original primitive index, like in build()
+	void refit(const vector<AABB> &boxes);
+
+	const vector<int> &getLeafOrder() const { return leafOrder; }
+	const vector<BVHNode> &getNodes() const { return nodes; }
+	bool empty() const { return nodes.empty(); }
+
+	// Finds the closest primitive hit by the ray
+	//	test(i, t) must return true if the ith primitive in leaf order is hit, and set t
+	//	Sets closestTime and closestIndex (in leaf order) for the closest hit
+	template <class PrimitiveTest>
+	bool closestHit(const Ray &ray, PrimitiveTest test, float &closestTime, int &closestIndex) const;
+};
+
+template <class PrimitiveTest>
+bool BVH::closestHit(const Ray &ray, PrimitiveTest test, float &closestTime, int &closestIndex) const {
+	closestTime = FLT_MAX;
+	closestIndex = -1;
+	if (nodes.empty()) {
+		return false;
+	}
+
+	VEC3 invD(1.0 / ray.d[0], 1.0 / ray.d[1], 1.0 / ray.d[2]);
+	float tNear;
+	if (not nodes[0].box.intersects(ray, invD, closestTime, tNear)) {
+		return false;
+	}
+
+	// Depth-first traversal, visiting the nearer child first so later boxes can be culled
+	int stack[64];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0) {
+		const BVHNode &node = nodes[stack[--stackSize]];
+
+		if (node.isLeaf) {
+			for (int i = node.first; i < node.first + node.count; i++) {
+				float t;
+				if (test(i, t) and t < closestTime) {
+					closestTime = t;
+					closestIndex = i;
+				}
+			}
+			continue;
+		}
+
+		int left = &node - &nodes[0] + 1;
+		int right = node.rightChild;
+		float tLeft, tRight;
+		bool hitLeft = nodes[left].box.intersects(ray, invD, closestTime, tLeft);
+		bool hitRight = nodes[right].box.intersects(ray, invD, closestTime, tRight);
+		if (hitLeft and hitRight) {
+			// Push the further child first, so the nearer one is popped next
+			if (tLeft < tRight) {
+				stack[stackSize++] = right;
+				stack[stackSize++] = left;
+			} else {
+				stack[stackSize++] = left;
+				stack[stackSize++] = right;
+			}
+		} else if (hitLeft) {
+			stack[stackSize++] = left;
+		} else if (hitRight) {
+			stack[stackSize++] = right;
+		}
+	}
+
+	return closestIndex != -1;
+}
+
+#endif
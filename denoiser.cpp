@@ -0,0 +1,237 @@
+#include "denoiser.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <float.h>
+
+extern const int DENOISE_ITERATIONS;	// Number of filter passes
+extern const float DENOISE_COLOUR_SIGMA;	// How different colours can be and still be blurred together
+extern const float DENOISE_ALBEDO_SIGMA;	// The same for the surfaces' own colours
+extern const float DENOISE_DEPTH_SIGMA;	// The same for depths, relative to the depth's slope
+
+// Rows filtered by each task on the thread pool
+static const int ROWS_PER_TASK = 8;
+
+// The 5-tap B3 spline the a-trous filter spreads out
+static const float KERNEL[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+
+DenoiseBuffers::DenoiseBuffers(int width, int height)
+	: width(width), height(height), depth(width * height, 0), frameNum(width * height, 1)
+{
+	for (int c = 0; c < 3; c++) {
+		colour[c].assign(width * height, 0);
+		albedo[c].assign(width * height, 0);
+		normal[c].assign(width * height, 0);
+	}
+}
+
+void DenoiseBuffers::setColour(int pixel, VEC3 colour) {
+	for (int c = 0; c < 3; c++) {
+		this->colour[c][pixel] = colour[c];
+	}
+}
+
+void DenoiseBuffers::setFeatures(int pixel, VEC3 albedo, VEC3 normal, float depth) {
+	for (int c = 0; c < 3; c++) {
+		this->albedo[c][pixel] = albedo[c];
+		this->normal[c][pixel] = normal[c];
+	}
+	this->depth[pixel] = depth;
+}
+
+VEC3 DenoiseBuffers::getColour(int pixel) const {
+	return VEC3(colour[0][pixel], colour[1][pixel], colour[2][pixel]);
+}
+
+// max(x, 0) without a branch, which would stop the filter's loop being vectorised
+static inline float positivePart(float x) {
+	return 0.5f * (x + fabs(x));
+}
+
+// exp(-x) for x >= 0, near enough for weights: (1 - x/8)^8, which unlike exp
+//	compiles to plain SIMD arithmetic
+static inline float fastExpNegative(float x) {
+	float t = positivePart(1 - x * (1.0f / 8));
+	t *= t;
+	t *= t;
+	return t * t;
+}
+
+// How fast the depth changes from each pixel to the next, so depths on a slanted
+//	surface aren't mistaken for an edge
+//	Along each axis it's the smaller change to either neighbour, so a pixel on the
+//	edge of an object takes its slope from its own side.
+static vector<float> depthSlopes(const DenoiseBuffers &buffers) {
+	int width = buffers.width;
+	int height = buffers.height;
+	const vector<float> &depth = buffers.depth;
+
+	// Change in depth to a neighbour, or none if it's off the image or hit nothing
+	auto change = [&](int pixel, int neighbour, bool exists) {
+		return exists and depth[neighbour] != 0 ? fabs(depth[neighbour] - depth[pixel]) : FLT_MAX;
+	};
+
+	vector<float> slopes(width * height, 0);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			int pixel = y * width + x;
+			if (depth[pixel] == 0) {
+				continue;
+			}
+			float alongX = min(change(pixel, pixel - 1, x > 0), change(pixel, pixel + 1, x < width - 1));
+			float alongY = min(change(pixel, pixel - width, y > 0), change(pixel, pixel + width, y < height - 1));
+			float slope = max(alongX == FLT_MAX ? 0 : alongX, alongY == FLT_MAX ? 0 : alongY);
+			slopes[pixel] = slope;
+		}
+	}
+	return slopes;
+}
+
+// The planes a pass reads from
+struct FilterPlanes {
+	const float *r, *g, *b;	// The colour being filtered
+	const float *albedoR, *albedoG, *albedoB;
+	const float *normalX, *normalY, *normalZ;
+	const float *depth, *slopes;
+	const float *frameNum;
+};
+
+// Adds the taps offset pixels away to the sums for pixels [first, last)
+//	The sums are restrict, promising they overlap none of the planes, without
+//	which the compiler won't vectorise the loop.
+static void addTaps(const FilterPlanes &planes, int first, int last, int offset, float kernel,
+	float colourScale, float albedoScale, float depthScale,
+	float *__restrict sumR, float *__restrict sumG, float *__restrict sumB, float *__restrict sumWeight)
+{
+	const float *r = planes.r, *g = planes.g, *b = planes.b;
+	const float *ar = planes.albedoR, *ag = planes.albedoG, *ab = planes.albedoB;
+	const float *nx = planes.normalX, *ny = planes.normalY, *nz = planes.normalZ;
+	const float *depth = planes.depth, *slopes = planes.slopes;
+	const float *frameNum = planes.frameNum;
+
+	for (int p = first; p < last; p++) {
+		int q = p + offset;
+
+		float dr = r[p] - r[q];
+		float dg = g[p] - g[q];
+		float db = b[p] - b[q];
+		// Averaging n frames leaves 1/sqrt(n) of the noise, so colours can differ that much less
+		float colourDistance = (dr * dr + dg * dg + db * db) * colourScale * frameNum[p];
+
+		float dar = ar[p] - ar[q];
+		float dag = ag[p] - ag[q];
+		float dab = ab[p] - ab[q];
+		float albedoDistance = (dar * dar + dag * dag + dab * dab) * albedoScale;
+
+		float depthDistance = fabs(depth[p] - depth[q]) * depthScale / (slopes[p] + 1e-4f);
+
+		// cos^128 of the angle between the normals, by squaring 7 times
+		float normalWeight = positivePart(nx[p] * nx[q] + ny[p] * ny[q] + nz[p] * nz[q]);
+		for (int i = 0; i < 7; i++) {
+			normalWeight *= normalWeight;
+		}
+
+		float weight = kernel * normalWeight * fastExpNegative(colourDistance + albedoDistance + depthDistance);
+		sumR[p] += weight * r[q];
+		sumG[p] += weight * g[q];
+		sumB[p] += weight * b[q];
+		sumWeight[p] += weight;
+	}
+}
+
+// One a-trous pass over rows [firstRow, lastRow), with taps step pixels apart
+static void filterRows(const DenoiseBuffers &buffers, const vector<float> &slopes, const vector<float> *in,
+	vector<float> *out, int step, float colourSigma, int firstRow, int lastRow)
+{
+	int width = buffers.width;
+	int height = buffers.height;
+	float colourScale = 1 / (colourSigma * colourSigma);
+	float albedoScale = 1 / (DENOISE_ALBEDO_SIGMA * DENOISE_ALBEDO_SIGMA);
+
+	vector<float> sumR(width), sumG(width), sumB(width), sumWeight(width);
+	for (int y = firstRow; y < lastRow; y++) {
+		fill(sumR.begin(), sumR.end(), 0);
+		fill(sumG.begin(), sumG.end(), 0);
+		fill(sumB.begin(), sumB.end(), 0);
+		fill(sumWeight.begin(), sumWeight.end(), 0);
+
+		// Planes start at the row, so pixel x of the row is index x
+		int row = y * width;
+		FilterPlanes planes = {
+			in[0].data() + row, in[1].data() + row, in[2].data() + row,
+			buffers.albedo[0].data() + row, buffers.albedo[1].data() + row, buffers.albedo[2].data() + row,
+			buffers.normal[0].data() + row, buffers.normal[1].data() + row, buffers.normal[2].data() + row,
+			buffers.depth.data() + row, slopes.data() + row,
+			buffers.frameNum.data() + row
+		};
+
+		for (int ty = -2; ty <= 2; ty++) {
+			int tapY = y + ty * step;
+			if (tapY < 0 or tapY >= height) {
+				continue;	// Taps off the image are left out, and the rest weighted up
+			}
+			for (int tx = -2; tx <= 2; tx++) {
+				int offset = (tapY - y) * width + tx * step;
+				float kernel = KERNEL[tx + 2] * KERNEL[ty + 2];
+				float depthScale = 1 / (DENOISE_DEPTH_SIGMA * step * (abs(tx) + abs(ty)) + 1e-4f);
+
+				// The pixels whose tap lands on the image form one contiguous run
+				int first = max(0, -tx * step);
+				int last = min(width, width - tx * step);
+				addTaps(planes, first, last, offset, kernel, colourScale, albedoScale, depthScale,
+					sumR.data(), sumG.data(), sumB.data(), sumWeight.data());
+			}
+		}
+
+		for (int x = 0; x < width; x++) {
+			int p = row + x;
+			// Pixels that hit nothing have no normal, and keep their colour
+			if (sumWeight[x] > 0) {
+				out[0][p] = sumR[x] / sumWeight[x];
+				out[1][p] = sumG[x] / sumWeight[x];
+				out[2][p] = sumB[x] / sumWeight[x];
+			} else {
+				out[0][p] = in[0][p];
+				out[1][p] = in[1][p];
+				out[2][p] = in[2][p];
+			}
+		}
+	}
+}
+
+void denoise(DenoiseBuffers &buffers, ThreadPool &pool) {
+	int pixelNum = buffers.width * buffers.height;
+	if (pixelNum == 0) {
+		return;
+	}
+
+	// Filter what will be displayed, which is clamped to [0, 1]
+	for (int c = 0; c < 3; c++) {
+		for (int p = 0; p < pixelNum; p++) {
+			buffers.colour[c][p] = max(0.0f, min(1.0f, buffers.colour[c][p]));
+		}
+	}
+	vector<float> slopes = depthSlopes(buffers);
+
+	vector<float> filtered[3];
+	for (int c = 0; c < 3; c++) {
+		filtered[c].resize(pixelNum);
+	}
+
+	// Each pass spreads the taps twice as far, and lets less colour difference through
+	int taskNum = (buffers.height + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+	float colourSigma = DENOISE_COLOUR_SIGMA;
+	for (int iteration = 0; iteration < DENOISE_ITERATIONS; iteration++) {
+		int step = 1 << iteration;
+		pool.run(taskNum, [&](int task) {
+			int firstRow = task * ROWS_PER_TASK;
+			int lastRow = min(buffers.height, firstRow + ROWS_PER_TASK);
+			filterRows(buffers, slopes, buffers.colour, filtered, step, colourSigma, firstRow, lastRow);
+		});
+		for (int c = 0; c < 3; c++) {
+			buffers.colour[c].swap(filtered[c]);
+		}
+		colourSigma /= 2;
+	}
+}
@@ -0,0 +1,43 @@
+// Removes the noise left by the few rays per pixel, after the frame is rendered
+//	This is the edge-avoiding a-trous wavelet filter (Dammertz et al., "Edge-
+//	Avoiding A-Trous Wavelet Transform for fast Global Illumination Filtering",
+//	2010): a 5x5 blur run several times, its taps spread twice as far apart
+//	each time, so a few cheap passes cover a wide area. Each tap is weighted
+//	down the more its pixel differs from the centre one in colour, and in the
+//	features the renderer writes out alongside: the surface's own colour
+//	(albedo), normal and depth. The blur then stays on its own surface, and
+//	doesn't smear edges, textures or the outlines of shadows.
+//
+//	Buffers are kept as separate planes of floats, and each pass works a row
+//	at a time along contiguous runs of pixels, which compilers turn into SIMD
+//	code. Passes are split over the thread pool by rows.
+
+#ifndef _DENOISER_H
+#define _DENOISER_H
+
+#include <vector>
+#include "SETTINGS.h"
+#include "threadPool.h"
+
+using namespace std;
+
+// The rendered colour and the features that guide the filter, one float per pixel per plane
+struct DenoiseBuffers {
+	int width, height;
+	vector<float> colour[3];	// RGB
+	vector<float> albedo[3];	// Colour of the surface seen through the pixel (0 where nothing is hit)
+	vector<float> normal[3];	// Its normal (0 where nothing is hit)
+	vector<float> depth;	// Its distance from the eye (0 where nothing is hit)
+	vector<float> frameNum;	// Frames averaged into the colour (see temporal.h), which make it less noisy
+
+	DenoiseBuffers(int width, int height);
+
+	void setColour(int pixel, VEC3 colour);
+	void setFeatures(int pixel, VEC3 albedo, VEC3 normal, float depth);
+	VEC3 getColour(int pixel) const;
+};
+
+// Filters the colour in place (see DENOISE_ITERATIONS and the sigmas in renderConfig.cpp)
+void denoise(DenoiseBuffers &buffers, ThreadPool &pool);
+
+#endif
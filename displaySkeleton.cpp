@@ -14,10 +14,8 @@ Revision 3 - Jernej Barbic and Yili Zhao, Feb, 2012
 #include "displaySkeleton.h"
 
 ////////////////SOFTWARE GL BEGIN///////////////////////
-#include <stack>
-stack<MATRIX4> matrixStack;
-static MATRIX4 currentMatrix = MATRIX4::Identity();
-
+// The matrix stack is part of each DisplaySkeleton, so several skeletons
+// can compute their bones on different threads at once
 static MATRIX4 toMatrix4(const MATRIX3& A)
 {
   MATRIX4 result = MATRIX4::Identity();
@@ -27,18 +25,18 @@ static MATRIX4 toMatrix4(const MATRIX3& A)
   return result;
 }
 
-static void myPushMatrix()
+void DisplaySkeleton::myPushMatrix()
 {
   matrixStack.push(currentMatrix);  
 }
-static void myPopMatrix()
+void DisplaySkeleton::myPopMatrix()
 {
   assert(matrixStack.size() != 0);
   currentMatrix = matrixStack.top();
   matrixStack.pop();
 }
 
-static void myTranslatef(const float x, const float y, const float z)
+void DisplaySkeleton::myTranslatef(const float x, const float y, const float z)
 {
   MATRIX4 translation = MATRIX4::Identity();
   translation(3,0) = x;
@@ -47,7 +45,7 @@ static void myTranslatef(const float x, const float y, const float z)
 
   currentMatrix = translation * currentMatrix;
 }
-static void myRotatef(const float degrees, const float x, const float y, const float z)
+void DisplaySkeleton::myRotatef(const float degrees, const float x, const float y, const float z)
 {
   VEC3 axis(x,y,z);
   axis.normalize();
@@ -59,7 +57,7 @@ static void myRotatef(const float degrees, const float x, const float y, const f
   
   currentMatrix = toMatrix4(rotation) * currentMatrix;
 }
-static void myMultMatrixd(const double* matrix)
+void DisplaySkeleton::myMultMatrixd(const double* matrix)
 {
   MATRIX4 A;
   int i = 0;
@@ -69,7 +67,7 @@ static void myMultMatrixd(const double* matrix)
 
   currentMatrix = A * currentMatrix;
 }
-static void myLoadIdentity()
+void DisplaySkeleton::myLoadIdentity()
 {
   currentMatrix = MATRIX4::Identity();
 }
@@ -84,6 +82,7 @@ float DisplaySkeleton::jointColors[NUMBER_JOINT_COLORS][3] =
 
 DisplaySkeleton::DisplaySkeleton(void)
 {
+  currentMatrix = MATRIX4::Identity();
   m_SpotJoint = -1;
   numSkeletons = 0;
   for(int skeletonIndex = 0; skeletonIndex < MAX_SKELS; skeletonIndex++)
@@ -16,6 +16,7 @@ Revision 3 - Jernej Barbic and Yili Zhao, Feb, 2012
 #include "motion.h"
 #include <vector>
 #include <map>
+#include <stack>
 
 using namespace std;
 
@@ -71,6 +72,16 @@ protected:
 
   static float jointColors[NUMBER_JOINT_COLORS][3];
 
+  // Software replacement for the GL matrix stack
+  stack<MATRIX4> matrixStack;
+  MATRIX4 currentMatrix;
+  void myPushMatrix();
+  void myPopMatrix();
+  void myTranslatef(const float x, const float y, const float z);
+  void myRotatef(const float degrees, const float x, const float y, const float z);
+  void myMultMatrixd(const double* matrix);
+  void myLoadIdentity();
+
   vector<MATRIX4> boneRotations;
   vector<MATRIX4> boneScalings;
   vector<VEC4> boneTranslations;
@@ -0,0 +1,794 @@
+#include "farm.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <iostream>
+#include <string>
+#include <deque>
+#include <map>
+#include <set>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+typedef chrono::steady_clock Clock;
+
+// Messages between the coordinator and its workers
+enum FarmMessageType {
+	HELLO_MESSAGE = 1,	// Worker to coordinator: {uint64 token it was started with, 0 if none}
+	ASSIGN_MESSAGE,	// Coordinator to worker: {int32 frame, ...}, to render in that order
+	FRAME_MESSAGE,	// Worker to coordinator: {int32 frame, width, height, double seconds, RGB pixels}
+	SHUTDOWN_MESSAGE,	// Coordinator to worker: no more frames
+	ASSIGN_TILES_MESSAGE,	// Coordinator to worker: {int32 frame, {int32 tile, Tile}, ...}, to render together
+	TILE_MESSAGE	// Worker to coordinator: {int32 tile, double seconds, pixels of the tile (see runTileFarmCoordinator)}
+};
+
+// Every message starts with this
+struct MessageHeader {
+	uint32_t type;
+	uint32_t length;	// Bytes of payload after the header
+};
+
+static const uint32_t MAX_PAYLOAD_LENGTH = 256 << 20;
+
+// Each chunk is worth about this fraction of the remaining work per worker,
+//	so chunks shrink towards the end of the shot (or frame) and workers finish together
+static const double CHUNK_FRACTION = 0.5;
+
+// A worker is stalled if it hasn't sent anything within this many times the estimated
+//	cost of its current chunk, and at least MIN_STALL_SECONDS. Until some frame or tile
+//	has been timed there is no estimate, so the first ones get longer.
+static const double STALL_FACTOR = 4.0;
+static const double MIN_STALL_SECONDS = 30.0;
+static const double UNTIMED_STALL_SECONDS = 600.0;
+
+// Local workers that die are restarted, but only this many times in all
+static const int MAX_LOCAL_RESTARTS = 8;
+
+//////////////////////////////////////////////////////////////////////////////////
+// Sockets and messages
+//////////////////////////////////////////////////////////////////////////////////
+
+static bool sendAll(int socket, const void *data, size_t size) {
+	const char *bytes = (const char *) data;
+	while (size > 0) {
+		ssize_t sent = send(socket, bytes, size, 0);
+		if (sent < 0 and errno == EINTR) {
+			continue;
+		}
+		if (sent <= 0) {
+			return false;
+		}
+		bytes += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+static bool receiveAll(int socket, void *data, size_t size) {
+	char *bytes = (char *) data;
+	while (size > 0) {
+		ssize_t received = recv(socket, bytes, size, 0);
+		if (received < 0 and errno == EINTR) {
+			continue;
+		}
+		if (received <= 0) {
+			return false;
+		}
+		bytes += received;
+		size -= received;
+	}
+	return true;
+}
+
+static bool sendMessage(int socket, uint32_t type, const vector<unsigned char> &payload) {
+	MessageHeader header = { type, (uint32_t) payload.size() };
+	return sendAll(socket, &header, sizeof(header)) and
+		sendAll(socket, payload.data(), payload.size());
+}
+
+static bool receiveMessage(int socket, uint32_t &type, vector<unsigned char> &payload) {
+	MessageHeader header;
+	if (not receiveAll(socket, &header, sizeof(header)) or header.length > MAX_PAYLOAD_LENGTH) {
+		return false;
+	}
+	type = header.type;
+	payload.resize(header.length);
+	return receiveAll(socket, payload.data(), payload.size());
+}
+
+// Appends a plain value to a payload
+template <class T>
+static void pack(vector<unsigned char> &payload, const T &value) {
+	const unsigned char *bytes = (const unsigned char *) &value;
+	payload.insert(payload.end(), bytes, bytes + sizeof(T));
+}
+
+// Reads a plain value from a payload, moving offset past it
+template <class T>
+static bool unpack(const vector<unsigned char> &payload, size_t &offset, T &value) {
+	if (offset + sizeof(T) > payload.size()) {
+		return false;
+	}
+	memcpy(&value, payload.data() + offset, sizeof(T));
+	offset += sizeof(T);
+	return true;
+}
+
+// Keeps a socket from leaking into the local workers the coordinator starts
+static void closeOnExec(int socket) {
+	fcntl(socket, F_SETFD, fcntl(socket, F_GETFD) | FD_CLOEXEC);
+}
+
+static int connectTo(const char *host, int port) {
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	addrinfo *addresses;
+	if (getaddrinfo(host, to_string(port).c_str(), &hints, &addresses) != 0) {
+		return -1;
+	}
+
+	int connected = -1;
+	for (addrinfo *address = addresses; address != NULL and connected < 0; address = address->ai_next) {
+		int s = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (s < 0) {
+			continue;
+		}
+		if (connect(s, address->ai_addr, address->ai_addrlen) == 0) {
+			connected = s;
+		} else {
+			close(s);
+		}
+	}
+	freeaddrinfo(addresses);
+	return connected;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Coordinator
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// The coordinator hands out work items, which are either whole frames, or the
+//	tiles of a single frame
+struct FarmWorker {
+	int socket;
+	int id;	// For progress messages
+	pid_t localPid;	// The local worker it is, found from its token; 0 if it isn't one we started
+	bool greeted;	// Has said hello, so can be given work
+	vector<unsigned char> received;	// What has arrived of its next messages
+	deque<int> items;	// Assigned but not received yet, in the order it renders them
+	deque<int> chunkSizes;	// How many of those items came in each chunk
+	Clock::time_point lastHeard;
+};
+
+class FarmCoordinator {
+public:
+	FarmCoordinator(int localWorkerNum, int threadsPerWorker, const char *executable)
+		: localWorkerNum(localWorkerNum), threadsPerWorker(threadsPerWorker),
+		executable(executable), listener(-1), port(0), nextWorkerId(0), restarts(0),
+		tileFrame(-1), image(NULL), imageWidth(0), pixelBytes(3), doneNum(0), totalNum(0)
+	{
+	}
+
+	// Renders whole frames, handing each to output as it arrives
+	void addFrames(int startFrame, int endFrame, FrameOutputFunction frameOutput);
+
+	// Renders one frame, split into tiles that are composited into image as they arrive
+	//	Each pixel of the tiles and the image is tilePixelBytes bytes.
+	void addTiles(int frame, const vector<Tile> &frameTiles, int width, int tilePixelBytes, vector<unsigned char> &frameImage);
+
+	bool run(int requestedPort);
+
+private:
+	int localWorkerNum, threadsPerWorker;
+	const char *executable;
+
+	int listener, port;
+	vector<FarmWorker> workers;
+	set<pid_t> localPids;	// Local workers still running
+	map<uint64_t, pid_t> localTokens;	// Local workers that haven't said hello, by the token they were given
+	random_device tokenSource;
+	int nextWorkerId, restarts;
+
+	// What the items are
+	FrameOutputFunction output;	// Whole frames go here
+	int tileFrame;	// The frame being tiled, or -1 for whole frames
+	vector<Tile> tiles;
+	vector<unsigned char> *image;
+	int imageWidth, pixelBytes;
+
+	deque<int> pending;	// Items waiting to be assigned, in order
+	map<int, double> itemSeconds;	// Render time of every finished item
+	int doneNum, totalNum;
+
+	bool listenOn(int requestedPort);
+	void startLocalWorker();
+	void reapLocalWorkers();
+	void acceptWorker();
+	bool readFromWorker(FarmWorker &worker);
+	bool handleMessage(FarmWorker &worker, uint32_t type, const vector<unsigned char> &payload);
+	bool receiveFrame(FarmWorker &worker, const vector<unsigned char> &payload);
+	bool receiveTile(FarmWorker &worker, const vector<unsigned char> &payload);
+	bool finishItem(FarmWorker &worker, int item, double seconds);
+	void dropWorker(FarmWorker &worker, const string &reason);
+	void assignChunk(FarmWorker &worker, int workerNum);
+	double estimateSeconds(int item) const;
+	double stallSeconds(const FarmWorker &worker) const;
+};
+
+}
+
+void FarmCoordinator::addFrames(int startFrame, int endFrame, FrameOutputFunction frameOutput) {
+	output = frameOutput;
+	for (int frame = startFrame; frame <= endFrame; frame++) {
+		pending.push_back(frame);
+	}
+	totalNum = pending.size();
+}
+
+void FarmCoordinator::addTiles(int frame, const vector<Tile> &frameTiles, int width, int tilePixelBytes,
+	vector<unsigned char> &frameImage)
+{
+	tileFrame = frame;
+	tiles = frameTiles;
+	image = &frameImage;
+	imageWidth = width;
+	pixelBytes = tilePixelBytes;
+	for (unsigned int i = 0; i < tiles.size(); i++) {
+		pending.push_back(i);
+	}
+	totalNum = pending.size();
+}
+
+bool FarmCoordinator::listenOn(int requestedPort) {
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (listener < 0) {
+		return false;
+	}
+	closeOnExec(listener);
+	int reuse = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);	// Remote workers can join too
+	address.sin_port = htons(requestedPort);
+	if (bind(listener, (sockaddr *) &address, sizeof(address)) != 0 or listen(listener, 64) != 0) {
+		return false;
+	}
+
+	socklen_t length = sizeof(address);
+	getsockname(listener, (sockaddr *) &address, &length);
+	port = ntohs(address.sin_port);
+	return true;
+}
+
+// Each local worker is given a token to say hello with, which ties its connection
+//	to the process, so only processes the coordinator started are ever killed
+void FarmCoordinator::startLocalWorker() {
+	uint64_t token = 0;
+	while (token == 0 or localTokens.count(token)) {
+		token = ((uint64_t) tokenSource() << 32) | tokenSource();
+	}
+	string portArg = to_string(port);
+	string threadsArg = to_string(threadsPerWorker);
+	string tokenArg = to_string(token);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		execl(executable, executable, "worker", "127.0.0.1", portArg.c_str(), threadsArg.c_str(), tokenArg.c_str(),
+			(char *) NULL);
+		_exit(1);
+	}
+	if (pid > 0) {
+		localPids.insert(pid);
+		localTokens[token] = pid;
+	}
+}
+
+// Collects local workers that have exited, and starts replacements while there's work
+void FarmCoordinator::reapLocalWorkers() {
+	int status;
+	pid_t pid;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		localPids.erase(pid);
+		for (map<uint64_t, pid_t>::iterator token = localTokens.begin(); token != localTokens.end(); token++) {
+			if (token->second == pid) {
+				localTokens.erase(token);
+				break;
+			}
+		}
+		if (doneNum < totalNum and restarts < MAX_LOCAL_RESTARTS) {
+			cout << "Local worker " << pid << " exited; starting another" << endl;
+			restarts++;
+			startLocalWorker();
+		}
+	}
+}
+
+void FarmCoordinator::acceptWorker() {
+	int s = accept(listener, NULL, NULL);
+	if (s < 0) {
+		return;
+	}
+	closeOnExec(s);
+	int noDelay = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+	FarmWorker worker;
+	worker.socket = s;
+	worker.id = nextWorkerId++;
+	worker.localPid = 0;
+	worker.greeted = false;
+	worker.lastHeard = Clock::now();
+	workers.push_back(worker);
+}
+
+// Takes whatever has arrived from the worker, without waiting for the rest of a
+//	message, so a slow worker never holds up the others. Handles every message
+//	that is now complete.
+//	Returns false if the worker has gone, or sent something it shouldn't have
+bool FarmCoordinator::readFromWorker(FarmWorker &worker) {
+	unsigned char buffer[1 << 16];
+	while (true) {
+		ssize_t received = recv(worker.socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+		if (received < 0 and errno == EINTR) {
+			continue;
+		}
+		if (received < 0 and (errno == EAGAIN or errno == EWOULDBLOCK)) {
+			break;
+		}
+		if (received <= 0) {
+			return false;
+		}
+		worker.received.insert(worker.received.end(), buffer, buffer + received);
+		worker.lastHeard = Clock::now();
+	}
+
+	size_t offset = 0;
+	while (worker.received.size() - offset >= sizeof(MessageHeader)) {
+		MessageHeader header;
+		memcpy(&header, worker.received.data() + offset, sizeof(header));
+		if (header.length > MAX_PAYLOAD_LENGTH) {
+			return false;
+		}
+		if (worker.received.size() - offset - sizeof(header) < header.length) {
+			break;
+		}
+		vector<unsigned char>::iterator start = worker.received.begin() + offset + sizeof(header);
+		vector<unsigned char> payload(start, start + header.length);
+		offset += sizeof(header) + header.length;
+		if (not handleMessage(worker, header.type, payload)) {
+			return false;
+		}
+	}
+	worker.received.erase(worker.received.begin(), worker.received.begin() + offset);
+	return true;
+}
+
+// Returns false if the worker sent something it shouldn't have
+bool FarmCoordinator::handleMessage(FarmWorker &worker, uint32_t type, const vector<unsigned char> &payload) {
+	if (type == HELLO_MESSAGE) {
+		size_t offset = 0;
+		uint64_t token;
+		if (worker.greeted or not unpack(payload, offset, token)) {
+			return false;
+		}
+
+		// Each token is claimed once, by the first connection to use it
+		map<uint64_t, pid_t>::iterator local = localTokens.find(token);
+		if (token != 0 and local != localTokens.end()) {
+			worker.localPid = local->second;
+			localTokens.erase(local);
+		}
+		worker.greeted = true;
+		return true;
+	}
+	if (type == FRAME_MESSAGE and tileFrame < 0) {
+		return receiveFrame(worker, payload);
+	}
+	if (type == TILE_MESSAGE and tileFrame >= 0) {
+		return receiveTile(worker, payload);
+	}
+	return false;
+}
+
+bool FarmCoordinator::receiveFrame(FarmWorker &worker, const vector<unsigned char> &payload) {
+	size_t offset = 0;
+	int32_t frame, width, height;
+	double seconds;
+	if (not (unpack(payload, offset, frame) and unpack(payload, offset, width) and
+		unpack(payload, offset, height) and unpack(payload, offset, seconds)) or
+		width <= 0 or height <= 0 or payload.size() - offset != 3 * (size_t) width * height or
+		not finishItem(worker, frame, seconds))
+	{
+		return false;
+	}
+
+	vector<unsigned char> pixels(payload.begin() + offset, payload.end());
+	output(frame, pixels, width, height);
+	cout << "Frame " + to_string(frame) + " from worker " + to_string(worker.id) +
+		" (" + to_string(seconds) + "s), " + to_string(doneNum) + " of " + to_string(totalNum) + " done\n" << flush;
+	return true;
+}
+
+bool FarmCoordinator::receiveTile(FarmWorker &worker, const vector<unsigned char> &payload) {
+	size_t offset = 0;
+	int32_t index;
+	double seconds;
+	if (not (unpack(payload, offset, index) and unpack(payload, offset, seconds)) or
+		index < 0 or index >= (int) tiles.size())
+	{
+		return false;
+	}
+	const Tile &tile = tiles[index];
+	int tileWidth = tile.lastColumn - tile.firstColumn;
+	int tileHeight = tile.lastRow - tile.firstRow;
+	if (payload.size() - offset != pixelBytes * (size_t) tileWidth * tileHeight or
+		not finishItem(worker, index, seconds))
+	{
+		return false;
+	}
+
+	// Copy the tile's rows into place
+	const unsigned char *pixels = payload.data() + offset;
+	for (int row = 0; row < tileHeight; row++) {
+		memcpy(image->data() + pixelBytes * ((size_t) imageWidth * (tile.firstRow + row) + tile.firstColumn),
+			pixels + (size_t) pixelBytes * tileWidth * row, (size_t) pixelBytes * tileWidth);
+	}
+	return true;
+}
+
+// Takes a finished item off the worker's list, returning false if it wasn't on it
+bool FarmCoordinator::finishItem(FarmWorker &worker, int item, double seconds) {
+	deque<int>::iterator assigned = find(worker.items.begin(), worker.items.end(), item);
+	if (assigned == worker.items.end()) {
+		return false;
+	}
+	worker.items.erase(assigned);
+
+	// The chunk is done once the items before it and all of its own are
+	while (not worker.chunkSizes.empty() and
+		worker.items.size() <= accumulate(worker.chunkSizes.begin() + 1, worker.chunkSizes.end(), 0u))
+	{
+		worker.chunkSizes.pop_front();
+	}
+
+	itemSeconds[item] = seconds;
+	doneNum++;
+	return true;
+}
+
+// Disconnects a worker, putting its unfinished items back at the front of the queue
+void FarmCoordinator::dropWorker(FarmWorker &worker, const string &reason) {
+	if (not worker.items.empty() or doneNum < totalNum) {
+		cout << "Dropping worker " << worker.id << ": " << reason << endl;
+	}
+	if (worker.localPid > 0 and localPids.count(worker.localPid)) {
+		kill(worker.localPid, SIGKILL);
+	}
+	pending.insert(pending.begin(), worker.items.begin(), worker.items.end());
+	sort(pending.begin(), pending.end());
+	worker.items.clear();
+	worker.chunkSizes.clear();
+	close(worker.socket);
+	worker.socket = -1;
+}
+
+// Cost of an item, guessed from the finished item nearest to it
+//	Neighbouring frames have nearly the same scene, and tiles come in Hilbert
+//	order so neighbouring tiles cover nearby pixels, so they cost nearly the same.
+double FarmCoordinator::estimateSeconds(int item) const {
+	if (itemSeconds.empty()) {
+		return 1.0;
+	}
+	map<int, double>::const_iterator after = itemSeconds.lower_bound(item);
+	if (after == itemSeconds.end()) {
+		return prev(after)->second;
+	}
+	if (after == itemSeconds.begin() or after->first - item < item - prev(after)->first) {
+		return after->second;
+	}
+	return prev(after)->second;
+}
+
+// How long the worker may stay quiet while it works on its current chunk
+double FarmCoordinator::stallSeconds(const FarmWorker &worker) const {
+	if (itemSeconds.empty()) {
+		return UNTIMED_STALL_SECONDS;
+	}
+	int chunkSize = worker.items.size() - accumulate(worker.chunkSizes.begin() + 1, worker.chunkSizes.end(), 0u);
+	double chunkSeconds = 0;
+	for (int i = 0; i < chunkSize; i++) {
+		chunkSeconds += estimateSeconds(worker.items[i]);
+	}
+	return max(MIN_STALL_SECONDS, STALL_FACTOR * chunkSeconds);
+}
+
+// Gives the worker the next run of items, worth a share of what's left
+void FarmCoordinator::assignChunk(FarmWorker &worker, int workerNum) {
+	double remainingSeconds = 0;
+	for (int item : pending) {
+		remainingSeconds += estimateSeconds(item);
+	}
+	double targetSeconds = CHUNK_FRACTION * remainingSeconds / workerNum;
+
+	// Whole frames are sent as their numbers; tiles go with their frame and where they are
+	vector<unsigned char> payload;
+	if (tileFrame >= 0) {
+		pack(payload, (int32_t) tileFrame);
+	}
+	int chunkSize = 0;
+	double chunkSeconds = 0;
+	while (not pending.empty() and (chunkSize == 0 or chunkSeconds < targetSeconds)) {
+		int32_t item = pending.front();
+		pending.pop_front();
+		pack(payload, item);
+		if (tileFrame >= 0) {
+			pack(payload, tiles[item]);
+		}
+		worker.items.push_back(item);
+		chunkSize++;
+		chunkSeconds += estimateSeconds(item);
+	}
+
+	// Its timer starts now if it was idle, not when it last sent something
+	if (worker.chunkSizes.empty()) {
+		worker.lastHeard = Clock::now();
+	}
+	worker.chunkSizes.push_back(chunkSize);
+	if (not sendMessage(worker.socket, tileFrame >= 0 ? ASSIGN_TILES_MESSAGE : ASSIGN_MESSAGE, payload)) {
+		dropWorker(worker, "could not send it work");
+	}
+}
+
+bool FarmCoordinator::run(int requestedPort) {
+	// A worker dying mid-send shouldn't take the coordinator with it
+	signal(SIGPIPE, SIG_IGN);
+
+	if (not listenOn(requestedPort)) {
+		cout << " Could not listen on port " << requestedPort << " for render farm workers." << endl;
+		return false;
+	}
+	cout << "Render farm listening on port " << port << "; join with \"previz worker <host> " << port << "\"" << endl;
+
+	for (int i = 0; i < localWorkerNum; i++) {
+		startLocalWorker();
+	}
+
+	while (doneNum < totalNum) {
+		reapLocalWorkers();
+		if (workers.empty() and localPids.empty() and localWorkerNum > 0) {
+			cout << " Every local worker has died, and too many have been restarted. Bailing ... " << endl;
+			close(listener);
+			return false;
+		}
+
+		vector<pollfd> polled(1 + workers.size());
+		polled[0].fd = listener;
+		polled[0].events = POLLIN;
+		for (unsigned int i = 0; i < workers.size(); i++) {
+			polled[i + 1].fd = workers[i].socket;
+			polled[i + 1].events = POLLIN;
+		}
+		poll(polled.data(), polled.size(), 1000);
+
+		for (unsigned int i = 0; i < workers.size(); i++) {
+			if (polled[i + 1].revents and not readFromWorker(workers[i])) {
+				dropWorker(workers[i], "connection lost");
+			}
+		}
+
+		Clock::time_point now = Clock::now();
+		for (FarmWorker &worker : workers) {
+			if (worker.socket < 0) {
+				continue;
+			}
+			double quietSeconds = chrono::duration<double>(now - worker.lastHeard).count();
+			double limit = worker.items.empty() ? UNTIMED_STALL_SECONDS : stallSeconds(worker);
+			if ((not worker.items.empty() or not worker.greeted) and quietSeconds > limit) {
+				dropWorker(worker, "stalled for " + to_string((int) quietSeconds) + "s");
+			}
+		}
+		workers.erase(remove_if(workers.begin(), workers.end(),
+			[](const FarmWorker &worker) { return worker.socket < 0; }), workers.end());
+
+		if (polled[0].revents) {
+			acceptWorker();
+		}
+
+		// Hand out the next chunk before a worker finishes its current one, so it never
+		//	waits on the round trip. Local workers still starting up count, so the first
+		//	to connect doesn't take their share.
+		int workerNum = count_if(workers.begin(), workers.end(),
+			[](const FarmWorker &worker) { return worker.greeted; });
+		workerNum = max(workerNum, localWorkerNum);
+		for (FarmWorker &worker : workers) {
+			if (worker.greeted and worker.socket >= 0 and worker.chunkSizes.size() <= 1 and not pending.empty()) {
+				assignChunk(worker, workerNum);
+			}
+		}
+	}
+
+	for (FarmWorker &worker : workers) {
+		sendMessage(worker.socket, SHUTDOWN_MESSAGE, vector<unsigned char>());
+		close(worker.socket);
+	}
+	close(listener);
+	for (pid_t pid : localPids) {
+		waitpid(pid, NULL, 0);
+	}
+	return true;
+}
+
+bool runFarmCoordinator(int startFrame, int endFrame, int localWorkerNum, int threadsPerWorker,
+	int port, const char *executable, FrameOutputFunction output)
+{
+	FarmCoordinator coordinator(localWorkerNum, threadsPerWorker, executable);
+	coordinator.addFrames(startFrame, endFrame, output);
+	return coordinator.run(port);
+}
+
+bool runTileFarmCoordinator(int frame, int width, int height, int tileSize, int pixelBytes, int localWorkerNum,
+	int threadsPerWorker, int port, const char *executable, vector<unsigned char> &image)
+{
+	image.assign((size_t) pixelBytes * width * height, 0);
+
+	FarmCoordinator coordinator(localWorkerNum, threadsPerWorker, executable);
+	coordinator.addTiles(frame, createTiles(width, height, tileSize), width, pixelBytes, image);
+	return coordinator.run(port);
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Worker
+//////////////////////////////////////////////////////////////////////////////////
+
+// Renders a chunk of whole frames one after the other, sending each when it's done
+//	Returns false if the coordinator has gone.
+static bool renderFrameChunk(int s, const vector<int> &frames, FrameRenderFunction render) {
+	vector<unsigned char> pixels;
+	for (int frame : frames) {
+		int width, height;
+		Clock::time_point start = Clock::now();
+		render(frame, pixels, width, height);
+		double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+		vector<unsigned char> payload;
+		payload.reserve(3 * sizeof(int32_t) + sizeof(double) + pixels.size());
+		pack(payload, (int32_t) frame);
+		pack(payload, (int32_t) width);
+		pack(payload, (int32_t) height);
+		pack(payload, seconds);
+		payload.insert(payload.end(), pixels.begin(), pixels.end());
+		if (not sendMessage(s, FRAME_MESSAGE, payload)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Renders a chunk of tiles all together, then sends them back
+//	Returns false if the coordinator has gone, or sent a chunk that makes no sense.
+static bool renderTileChunk(int s, const vector<unsigned char> &assignment, TileRenderFunction render) {
+	size_t offset = 0;
+	int32_t frame;
+	if (not unpack(assignment, offset, frame) or frame < 0) {
+		cout << " Render farm coordinator sent tiles of no frame. Bailing ... " << endl;
+		return false;
+	}
+
+	vector<int32_t> indices;
+	vector<Tile> tiles;
+	while (offset < assignment.size()) {
+		int32_t index;
+		Tile tile;
+		if (not (unpack(assignment, offset, index) and unpack(assignment, offset, tile)) or
+			tile.firstColumn < 0 or tile.firstRow < 0 or tile.lastColumn <= tile.firstColumn or tile.lastRow <= tile.firstRow)
+		{
+			cout << " Render farm coordinator sent a bad tile of frame " << frame << ". Bailing ... " << endl;
+			return false;
+		}
+		indices.push_back(index);
+		tiles.push_back(tile);
+	}
+
+	vector<vector<unsigned char> > pixels;
+	vector<double> seconds;
+	render(frame, tiles, pixels, seconds);
+
+	for (unsigned int i = 0; i < tiles.size(); i++) {
+		vector<unsigned char> payload;
+		payload.reserve(sizeof(int32_t) + sizeof(double) + pixels[i].size());
+		pack(payload, indices[i]);
+		pack(payload, seconds[i]);
+		payload.insert(payload.end(), pixels[i].begin(), pixels[i].end());
+		if (not sendMessage(s, TILE_MESSAGE, payload)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool runFarmWorker(const char *host, int port, uint64_t token, FrameRenderFunction renderFrames, TileRenderFunction renderTiles) {
+	signal(SIGPIPE, SIG_IGN);
+
+	int s = connectTo(host, port);
+	if (s < 0) {
+		cout << " Could not connect to the render farm at " << host << ":" << port << ". Bailing ... " << endl;
+		return false;
+	}
+	int noDelay = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+	vector<unsigned char> hello;
+	pack(hello, token);
+	if (not sendMessage(s, HELLO_MESSAGE, hello)) {
+		close(s);
+		return false;
+	}
+
+	// Chunks arrive while the previous one renders, and are queued up here
+	deque<pair<uint32_t, vector<unsigned char> > > chunks;
+	while (true) {
+		// Pick up any new work, waiting for some if there's nothing left to do
+		pollfd polled = { s, POLLIN, 0 };
+		while (poll(&polled, 1, chunks.empty() ? -1 : 0) > 0) {
+			uint32_t type;
+			vector<unsigned char> payload;
+			if (not receiveMessage(s, type, payload) or type == SHUTDOWN_MESSAGE) {
+				close(s);
+				return true;
+			}
+			chunks.push_back(make_pair(type, payload));
+		}
+		if (chunks.empty()) {
+			continue;
+		}
+
+		uint32_t type = chunks.front().first;
+		vector<unsigned char> payload;
+		payload.swap(chunks.front().second);
+		chunks.pop_front();
+
+		bool sent = true;
+		if (type == ASSIGN_MESSAGE) {
+			vector<int> frames;
+			size_t offset = 0;
+			while (offset < payload.size()) {
+				int32_t frame;
+				if (not unpack(payload, offset, frame) or frame < 0) {
+					cout << " Render farm coordinator sent a bad frame number. Bailing ... " << endl;
+					close(s);
+					return true;
+				}
+				frames.push_back(frame);
+			}
+			sent = renderFrameChunk(s, frames, renderFrames);
+		} else if (type == ASSIGN_TILES_MESSAGE) {
+			sent = renderTileChunk(s, payload, renderTiles);
+		}
+		if (not sent) {
+			close(s);
+			return true;
+		}
+	}
+}
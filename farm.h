@@ -0,0 +1,60 @@
+// A render farm spreads the frames of a shot over several worker processes
+//	The coordinator listens on a TCP port and hands out chunks of frames to the
+//	workers that connect to it. It can start local workers itself, which stand in
+//	for other machines when testing; remote workers are started by hand with
+//	"previz worker <host> <port>". Workers render each frame of their chunk and
+//	send the pixels back, and the coordinator writes them out.
+//
+//	For a single frame, the coordinator can instead hand out chunks of its tiles,
+//	with every worker building the frame's scene for itself. Sampling depends only
+//	on the frame and pixel, so a tile comes back the same whichever worker renders it.
+//	A tile's pixels needn't be finished colours: they can be whatever the frame
+//	needs to be finished once every tile is in (e.g. denoised).
+//
+//	Chunks are sized from the measured cost of nearby frames, so that each is
+//	worth a fraction of the remaining work and the last chunks are small. A worker
+//	that dies, or goes quiet for much longer than its frame should take, has its
+//	unfinished frames handed to another worker.
+//
+//	Messages are sent in the host's byte order, so all machines must share it.
+
+#ifndef _FARM_H
+#define _FARM_H
+
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include "tiles.h"
+
+using namespace std;
+
+// Renders one frame into 8-bit RGB pixels, top row first
+typedef function<void(int frame, vector<unsigned char> &pixels, int &width, int &height)> FrameRenderFunction;
+
+// Renders tiles of one frame together, each into its own pixels, top row first
+//	Each pixel is as many bytes as the coordinator expects (see runTileFarmCoordinator).
+//	Also reports how long each tile took to render.
+typedef function<void(int frame, const vector<Tile> &tiles, vector<vector<unsigned char> > &pixels, vector<double> &seconds)> TileRenderFunction;
+
+// Receives a finished frame from a worker
+typedef function<void(int frame, const vector<unsigned char> &pixels, int width, int height)> FrameOutputFunction;
+
+// Renders frames [startFrame, endFrame] on the farm, and returns once all have been output
+//	Starts localWorkerNum workers by running executable, each with threadsPerWorker threads.
+//	port 0 picks any free port. Returns false if the farm could not be set up.
+bool runFarmCoordinator(int startFrame, int endFrame, int localWorkerNum, int threadsPerWorker,
+	int port, const char *executable, FrameOutputFunction output);
+
+// Renders a single width x height frame on the farm, split into tiles, into image
+//	Each pixel is pixelBytes bytes, e.g. 3 for 8-bit RGB; a tile of the wrong size
+//	is refused. Workers are started and ports picked as for runFarmCoordinator.
+bool runTileFarmCoordinator(int frame, int width, int height, int tileSize, int pixelBytes, int localWorkerNum,
+	int threadsPerWorker, int port, const char *executable, vector<unsigned char> &image);
+
+// Connects to the coordinator and renders whatever it asks for, until it says to stop
+//	token is what a local worker was started with, and 0 for workers started by hand.
+//	Returns false if the coordinator could not be reached.
+bool runFarmWorker(const char *host, int port, uint64_t token, FrameRenderFunction renderFrames,
+	TileRenderFunction renderTiles);
+
+#endif
@@ -0,0 +1,146 @@
+#include "frameWriter.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include "frames/QUICKTIME_MOVIE.h"
+
+// O_DIRECT needs the memory, the file offset and the length of every write
+//	to be a multiple of the device's block size; this covers common devices
+static const size_t DIRECT_IO_ALIGNMENT = 4096;
+
+FrameWriter::FrameWriter(int width, int height, int bufferNum, bool directIO, QUICKTIME_MOVIE *movie)
+	: width(width), height(height), directIO(directIO), movie(movie),
+	freeBuffers(bufferNum), pendingWrites(bufferNum)
+{
+	char headerText[64];
+	sprintf(headerText, "P6\n%d %d\n255\n", width, height);
+	header = headerText;
+	fileSize = header.size() + 3 * (size_t) width * height;
+
+	// Round up so the direct writes never run off the end of the buffer
+	size_t bufferSize = (fileSize + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+	for (int i = 0; i < bufferNum; i++) {
+		void *buffer;
+		if (posix_memalign(&buffer, DIRECT_IO_ALIGNMENT, bufferSize) != 0) {
+			cout << " Could not allocate " << bufferNum << " output buffers of " << bufferSize << " bytes. Bailing ... " << endl;
+			exit(0);
+		}
+		header.copy((char *) buffer, header.size());
+		buffers.push_back((unsigned char *) buffer);
+		freeBuffers.push((unsigned char *) buffer);
+	}
+
+	writer = thread(&FrameWriter::writeLoop, this);
+}
+
+FrameWriter::~FrameWriter() {
+	pendingWrites.close();
+	writer.join();
+	for (unsigned char *buffer : buffers) {
+		free(buffer);
+	}
+}
+
+unsigned char *FrameWriter::acquire() {
+	unsigned char *buffer = NULL;
+	if (not freeBuffers.pop(buffer)) {
+		cout << " No free output buffer to render into; the writer has been shut down. Bailing ... " << endl;
+		exit(0);
+	}
+	return buffer + header.size();
+}
+
+void FrameWriter::forEachBuffer(const function<void(unsigned char *pixels)> &visit) {
+	for (unsigned char *buffer : buffers) {
+		visit(buffer + header.size());
+	}
+}
+
+void FrameWriter::submit(unsigned char *pixels, const string &filename) {
+	PendingWrite pending;
+	pending.buffer = pixels - header.size();
+	pending.filename = filename;
+	pendingWrites.push(pending);
+}
+
+void FrameWriter::writeLoop() {
+	PendingWrite pending;
+	while (pendingWrites.pop(pending)) {
+		if (not pending.filename.empty()) {
+			writeFile(pending);
+		}
+		if (movie != NULL) {
+			movie->addFrame(pending.buffer + header.size(), width, height);
+		}
+		freeBuffers.push(pending.buffer);
+	}
+}
+
+// Writes all of data, carrying on after short writes
+static bool writeAll(int file, const unsigned char *data, size_t size) {
+	while (size > 0) {
+		ssize_t written = write(file, data, size);
+		if (written < 0 and errno == EINTR) {
+			continue;
+		}
+		if (written <= 0) {
+			return false;
+		}
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+
+void FrameWriter::writeFile(const PendingWrite &pending) {
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+	if (directIO) {
+		flags |= O_DIRECT;
+	}
+#endif
+	int file = open(pending.filename.c_str(), flags, 0644);
+#ifdef O_DIRECT
+	// Some filesystems (e.g. tmpfs) refuse O_DIRECT; write through the cache there
+	if (file < 0 and directIO) {
+		file = open(pending.filename.c_str(), flags & ~O_DIRECT, 0644);
+	}
+#endif
+	if (file < 0)
+	{
+		cout << " Could not open file \"" << pending.filename.c_str() << "\" for writing." << endl;
+		cout << " Make sure you're not trying to write from a weird location or with a " << endl;
+		cout << " strange filename. Bailing ... " << endl;
+		exit(0);
+	}
+#ifdef F_NOCACHE
+	if (directIO) {
+		fcntl(file, F_NOCACHE, 1);
+	}
+#endif
+
+	// Direct writes must be whole blocks, so the last partial block goes through the cache
+	size_t written = 0;
+#ifdef O_DIRECT
+	if (fcntl(file, F_GETFL) & O_DIRECT) {
+		size_t directSize = fileSize / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+		if (writeAll(file, pending.buffer, directSize)) {
+			written = directSize;
+		} else {
+			lseek(file, 0, SEEK_SET);
+		}
+		fcntl(file, F_SETFL, fcntl(file, F_GETFL) & ~O_DIRECT);
+	}
+#endif
+	bool succeeded = writeAll(file, pending.buffer + written, fileSize - written);
+	close(file);
+
+	if (not succeeded) {
+		cout << " Could not write all of \"" << pending.filename.c_str() << "\". Bailing ... " << endl;
+		exit(0);
+	}
+}
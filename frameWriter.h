@@ -0,0 +1,73 @@
+// Writes rendered frames out to PPM files and/or a movie on a thread of its own
+//	The writer owns a ring of frame buffers, allocated once up front. The
+//	renderer takes a free buffer, renders straight into its 8-bit pixels and
+//	hands it back to be written; the buffer returns to the ring once it's on
+//	disk. The renderer only waits if every buffer is still queued for writing.
+//
+//	Each buffer holds the PPM header right before the pixels, so a whole file
+//	goes out in one large write. Optionally the files are written around the
+//	page cache (O_DIRECT on Linux, F_NOCACHE on macOS), since frames are
+//	written once and not read back.
+//
+//	The frames can also (or instead) be handed to a movie, which compresses
+//	them into the movie file as they come.
+
+#ifndef _FRAME_WRITER_H
+#define _FRAME_WRITER_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <functional>
+#include "boundedQueue.h"
+
+using namespace std;
+
+class QUICKTIME_MOVIE;
+
+class FrameWriter {
+	struct PendingWrite {
+		unsigned char *buffer;
+		string filename;
+	};
+
+	int width, height;
+	string header;	// The PPM header, the same for every frame
+	size_t fileSize;	// Header and pixels
+	bool directIO;
+	QUICKTIME_MOVIE *movie;	// Gets every frame, in the order submitted (may be NULL)
+
+	vector<unsigned char *> buffers;	// Every buffer in the ring
+	BoundedQueue<unsigned char *> freeBuffers;
+	BoundedQueue<PendingWrite> pendingWrites;
+	thread writer;
+
+	void writeLoop();
+	void writeFile(const PendingWrite &pending);
+
+public:
+	// Allocates bufferNum buffers for width x height frames, and starts the writer thread
+	//	If movie isn't NULL, every frame is added to it too.
+	FrameWriter(int width, int height, int bufferNum, bool directIO, QUICKTIME_MOVIE *movie = NULL);
+	// Finishes writing every frame submitted, then frees the buffers
+	~FrameWriter();
+
+	// Returns 3 * width * height bytes to render RGB pixels into, top row first
+	//	Waits if every buffer is still waiting to be written, and bails if none ever can be.
+	unsigned char *acquire();
+
+	// Calls visit on the pixels of every buffer, e.g. to place their pages in memory
+	//	Call before any are acquired.
+	void forEachBuffer(const function<void(unsigned char *pixels)> &visit);
+
+	// Queues pixels from acquire() to be written to the file (if filename isn't empty)
+	//	and added to the movie
+	void submit(unsigned char *pixels, const string &filename);
+
+private:
+	// The writer owns its buffers and thread, so can't be copied
+	FrameWriter(const FrameWriter &);
+	FrameWriter &operator=(const FrameWriter &);
+};
+
+#endif
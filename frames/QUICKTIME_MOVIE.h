@@ -2,11 +2,16 @@
 // This is just a nice interface on Andrew Selle's code:
 // http://physbam.stanford.edu/~aselle/code/make_quicktime.cpp
 //
-// To use, call "addLuminanceFrame" for each frame of your movie
-// (it will set dimensions based on the first frame passed in)
-// and "writeMovie" to write the MOV out when you're done.
+// To use, create the movie with the file to write, call "addLuminanceFrame"
+// or "addFrame" for each frame of your movie (it will set dimensions based on
+// the first frame passed in) and "close" to finish the MOV when you're done.
 //
-// Or, to grab a frame from GL, call "addFrameGL"
+// Frames are JPEG compressed as they arrive, in parallel, one per core, since
+// they don't depend on each other. Each is appended to the file as soon as the
+// frames before it are, so only a few frames are ever held in memory, however
+// long the movie. The sample tables go at the end of the file when it's closed.
+// Frames are still written out in order, so the movie comes out the same
+// whatever the number of cores.
 ///////////////////////////////////////////////////////////////////////
 
 #ifndef QUICKTIME_MOVIE_H
@@ -17,6 +22,12 @@
 #include <string>
 #include <cassert>
 #include <vector>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <jpeglib.h>
 
 #ifdef __linux__
@@ -53,20 +64,89 @@ public:
 
 };
 
+//////////////////////////////////////////////////////////////////////////
+// A libjpeg destination that compresses into a growing memory buffer,
+// so frames can be compressed before they're written to the file
+//////////////////////////////////////////////////////////////////////////
+class JPEG_MEMORY_DESTINATION
+{
+    struct jpeg_destination_mgr manager; // must come first; libjpeg sees only this
+    std::vector<unsigned char>& buffer;
+
+    static void initDestination(j_compress_ptr cinfo)
+    {
+        JPEG_MEMORY_DESTINATION* dest=(JPEG_MEMORY_DESTINATION*)cinfo->dest;
+        dest->buffer.resize(65536);
+        dest->manager.next_output_byte=&dest->buffer[0];
+        dest->manager.free_in_buffer=dest->buffer.size();
+    }
+
+    // the buffer is full, so double it
+    static boolean emptyOutputBuffer(j_compress_ptr cinfo)
+    {
+        JPEG_MEMORY_DESTINATION* dest=(JPEG_MEMORY_DESTINATION*)cinfo->dest;
+        size_t used=dest->buffer.size();
+        dest->buffer.resize(2*used);
+        dest->manager.next_output_byte=&dest->buffer[used];
+        dest->manager.free_in_buffer=dest->buffer.size()-used;
+        return TRUE;
+    }
+
+    static void termDestination(j_compress_ptr cinfo)
+    {
+        JPEG_MEMORY_DESTINATION* dest=(JPEG_MEMORY_DESTINATION*)cinfo->dest;
+        dest->buffer.resize(dest->buffer.size()-dest->manager.free_in_buffer);
+    }
+
+public:
+    JPEG_MEMORY_DESTINATION(j_compress_ptr cinfo,std::vector<unsigned char>& buffer)
+        :buffer(buffer)
+    {
+        manager.init_destination=initDestination;
+        manager.empty_output_buffer=emptyOutputBuffer;
+        manager.term_destination=termDestination;
+        cinfo->dest=&manager;
+    }
+};
+
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 class QUICKTIME_MOVIE {
 
 public:  
-  QUICKTIME_MOVIE() {
+  QUICKTIME_MOVIE(const char* filename) {
     _width = -1;
     _height = -1;
     _totalFrames = 0;
+    _framesWritten = 0;
+    _stopping = false;
+    _closed = false;
+
+    unsigned char EndianTest[2]={0,1};
+    big_endian=*(short*)EndianTest==1;
+
+    std::cout << " Writing movie " << filename << "..." << std::endl;
+    _fp=fopen(filename,"wb");
+    if (_fp == NULL)
+    {
+      std::cout << " Could not open movie \"" << filename << "\" for writing. Bailing ... " << std::endl;
+      exit(0);
+    }
+
+    // The samples (i.e. the mdat part in the quicktime) are written as they come,
+    // and the atom's size is filled in on close
+    _mdatBegin=ftell(_fp);
+    _mdat=new QT_ATOM(_fp,"mdat");
+
+    // Compress frames on every core, with a couple of frames queued for each
+    int threadNum = std::max(1u, std::thread::hardware_concurrency());
+    _maxFramesInFlight = 2 * threadNum;
+    for (int t = 0; t < threadNum; t++)
+      _compressors.push_back(std::thread(&QUICKTIME_MOVIE::compressLoop, this));
   };
 
   ~QUICKTIME_MOVIE() {
-    for (unsigned int x = 0; x < _frameRows.size(); x++)
-      delete[] _frameRows[x];
+    close();
   };
 
   ////////////////////////////////////////////////////////////////////////
@@ -82,9 +162,10 @@ public:
     assert(width == _width);
     assert(height == _height);
 
+    std::vector<JSAMPLE> pixels(3 * _width * _height);
     for (int y = 0; y < _height; y++)
     {
-      JSAMPLE* row = new JSAMPLE[3 * _width];
+      JSAMPLE* row = &pixels[3 * _width * y];
 
       for (int x = 0; x < _width; x++)
       {
@@ -97,10 +178,8 @@ public:
         row[3 * x + 1] = scaled;
         row[3 * x + 2] = scaled;
       }
-
-      _frameRows.push_back(row);
     }
-    _totalFrames++;
+    queueFrame(pixels);
   };
 
   ////////////////////////////////////////////////////////////////////////
@@ -116,87 +195,42 @@ public:
     }
     assert(width == _width);
     assert(height == _height);
-    for (int y = 0; y < _height; y++)
-    {
-      JSAMPLE* row = new JSAMPLE[3 * _width];
-
-      // invert y, because of pixel ordering
-      for (int x = 0; x < _width * 3; x++)
-        //row[x] = image[x + (height - 1 - y) * (3 * _width)];
-        row[x] = image[x + y * (3 * _width)];
 
-      _frameRows.push_back(row);
-    }
-    _totalFrames++;
+    std::vector<JSAMPLE> pixels(image, image + 3 * _width * _height);
+    queueFrame(pixels);
   }
 
   ////////////////////////////////////////////////////////////////////////
-  // dump out the final movie
+  // write out the last frames and the header, and close the file
   ////////////////////////////////////////////////////////////////////////
-  void writeMovie(const char* filename)
+  void close()
   {
-    std::cout << " Writing movie " << filename << "..."; flush(std::cout);
-    unsigned char EndianTest[2]={0,1};
-    big_endian=*(short*)EndianTest==1;
-    //std::cout<<"big endian is "<<big_endian<<std::endl;
+    if (_closed) return;
+    _closed = true;
 
-    FILE *fp=fopen(filename,"w");
+    // finish off every frame still being compressed
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      while (_framesWritten < _totalFrames)
+        writeCompressedFrames(lock, true);
+      _stopping = true;
+    }
+    _frameQueued.notify_all();
+    for (unsigned int t = 0; t < _compressors.size(); t++)
+      _compressors[t].join();
 
+    // fills in the size of mdat
+    delete _mdat;
+
+    FILE *fp=_fp;
     const int frames_per_second=30;
 
     const int frames = _totalFrames;
     const int width = _width;
     const int height = _height;
 
-    std::vector<int> samplesizes;
-    std::vector<int> offsets;
-
-    // Write the samples (i.e. the mdat part in the quicktime)
-    {long mdat_begin=ftell(fp);
-    QT_ATOM mdat(fp,"mdat");
-
-        struct jpeg_compress_struct cinfo;
-        struct jpeg_error_mgr jerr;
-     
-        // this is where image data is set
-        int currentFrameRow = 0;
-        for(int i = 0; i < frames; i++){
-          long initial_pos=ftell(fp);
-          offsets.push_back(initial_pos-mdat_begin);
-          cinfo.err=jpeg_std_error(&jerr);
-
-          jpeg_create_compress(&cinfo);
-          jpeg_stdio_dest(&cinfo,fp);
-          
-          cinfo.image_width=width;
-          cinfo.image_height=height;
-          cinfo.input_components=3;
-          cinfo.in_color_space=JCS_RGB;
-          jpeg_set_defaults(&cinfo);
-
-          jpeg_set_quality(&cinfo,95,TRUE);
-          jpeg_start_compress(&cinfo,TRUE);
-          
-          //int row_stride = cinfo.image_width * 3;
-          //JSAMPLE* row = new JSAMPLE[row_stride];
-          //unsigned char rowi=i;
-          while(cinfo.next_scanline < cinfo.image_height)
-          {
-            JSAMPROW row_pointer[]={_frameRows[currentFrameRow]};
-            /*
-            int j;
-            for(j = 0; j < row_stride; j++) 
-              row[j] = rowi;
-            rowi = (rowi+1) % 256;
-            */
-            jpeg_write_scanlines(&cinfo,row_pointer,1);
-            currentFrameRow++;
-          }
-          jpeg_finish_compress(&cinfo);
-          jpeg_destroy_compress(&cinfo);
-          samplesizes.push_back(ftell(fp)-initial_pos);
-        }
-    }
+    const std::vector<int>& samplesizes = _sampleSizes;
+    const std::vector<int>& offsets = _offsets;
 
     // Write the header
     {QT_ATOM a(fp,"moov");
@@ -337,18 +371,141 @@ public:
         }
     }
     fclose(fp);
-    std::cout << " done." << std::endl;
+    std::cout << " Finished movie with " << frames << " frames." << std::endl;
   }
 
 private:
   // video dimensions
   int _width;
   int _height;
-  std::vector<JSAMPLE*> _frameRows;
   int _totalFrames;
 
+  FILE* _fp;
+  long _mdatBegin;
+  QT_ATOM* _mdat;
+  std::vector<int> _sampleSizes;
+  std::vector<int> _offsets;
+  bool _closed;
+
+  // Frames waiting to be compressed, and compressed frames waiting to be
+  // written, both numbered in movie order. Only the thread adding frames
+  // writes to the file.
+  struct QueuedFrame {
+    int index;
+    std::vector<JSAMPLE> pixels;
+  };
+  std::deque<QueuedFrame> _queuedFrames;
+  std::map<int, std::vector<unsigned char> > _compressedFrames;
+  int _framesWritten;
+  int _maxFramesInFlight;
+  bool _stopping;
+
+  std::vector<std::thread> _compressors;
+  std::mutex _mutex;
+  std::condition_variable _frameQueued;
+  std::condition_variable _frameCompressed;
+
   bool big_endian;
 
+  ////////////////////////////////////////////////////////////////////////
+  // Hand a frame to the compressors, waiting if too many are in flight
+  ////////////////////////////////////////////////////////////////////////
+  void queueFrame(std::vector<JSAMPLE>& pixels)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_totalFrames - _framesWritten >= _maxFramesInFlight)
+      writeCompressedFrames(lock, true);
+
+    _queuedFrames.push_back(QueuedFrame());
+    _queuedFrames.back().index = _totalFrames++;
+    _queuedFrames.back().pixels.swap(pixels);
+    _frameQueued.notify_one();
+
+    writeCompressedFrames(lock, false);
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Append the compressed frames that are next in line to mdat, waiting
+  // for the next one if there are none and wait is set
+  ////////////////////////////////////////////////////////////////////////
+  void writeCompressedFrames(std::unique_lock<std::mutex>& lock, bool wait)
+  {
+    if (wait)
+      _frameCompressed.wait(lock, [this]() { return _compressedFrames.count(_framesWritten) > 0; });
+
+    std::map<int, std::vector<unsigned char> >::iterator next;
+    while ((next = _compressedFrames.find(_framesWritten)) != _compressedFrames.end())
+    {
+      std::vector<unsigned char> jpeg;
+      jpeg.swap(next->second);
+      _compressedFrames.erase(next);
+
+      // nobody else touches the file, so let the compressors carry on meanwhile
+      lock.unlock();
+      long initial_pos=ftell(_fp);
+      _offsets.push_back(initial_pos-_mdatBegin);
+      fwrite(&jpeg[0],1,jpeg.size(),_fp);
+      _sampleSizes.push_back(ftell(_fp)-initial_pos);
+      lock.lock();
+
+      _framesWritten++;
+    }
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Each compressor thread takes frames off the queue until the movie closes
+  ////////////////////////////////////////////////////////////////////////
+  void compressLoop()
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+      _frameQueued.wait(lock, [this]() { return _stopping || !_queuedFrames.empty(); });
+      if (_queuedFrames.empty()) return;
+
+      QueuedFrame queued;
+      std::swap(queued, _queuedFrames.front());
+      _queuedFrames.pop_front();
+      lock.unlock();
+
+      std::vector<unsigned char> jpeg;
+      compressFrame(&queued.pixels[0], jpeg);
+
+      lock.lock();
+      _compressedFrames[queued.index].swap(jpeg);
+      _frameCompressed.notify_all();
+    }
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // JPEG compress one frame's pixels into memory
+  ////////////////////////////////////////////////////////////////////////
+  void compressFrame(JSAMPLE* pixels, std::vector<unsigned char>& jpeg) const
+  {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err=jpeg_std_error(&jerr);
+
+    jpeg_create_compress(&cinfo);
+    JPEG_MEMORY_DESTINATION destination(&cinfo,jpeg);
+
+    cinfo.image_width=_width;
+    cinfo.image_height=_height;
+    cinfo.input_components=3;
+    cinfo.in_color_space=JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+
+    jpeg_set_quality(&cinfo,95,TRUE);
+    jpeg_start_compress(&cinfo,TRUE);
+    while(cinfo.next_scanline < cinfo.image_height)
+    {
+      JSAMPROW row_pointer[]={pixels + 3 * _width * cinfo.next_scanline};
+      jpeg_write_scanlines(&cinfo,row_pointer,1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+  }
+
   template<class T>
   inline void Swap_Endianity(T& x)
   { 
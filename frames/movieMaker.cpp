@@ -59,7 +59,8 @@ bool readPPM(const char* filename, unsigned char*& pixels, int& width, int& heig
 //////////////////////////////////////////////////////////////////////////////////
 int main(int argc, char** argv)
 {
-  QUICKTIME_MOVIE movie;
+  // frames are compressed and written out as they are read in
+  QUICKTIME_MOVIE movie("movie.mov");
 
   bool readSuccess = true;
   int frameNumber = 0;
@@ -82,8 +83,8 @@ int main(int argc, char** argv)
     frameNumber++;
   }
 
-  // write out the compiled movie
-  movie.writeMovie("movie.mov");
+  // write out the rest of the movie
+  movie.close();
 
   return 0;
 }
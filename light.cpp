@@ -0,0 +1,118 @@
+#include "light.h"
+#include "sampler.h"
+
+#include <cmath>
+
+using namespace std;
+
+Light rectangleLight(VEC3 centre, VEC3 edgeU, VEC3 edgeV, VEC3 colour) {
+	Light light{ centre, colour };
+	light.shape = RECTANGLE_LIGHT;
+	light.edgeU = edgeU;
+	light.edgeV = edgeV;
+	light.normal = edgeU.cross(edgeV).normalized();
+	return light;
+}
+
+Light discLight(VEC3 centre, VEC3 normal, float radius, VEC3 colour) {
+	Light light{ centre, colour };
+	light.shape = DISC_LIGHT;
+	light.normal = normal.normalized();
+	light.radius = radius;
+
+	// Any two radii at right angles to each other and the normal
+	VEC3 other = fabs(light.normal[0]) < 0.9 ? VEC3(1, 0, 0) : VEC3(0, 1, 0);
+	light.edgeU = light.normal.cross(other).normalized() * radius;
+	light.edgeV = light.normal.cross(light.edgeU);
+	return light;
+}
+
+Light sphereLight(VEC3 centre, float radius, VEC3 colour) {
+	Light light{ centre, colour };
+	light.shape = SPHERE_LIGHT;
+	light.radius = radius;
+	return light;
+}
+
+AABB lightBounds(const Light &light) {
+	AABB box;
+	switch (light.shape) {
+	case RECTANGLE_LIGHT:
+	case DISC_LIGHT:
+		// The disc fits in the square with its radii as edges
+		for (int i = -1; i <= 1; i += 2) {
+			for (int j = -1; j <= 1; j += 2) {
+				box.expand(light.pos + i * light.edgeU + j * light.edgeV);
+			}
+		}
+		break;
+	case SPHERE_LIGHT:
+		box.expand(light.pos - VEC3::Constant(light.radius));
+		box.expand(light.pos + VEC3::Constant(light.radius));
+		break;
+	default:
+		box.expand(light.pos);
+	}
+	return box;
+}
+
+// Weight of a point picked evenly by area on a flat light: the solid angle a
+//	little patch of it fills, seen from point (the geometry term)
+static float geometryTerm(VEC3 lightPoint, VEC3 lightNormal, VEC3 point) {
+	VEC3 toPoint = point - lightPoint;
+	float distanceSquared = toPoint.squaredNorm();
+	if (distanceSquared == 0) {
+		return 0;
+	}
+	return fabs(lightNormal.dot(toPoint)) / (distanceSquared * sqrt(distanceSquared));
+}
+
+VEC3 sampleLightPoint(const Light &light, VEC3 point, float u, float v, float &weight) {
+	switch (light.shape) {
+	case RECTANGLE_LIGHT: {
+		VEC3 sample = light.pos + (2 * u - 1) * light.edgeU + (2 * v - 1) * light.edgeV;
+		weight = geometryTerm(sample, light.normal, point);
+		return sample;
+	}
+	case DISC_LIGHT: {
+		float x, y;
+		squareToDisc(u, v, x, y);
+		VEC3 sample = light.pos + x * light.edgeU + y * light.edgeV;
+		weight = geometryTerm(sample, light.normal, point);
+		return sample;
+	}
+	case SPHERE_LIGHT: {
+		VEC3 toCentre = light.pos - point;
+		float distance = toCentre.norm();
+		weight = 1;
+		if (distance <= light.radius) {
+			// Inside the light, which is then all around
+			float cosTheta = 1 - 2 * u;
+			float sinTheta = sqrt(max(0.0f, 1 - cosTheta * cosTheta));
+			float phi = 2 * M_PI * v;
+			return light.pos + light.radius * VEC3(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta);
+		}
+
+		// Pick a direction evenly inside the cone the sphere fills
+		float sinThetaMaxSquared = light.radius * light.radius / (distance * distance);
+		float cosThetaMax = sqrt(max(0.0f, 1 - sinThetaMaxSquared));
+		float cosTheta = 1 - u * (1 - cosThetaMax);
+		float sinTheta = sqrt(max(0.0f, 1 - cosTheta * cosTheta));
+		float phi = 2 * M_PI * v;
+
+		VEC3 w = toCentre / distance;
+		VEC3 other = fabs(w[0]) < 0.9 ? VEC3(1, 0, 0) : VEC3(0, 1, 0);
+		VEC3 a = w.cross(other).normalized();
+		VEC3 b = w.cross(a);
+		VEC3 direction = cosTheta * w + sinTheta * (cos(phi) * a + sin(phi) * b);
+
+		// Where that direction first meets the sphere
+		float along = distance * cosTheta;
+		float inside = light.radius * light.radius - distance * distance * sinTheta * sinTheta;
+		return point + (along - sqrt(max(0.0f, inside))) * direction;
+	}
+	default:
+		weight = 1;
+		return light.pos;
+	}
+}
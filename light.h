@@ -1,8 +1,40 @@
+// Lights, and the points on them that soft shadows are sampled at
+//	A point light is just its position. Area lights (rectangles, discs and
+//	spheres) are sampled over the solid angle they fill as seen from the point
+//	being shaded, so each shadow ray stands for an equal part of what's
+//	visible of the light. Rectangles and discs shine from both faces.
+//
+//	Shading itself still treats the light as if it were all at its centre;
+//	the samples only decide how much of the light is blocked.
+
 #ifndef _LIGHT_H
 #define _LIGHT_H
 
+#include "SETTINGS.h"
+#include "bvh.h"
+
+enum LightShape {
+	POINT_LIGHT = 0, RECTANGLE_LIGHT, DISC_LIGHT, SPHERE_LIGHT
+};
+
 struct Light {
-	VEC3 pos, colour;
+	VEC3 pos, colour;	// pos is the centre of an area light
+	LightShape shape;	// Light{ pos, colour } is a point light
+	VEC3 edgeU, edgeV;	// Rectangle: from the centre to the middle of two adjacent sides
+	VEC3 normal;	// Disc
+	float radius;	// Disc and sphere
 };
 
-#endif
\ No newline at end of file
+Light rectangleLight(VEC3 centre, VEC3 edgeU, VEC3 edgeV, VEC3 colour);
+Light discLight(VEC3 centre, VEC3 normal, float radius, VEC3 colour);
+Light sphereLight(VEC3 centre, float radius, VEC3 colour);
+
+// The box containing every point of the light
+AABB lightBounds(const Light &light);
+
+// Picks the point on the light for the sample (u, v) in [0, 1)^2, as seen from point
+//	The point's weight converts the way it was picked into an even share of the
+//	light's solid angle; weights of 0 are points that can't be seen from there.
+VEC3 sampleLightPoint(const Light &light, VEC3 point, float u, float v, float &weight);
+
+#endif
@@ -0,0 +1,115 @@
+#include "lightTree.h"
+
+#include <cmath>
+#include <algorithm>
+
+// Lights behind the surface still get this much of a chance, as if a little in front
+//	of it, so nothing they add (e.g. to surfaces whose normals face away) is left out
+static const float MIN_ORIENTATION_WEIGHT = 0.05;
+
+void LightTree::build(const vector<Light> &lights) {
+	nodes.clear();
+	if (lights.empty()) {
+		return;
+	}
+
+	vector<AABB> boxes(lights.size());
+	vector<int> order(lights.size());
+	for (unsigned int i = 0; i < lights.size(); i++) {
+		boxes[i] = lightBounds(lights[i]);
+		order[i] = i;
+	}
+
+	// One light per leaf makes 2n - 1 nodes
+	nodes.reserve(2 * lights.size());
+	buildNode(lights, boxes, order, 0, lights.size());
+}
+
+// Splits the lights at the median along the axis where their centres are most spread out
+int LightTree::buildNode(const vector<Light> &lights, const vector<AABB> &boxes, vector<int> &order, int first, int count) {
+	int index = nodes.size();
+	nodes.push_back(LightTreeNode());
+
+	AABB box, centreBox;
+	float power = 0;
+	for (int i = first; i < first + count; i++) {
+		const Light &light = lights[order[i]];
+		box.expand(boxes[order[i]]);
+		centreBox.expand(light.pos);
+		power += light.colour.sum() / 3;
+	}
+
+	nodes[index].box = box;
+	nodes[index].power = power;
+	nodes[index].rightChild = -1;
+	nodes[index].light = count == 1 ? order[first] : -1;
+	if (count == 1) {
+		return index;
+	}
+
+	VEC3 extent = centreBox.hi - centreBox.lo;
+	int axis = 0;
+	if (extent[1] > extent[axis]) axis = 1;
+	if (extent[2] > extent[axis]) axis = 2;
+
+	int half = count / 2;
+	vector<int>::iterator begin = order.begin() + first;
+	nth_element(begin, begin + half, begin + count, [&](int a, int b) {
+		return lights[a].pos[axis] < lights[b].pos[axis];
+	});
+
+	// Left child is always the next node, so only the right child is recorded
+	buildNode(lights, boxes, order, first, half);
+	int right = buildNode(lights, boxes, order, first + half, count - half);
+	nodes[index].rightChild = right;
+	return index;
+}
+
+// The node's power, times the most the diffuse cosine can be for any point in the box:
+//	the cosine of the angle between the normal and the nearest edge of the cone
+//	around the box's bounding sphere
+float LightTree::importance(const LightTreeNode &node, VEC3 point, VEC3 normal) const {
+	VEC3 toCentre = node.box.center() - point;
+	float distance = toCentre.norm();
+	float radius = (node.box.hi - node.box.lo).norm() / 2;
+	if (distance <= radius) {
+		return node.power;
+	}
+
+	float cosine = normal.dot(toCentre) / distance;
+	float angle = acos(max(-1.0f, min(1.0f, cosine)));
+	float coneAngle = asin(radius / distance);
+	float orientation = angle <= coneAngle ? 1 : cos(angle - coneAngle);
+	return node.power * max(MIN_ORIENTATION_WEIGHT, orientation);
+}
+
+int LightTree::sampleLight(VEC3 point, VEC3 normal, float u, float &probability) const {
+	probability = 0;
+	if (nodes.empty()) {
+		return -1;
+	}
+
+	// Go down one side at each level, reusing what's left of u for the next choice
+	probability = 1;
+	int index = 0;
+	while (nodes[index].light < 0) {
+		int left = index + 1;
+		int right = nodes[index].rightChild;
+		float leftImportance = importance(nodes[left], point, normal);
+		float rightImportance = importance(nodes[right], point, normal);
+		float total = leftImportance + rightImportance;
+		float leftProbability = total > 0 ? leftImportance / total : 0.5;
+
+		if (u < leftProbability) {
+			u /= leftProbability;
+			probability *= leftProbability;
+			index = left;
+		} else {
+			u = (u - leftProbability) / (1 - leftProbability);
+			probability *= 1 - leftProbability;
+			index = right;
+		}
+		u = min(u, 0.99999994f);
+	}
+	return nodes[index].light;
+}
@@ -0,0 +1,51 @@
+// A light tree, for scenes with too many lights to shade every one of them
+//	The lights are grouped into a binary tree of bounding boxes, each node
+//	knowing how bright the lights under it are together. A shading point picks
+//	a light by walking down from the root, going left or right in proportion to
+//	how much each child could light the point (its brightness, and how far it
+//	can be in front of the surface), so a sample costs one step per level of
+//	the tree rather than one shadow test per light. Dividing by the chance of
+//	the pick keeps the average the same as shading every light.
+//
+//	Lights here don't fade with distance, so distance doesn't come into it.
+
+#ifndef _LIGHT_TREE_H
+#define _LIGHT_TREE_H
+
+#include <vector>
+#include "SETTINGS.h"
+#include "light.h"
+#include "bvh.h"
+
+using namespace std;
+
+// A node in the flattened tree
+//	As in the BVH, nodes are stored depth-first, so the left child of a node is the next node
+struct LightTreeNode {
+	AABB box;	// Bounds everything of every light under the node
+	float power;	// Sum of the brightness of the lights under the node
+	int rightChild;	// Index of the right child (interior nodes only)
+	int light;	// Index of the light in the scene's list (leaves only, else -1)
+};
+
+class LightTree {
+	vector<LightTreeNode> nodes;
+
+	// Recursively builds the node over lights [first, first + count) of order
+	int buildNode(const vector<Light> &lights, const vector<AABB> &boxes, vector<int> &order, int first, int count);
+
+	// How much the node's lights could light a point with this normal, up to a constant
+	float importance(const LightTreeNode &node, VEC3 point, VEC3 normal) const;
+
+public:
+	void build(const vector<Light> &lights);
+
+	bool empty() const { return nodes.empty(); }
+
+	// Picks a light to shade the point with, using u in [0, 1)
+	//	Returns the light's index, and sets probability to the chance it was picked
+	//	(or returns -1 if there are no lights)
+	int sampleLight(VEC3 point, VEC3 normal, float u, float &probability) const;
+};
+
+#endif
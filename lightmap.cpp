@@ -0,0 +1,322 @@
+#include "lightmap.h"
+#include "shader.h"
+#include "physicsWorld.h"
+#include "rng.h"
+#include "pagedMesh.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/stat.h>
+
+extern const float LIGHTMAP_TEXEL_SIZE;	// Rough width of a texel in the world
+extern const int LIGHTMAP_SAMPLE_ROOT;	// sqrt of the shadow rays per texel per light
+
+// Most texels across a lightmap, whatever the triangle's size
+static const int MAX_TEXELS = 1024;
+
+// Texels further than this many texels off their triangle are never looked up, so aren't baked
+static const float TEXEL_MARGIN = 1.5;
+
+// Marks the texels that weren't baked
+static const float UNBAKED = -1;
+
+// Changes whenever the file layout or what's baked into it does
+static const uint32_t LIGHTMAP_VERSION = 1;
+static const char LIGHTMAP_MAGIC[4] = { 'L', 'M', 'A', 'P' };
+
+static uint64_t hashReal(uint64_t key, Real value) {
+	uint64_t bits = 0;
+	memcpy(&bits, &value, min(sizeof(bits), sizeof(value)));
+	return hashKey(key, bits);
+}
+
+static uint64_t hashVector(uint64_t key, const VEC3 &vector) {
+	for (int i = 0; i < 3; i++) {
+		key = hashReal(key, vector[i]);
+	}
+	return key;
+}
+
+// The matrix taking texture coordinates (less those of vertex a) to the
+//	barycentric coordinates of vertices b and c
+static MATRIX2 textureToBarycentric(VEC2 texA, VEC2 texB, VEC2 texC) {
+	MATRIX2 edges;
+	edges.col(0) = texB - texA;
+	edges.col(1) = texC - texA;
+	return edges.inverse();
+}
+
+Lightmaps::Lightmaps()
+	: lightNum(0), sceneKey(0)
+{}
+
+uint64_t Lightmaps::triangleKey(const Triangle &triangle) {
+	return hashVector(hashVector(hashVector(0, triangle.a), triangle.b), triangle.c);
+}
+
+bool Lightmaps::canBake(const Triangle &triangle) {
+	VEC2 texA, texB, texC;
+	triangle.getTextureCoords(texA, texB, texC);
+	MATRIX2 edges;
+	edges.col(0) = texB - texA;
+	edges.col(1) = texC - texA;
+	return fabs(edges.determinant()) > 1e-8;
+}
+
+uint64_t Lightmaps::makeSceneKey(const vector<const Shape *> &staticShapes, const vector<Light> &lights) {
+	uint64_t key = hashKey(hashKey(hashReal(0, LIGHTMAP_TEXEL_SIZE), LIGHTMAP_SAMPLE_ROOT), LIGHTMAP_VERSION);
+
+	// Every static shape can cast a shadow, but only triangles and paged meshes can be identified
+	key = hashKey(key, staticShapes.size());
+	for (const Shape *shape : staticShapes) {
+		const PagedMesh *mesh = dynamic_cast<const PagedMesh *>(shape);
+		if (mesh != NULL) {
+			key = hashKey(key, mesh->getKey());
+			continue;
+		}
+		const Triangle *triangle = dynamic_cast<const Triangle *>(shape);
+		if (triangle == NULL) {
+			continue;
+		}
+		VEC2 texA, texB, texC;
+		triangle->getTextureCoords(texA, texB, texC);
+		key = hashKey(key, triangleKey(*triangle));
+		for (int i = 0; i < 2; i++) {
+			key = hashReal(hashReal(hashReal(key, texA[i]), texB[i]), texC[i]);
+		}
+	}
+
+	key = hashKey(key, lights.size());
+	for (const Light &light : lights) {
+		key = hashVector(hashVector(key, light.pos), light.colour);
+		key = hashVector(hashVector(hashVector(hashKey(key, light.shape), light.edgeU), light.edgeV), light.normal);
+		key = hashReal(key, light.radius);
+	}
+	return key;
+}
+
+// Texels are laid out on a grid over the rectangle of the triangle's texture
+//	coordinates, so the ones the triangle covers form a triangle too. Their
+//	points in the world follow from the texture coordinates of the vertices.
+void Lightmaps::bakeTriangle(const Triangle &triangle, const Shader &shader, TriangleLightmap &map, ThreadPool &pool) const {
+	VEC2 texA, texB, texC;
+	triangle.getTextureCoords(texA, texB, texC);
+	map.uvLo = texA.cwiseMin(texB).cwiseMin(texC);
+	map.uvHi = texA.cwiseMax(texB).cwiseMax(texC);
+	VEC2 uvRange = map.uvHi - map.uvLo;
+
+	// How far a step along u and v goes in the world, which sets the texel counts
+	MATRIX2 toBarycentric = textureToBarycentric(texA, texB, texC);
+	VEC3 edgeB = triangle.b - triangle.a;
+	VEC3 edgeC = triangle.c - triangle.a;
+	VEC3 alongU = edgeB * toBarycentric(0, 0) + edgeC * toBarycentric(1, 0);
+	VEC3 alongV = edgeB * toBarycentric(0, 1) + edgeC * toBarycentric(1, 1);
+	map.width = max(2, min(MAX_TEXELS, (int) ceil(alongU.norm() * uvRange[0] / LIGHTMAP_TEXEL_SIZE)));
+	map.height = max(2, min(MAX_TEXELS, (int) ceil(alongV.norm() * uvRange[1] / LIGHTMAP_TEXEL_SIZE)));
+
+	float texelWidth = (alongU * uvRange[0] / map.width).norm();
+	float texelHeight = (alongV * uvRange[1] / map.height).norm();
+	float margin = TEXEL_MARGIN * sqrt(texelWidth * texelWidth + texelHeight * texelHeight);
+
+	int texelNum = map.width * map.height;
+	map.visibility.assign(texelNum * lightNum, UNBAKED);
+	uint64_t key = triangleKey(triangle);
+
+	pool.run(map.height, [&](int row) {
+		for (int column = 0; column < map.width; column++) {
+			VEC2 uv = map.uvLo + VEC2((column + 0.5) / map.width * uvRange[0], (row + 0.5) / map.height * uvRange[1]);
+			VEC2 barycentric = toBarycentric * (uv - texA);
+			VEC3 weights(1 - barycentric[0] - barycentric[1], barycentric[0], barycentric[1]);
+			VEC3 point = weights[0] * triangle.a + weights[1] * triangle.b + weights[2] * triangle.c;
+
+			// Texels just off the triangle are baked at the nearby point on it, for
+			//	lookups that blend in their neighbours along the edges
+			weights = weights.cwiseMax(0.0);
+			weights /= weights.sum();
+			VEC3 onTriangle = weights[0] * triangle.a + weights[1] * triangle.b + weights[2] * triangle.c;
+			if ((onTriangle - point).norm() > margin) {
+				continue;
+			}
+
+			int texel = row * map.width + column;
+			for (int light = 0; light < lightNum; light++) {
+				uint64_t texelKey = hashKey(hashKey(key, light), texel);
+				map.visibility[light * texelNum + texel] = shader.estimateLightVisibility(onTriangle, light, LIGHTMAP_SAMPLE_ROOT, texelKey);
+			}
+		}
+	});
+}
+
+void Lightmaps::bake(const vector<const Shape *> &staticShapes, const vector<Light> &lights, ThreadPool &pool) {
+	maps.clear();
+	mapIndices.clear();
+	lightNum = lights.size();
+	sceneKey = makeSceneKey(staticShapes, lights);
+
+	// Only the static shapes cast the baked shadows
+	PhysicsWorld world(staticShapes);
+	Shader shader(lights, world, VEC3(0, 0, 0));
+
+	for (const Shape *shape : staticShapes) {
+		const Triangle *triangle = dynamic_cast<const Triangle *>(shape);
+		if (triangle == NULL or not canBake(*triangle)) {
+			continue;
+		}
+		uint64_t key = triangleKey(*triangle);
+		if (mapIndices.count(key) > 0) {
+			continue;
+		}
+		maps.push_back(TriangleLightmap());
+		bakeTriangle(*triangle, shader, maps.back(), pool);
+		mapIndices[key] = maps.size() - 1;
+	}
+}
+
+// The file holds the magic number, version, scene key, number of lights and
+//	of maps, then each map's triangle key, texture coordinates, size and texels
+bool Lightmaps::load(const string &filename, uint64_t expectedKey) {
+	FILE *fp = fopen(filename.c_str(), "rb");
+	if (fp == NULL) {
+		return false;
+	}
+
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	int32_t storedLightNum, mapNum;
+	bool read = fread(magic, sizeof(magic), 1, fp) == 1 and memcmp(magic, LIGHTMAP_MAGIC, sizeof(magic)) == 0 and
+		fread(&version, sizeof(version), 1, fp) == 1 and version == LIGHTMAP_VERSION and
+		fread(&key, sizeof(key), 1, fp) == 1 and key == expectedKey and
+		fread(&storedLightNum, sizeof(storedLightNum), 1, fp) == 1 and
+		fread(&mapNum, sizeof(mapNum), 1, fp) == 1 and storedLightNum >= 0 and mapNum >= 0;
+
+	vector<TriangleLightmap> loadedMaps;
+	unordered_map<uint64_t, int> loadedIndices;
+	for (int i = 0; read and i < mapNum; i++) {
+		TriangleLightmap map;
+		uint64_t triangle;
+		double uv[4];
+		int32_t size[2];
+		read = fread(&triangle, sizeof(triangle), 1, fp) == 1 and fread(uv, sizeof(uv), 1, fp) == 1 and
+			fread(size, sizeof(size), 1, fp) == 1 and
+			size[0] > 0 and size[0] <= MAX_TEXELS and size[1] > 0 and size[1] <= MAX_TEXELS;
+		if (not read) {
+			break;
+		}
+		map.uvLo = VEC2(uv[0], uv[1]);
+		map.uvHi = VEC2(uv[2], uv[3]);
+		map.width = size[0];
+		map.height = size[1];
+		map.visibility.resize(map.width * map.height * storedLightNum);
+		read = map.visibility.empty() or
+			fread(map.visibility.data(), sizeof(float), map.visibility.size(), fp) == map.visibility.size();
+		loadedIndices[triangle] = loadedMaps.size();
+		loadedMaps.push_back(move(map));
+	}
+	fclose(fp);
+
+	if (not read) {
+		return false;
+	}
+	maps = move(loadedMaps);
+	mapIndices = move(loadedIndices);
+	lightNum = storedLightNum;
+	sceneKey = key;
+	return true;
+}
+
+// Written to a file of its own next to the file and then moved over it, so a
+//	reader never sees half of one, and neither does another process saving at once
+bool Lightmaps::save(const string &filename) const {
+	vector<char> partFilename(filename.begin(), filename.end());
+	const char suffix[] = ".part.XXXXXX";
+	partFilename.insert(partFilename.end(), suffix, suffix + sizeof(suffix));
+	int fd = mkstemp(partFilename.data());
+	if (fd < 0) {
+		return false;
+	}
+	fchmod(fd, 0644);	// mkstemp makes it private to us
+	FILE *fp = fdopen(fd, "wb");
+	if (fp == NULL) {
+		close(fd);
+		remove(partFilename.data());
+		return false;
+	}
+
+	vector<uint64_t> triangles(maps.size());
+	for (const auto &entry : mapIndices) {
+		triangles[entry.second] = entry.first;
+	}
+
+	int32_t header[2] = { lightNum, (int32_t) maps.size() };
+	bool written = fwrite(LIGHTMAP_MAGIC, sizeof(LIGHTMAP_MAGIC), 1, fp) == 1 and
+		fwrite(&LIGHTMAP_VERSION, sizeof(LIGHTMAP_VERSION), 1, fp) == 1 and
+		fwrite(&sceneKey, sizeof(sceneKey), 1, fp) == 1 and
+		fwrite(header, sizeof(header), 1, fp) == 1;
+	for (unsigned int i = 0; written and i < maps.size(); i++) {
+		const TriangleLightmap &map = maps[i];
+		double uv[4] = { map.uvLo[0], map.uvLo[1], map.uvHi[0], map.uvHi[1] };
+		int32_t size[2] = { map.width, map.height };
+		written = fwrite(&triangles[i], sizeof(triangles[i]), 1, fp) == 1 and fwrite(uv, sizeof(uv), 1, fp) == 1 and
+			fwrite(size, sizeof(size), 1, fp) == 1 and
+			fwrite(map.visibility.data(), sizeof(float), map.visibility.size(), fp) == map.visibility.size();
+	}
+	written = fclose(fp) == 0 and written;
+
+	if (not written or rename(partFilename.data(), filename.c_str()) != 0) {
+		remove(partFilename.data());
+		return false;
+	}
+	return true;
+}
+
+// Blends the 4 texels around the point, leaving out any that weren't baked
+bool Lightmaps::lookup(const Shape *shape, VEC3 point, int lightIndex, float &visibility) const {
+	if (mapIndices.empty() or lightIndex >= lightNum) {
+		return false;
+	}
+	const Triangle *triangle = dynamic_cast<const Triangle *>(shape);
+	if (triangle == NULL) {
+		return false;
+	}
+	unordered_map<uint64_t, int>::const_iterator found = mapIndices.find(triangleKey(*triangle));
+	if (found == mapIndices.end()) {
+		return false;
+	}
+	const TriangleLightmap &map = maps[found->second];
+
+	VEC2 uv = triangle->getTextureCoordsAt(point);
+	float x = (uv[0] - map.uvLo[0]) / (map.uvHi[0] - map.uvLo[0]) * map.width - 0.5;
+	float y = (uv[1] - map.uvLo[1]) / (map.uvHi[1] - map.uvLo[1]) * map.height - 0.5;
+	if (not (x > -1 and x < map.width and y > -1 and y < map.height)) {
+		return false;	// Off the map, or not a number
+	}
+	int left = floor(x);
+	int top = floor(y);
+	float fx = x - left;
+	float fy = y - top;
+
+	const float *texels = map.visibility.data() + lightIndex * map.width * map.height;
+	float sum = 0;
+	float weightSum = 0;
+	for (int dy = 0; dy <= 1; dy++) {
+		for (int dx = 0; dx <= 1; dx++) {
+			int column = min(map.width - 1, max(0, left + dx));
+			int row = min(map.height - 1, max(0, top + dy));
+			float texel = texels[row * map.width + column];
+			if (texel == UNBAKED) {
+				continue;
+			}
+			float weight = (dx ? fx : 1 - fx) * (dy ? fy : 1 - fy);
+			sum += weight * texel;
+			weightSum += weight;
+		}
+	}
+	if (weightSum <= 0) {
+		return false;
+	}
+	visibility = sum / weightSum;
+	return true;
+}
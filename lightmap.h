@@ -0,0 +1,75 @@
+// Baked shadows for the triangles that never move
+//	The lights, the floor, the walls and the cube stay where they are for the
+//	whole first scene, so the share of each light that reaches a point on them
+//	past the other static shapes is the same every frame. Baking it once into a
+//	grid of texels (a lightmap) over each textured triangle's texture
+//	coordinates, and keeping it on disk, leaves shadow rays at render time only
+//	for the moving skeleton, which still shadows the baked surfaces.
+//
+//	Triangles without texture coordinates (the cube) aren't baked, and are
+//	shaded as before. A bake is only used for the triangles and lights it was
+//	made from; a saved one that doesn't match the scene is baked again.
+
+#ifndef _LIGHTMAP_H
+#define _LIGHTMAP_H
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+#include "SETTINGS.h"
+#include "shapes.h"
+#include "light.h"
+#include "threadPool.h"
+
+using namespace std;
+
+class Shader;
+
+// One triangle's lightmap
+struct TriangleLightmap {
+	VEC2 uvLo, uvHi;	// Rectangle of texture coordinates the texels cover
+	int width, height;	// Texels across u and v
+	vector<float> visibility;	// Visible share of each light per texel, one light's texels after another
+
+	TriangleLightmap() : uvLo(0, 0), uvHi(0, 0), width(0), height(0) {}
+};
+
+class Lightmaps {
+	vector<TriangleLightmap> maps;
+	unordered_map<uint64_t, int> mapIndices;	// Each baked triangle's map, by its key
+	int lightNum;
+	uint64_t sceneKey;	// Hash of what was baked, 0 if nothing was
+
+	// Identifies a triangle by its vertices, which are the same whenever the scene is built
+	static uint64_t triangleKey(const Triangle &triangle);
+
+	// Whether the triangle has texture coordinates to lay a lightmap out over
+	static bool canBake(const Triangle &triangle);
+
+	// Lays out the texels of the triangle's map and fills them in
+	//	shader traces shadow rays against the static shapes.
+	void bakeTriangle(const Triangle &triangle, const Shader &shader, TriangleLightmap &map, ThreadPool &pool) const;
+
+public:
+	Lightmaps();
+
+	// The key a bake of these static shapes and lights (with the current settings) would have
+	static uint64_t makeSceneKey(const vector<const Shape *> &staticShapes, const vector<Light> &lights);
+
+	// Bakes every static triangle that can be, using the pool's threads
+	void bake(const vector<const Shape *> &staticShapes, const vector<Light> &lights, ThreadPool &pool);
+
+	// Reads a bake from the file, and returns true, if it was made with this key
+	bool load(const string &filename, uint64_t expectedKey);
+	// Writes the bake to the file, returning false if it couldn't
+	//	Processes saving the same bake at once (e.g. local farm workers) each write
+	//	a whole file of their own, and the last one moved into place wins.
+	bool save(const string &filename) const;
+
+	// Sets the baked visible share of lights[lightIndex] at the point on the shape,
+	//	and returns true, if the shape was baked
+	bool lookup(const Shape *shape, VEC3 point, int lightIndex, float &visibility) const;
+};
+
+#endif
@@ -1,15 +1,21 @@
 #include "material.h"
 #include "raytracer.h"
+#include "sampler.h"
 
 extern const int GLOSSY_REFLECTION_SAMPLE_NUM;	// Number of reflection points to shoot out
+extern const int RUSSIAN_ROULETTE_DEPTH;	// Glossy bounces before paths may be ended at random
 
 Material::Material() {}
 
+VEC3 Material::calculateIndirectShading(const Shape *shape, VEC3 point, VEC3 normal, VEC3 eyeDir, const Ray &ray) const {
+	return VEC3(0, 0, 0);
+}
+
 Plastic::Plastic(float cPhong)
 	: Material(), cPhong(cPhong) {}
 
 // Calculates the Phong shading for a single light source
-VEC3 Plastic::calculateShading(const Shape *shape, VEC3 point, VEC3 normal, const Light &light, VEC3 eyeDir) const {
+VEC3 Plastic::calculateDirectShading(const Shape *shape, VEC3 point, VEC3 normal, const Light &light, int lightIndex, VEC3 eyeDir, const SamplePath &path) const {
 	// Calculate light direction
 	VEC3 lightDir = (light.pos - point).normalized();
 
@@ -36,7 +42,7 @@ Metal::Metal(float cGaussian, float cReflection)
 //	line 113-176, provided on 19th April 2021. We edited this 
 //	code to convert it from GLSL to C++ and make it more legible 
 //	and consistent within the context of our program.
-VEC3 Metal::calculateShading(const Shape *shape, VEC3 point, VEC3 normal, const Light &light, VEC3 eyeDir) const {
+VEC3 Metal::calculateDirectShading(const Shape *shape, VEC3 point, VEC3 normal, const Light &light, int lightIndex, VEC3 eyeDir, const SamplePath &path) const {
 	// material properties
 	VEC3 mat_diffuse = shape->getColourAt(point);	// Main colour of the material, I think?
 	//VEC3(0.0, 0.0, 1.0);VEC3(1.0, 1.0, 1.0);
@@ -91,74 +97,68 @@ VEC3 Metal::calculateShading(const Shape *shape, VEC3 point, VEC3 normal, const
 GlossyPlastic::GlossyPlastic(float cPhong, RayTracer *&rayTracer)
 	: Plastic(cPhong), rayTracer(rayTracer) {}
 
-VEC3 GlossyPlastic::calculateShading(const Shape *shape, VEC3 point, VEC3 normal, const Light &light, VEC3 eyeDir) const {
-	float discRadius = 0.15;	// Radius of the reflection disc. Increasing makes the glass more frosted.
-	float discDistance = 5;		// Distance of disc from point on shape
-
-	//assert(eyeDir.norm() == 1.0);
-	//assert(normal.norm() == 1.0);
+VEC3 GlossyPlastic::calculateDirectShading(const Shape *shape, VEC3 point, VEC3 normal, const Light &light, int lightIndex, VEC3 eyeDir, const SamplePath &path) const {
+	return 0.2 * shape->getColourAt(point);
+}
 
-	// Calculate reflection direction
-	VEC3 reflection = -eyeDir + 2 * normal * normal.dot(eyeDir);
+// Traces the reflection rays once per hit, whatever the number of lights
+VEC3 GlossyPlastic::calculateIndirectShading(const Shape *shape, VEC3 point, VEC3 normal, VEC3 eyeDir, const Ray &ray) const {
+	float lobeExponent = 4000;	// Sharpness of the reflection lobe. Decreasing makes the glass more frosted.
+	float reflectance = 0.7;	// Share of the reflected colour that comes back
 
-	// Calculate basis vectors for disc
-	VEC3 w = reflection.normalized();
-	VEC3 v;
-	// Get any vector perpendicular to the up vector. This is a radius
-	if (w[0] == 0 and w[1] == 0) {
-		v = VEC3(1, 0, 0);
-	} else if (w[1] == 0 and w[2] == 0) {
-		v = VEC3(0, 1, 0);
-	} else {
-		v = VEC3(1, (-w[0] -w[2]) / w[1], 1);
+	// Out of glossy bounces for this path
+	if (ray.recurse_depth <= 0) {
+		return VEC3(0, 0, 0);
 	}
-	v.normalize();
-	// Get the radius perpendicular to the other radius.
-	VEC3 u = v.cross(w);
-	u.normalize();
-
-	// Get the center of the disc
-	VEC3 disc_center = point + reflection * discDistance;
 
-	VEC3 colour(0, 0,  0);
-	int counter = 0;
+	// Calculate reflection direction of the ray coming in
+	//	(the same as the one towards the eye, for rays from the camera)
+	VEC3 incoming = -ray.d;
+	VEC3 reflection = -incoming + 2 * normal * normal.dot(incoming);
 
-	for (int i = 0; i < GLOSSY_REFLECTION_SAMPLE_NUM; i++) {
-		counter++;
-		if (counter > 10) {
-			break;
-		}
-		// Get random distances along x and y radius
-		float localX = discRadius;
-		float localY = discRadius;
-
-		// Randomly generate points until we have one inside the disc
-		while (pow(localX, 2) + pow(localY, 2) > pow(discRadius, 2)) {			// MAKE THIS MORE EFFICIENT!!!!
-			// Shoot out a point on the disc
-			localX = 2 * discRadius * (-0.5 + ((float) (rand()) / (float) RAND_MAX));
-			localY = 2 * discRadius * (-0.5 + ((float) (rand()) / (float) RAND_MAX));
+	// Calculate basis vectors around the reflection direction
+	VEC3 w = reflection.normalized();
+	VEC3 other = fabs(w[0]) < 0.9 ? VEC3(1, 0, 0) : VEC3(0, 1, 0);
+	VEC3 u = w.cross(other).normalized();
+	VEC3 v = w.cross(u);
+
+	// Only the first glossy hit of a path splits into several rays, so the rays
+	//	traced for a camera ray grow with the depth rather than exponentially
+	int sampleNum = ray.path.bounce == 0 ? GLOSSY_REFLECTION_SAMPLE_NUM : 1;
+	float throughput = ray.throughput * reflectance;
+
+	VEC3 colour(0, 0, 0);
+	for (int i = 0; i < sampleNum; i++) {
+		SamplePath reflectedPath = ray.path.reflect(GLOSSY_RAY_STREAM, 0, i, sampleNum);
+
+		// Russian roulette: past the first few bounces, carry on with a chance equal to
+		//	the throughput, and make up for the paths that stop by weighting up the rest
+		float weight = 1;
+		if (reflectedPath.bounce > RUSSIAN_ROULETTE_DEPTH) {
+			float survival = min(1.0f, throughput);
+			if (randomFloat(hashKey(reflectedPath.key, ROULETTE_STREAM), 0) >= survival) {
+				continue;
+			}
+			weight = 1 / survival;
 		}
 
-		// Convert to global point on disc
-		VEC3 sample = disc_center + u * localX + v * localY;
-
-		// Shoot ray through this point
-		VEC3 dir = (sample - point).normalized();
-		Ray sampleRay = Ray(point + 0.01 * dir, dir);			// CHECK RAY DOESN'T GO INSIDE SURFACE!!!!
-		
-		// If ray goes inside surface, find another one
-		bool goesBelowSurface = normal.dot(sampleRay.d) <= 0;				// IS THIS CORRECT??
-		if (goesBelowSurface) {
-			i -= 1;
+		// Draw the direction from the Phong lobe cos^n around the reflection, which
+		//	the glossy reflection is proportional to, so every ray counts the same
+		float randX, randY;
+		sample2D(ray.path, GLOSSY_DIMENSION, GLOSSY_STREAM, 0, i, sampleNum, randX, randY);
+		float cosTheta = pow(randX, 1 / (lobeExponent + 1));
+		float sinTheta = sqrt(max(0.0f, 1 - cosTheta * cosTheta));
+		float phi = 2 * M_PI * randY;
+		VEC3 dir = cosTheta * w + sinTheta * (cos(phi) * u + sin(phi) * v);
+
+		// Rays that would go inside the surface reflect nothing
+		if (normal.dot(dir) <= 0) {
 			continue;
 		}
 
-		colour += rayTracer->calculateColour(sampleRay);
+		Ray sampleRay(point + 0.01 * dir, dir, ray.recurse_depth - 1, reflectedPath, throughput * weight);
+		colour += weight * rayTracer->calculateColour(sampleRay);
 	}
 
-	//cout << "Glossy plastic: shape colour at point is:" << endl;
-	//cout << shape->getColourAt(point) << endl << endl;
-	return 0.2 * shape->getColourAt(point) + 0.7 * (colour / (float) GLOSSY_REFLECTION_SAMPLE_NUM);
-	//	0.3 0.3: alright, but colour of reflection doesn't come out unless base is white
-	//	0.3 0.5: decent 
+	return reflectance * colour / (float) sampleNum;
 }
@@ -4,16 +4,24 @@
 #ifndef _MATERIAL__H
 #define _MATERIAL__H
 
+#include <cstdint>
 #include "shapes.h"
 #include "light.h"
+#include "sampler.h"
 
 class Material {
 public:
 	Material();
 
-	// Calculates the colour at this point using the material's specific lighting model
+	// Calculates the colour this light gives the point, using the material's specific lighting model
 	//	point, normal: the point on the surface of the shape, and normal at that point
-	virtual VEC3 calculateShading(const Shape *shape, VEC3 point, VEC3 normal, const Light &light, VEC3 eyeDir) const = 0;
+	//	lightIndex, path: seed and sequence for materials that sample (see sampler.h)
+	virtual VEC3 calculateDirectShading(const Shape *shape, VEC3 point, VEC3 normal, const Light &light, int lightIndex, VEC3 eyeDir, const SamplePath &path) const = 0;
+
+	// Calculates the colour the point gets from the rest of the scene rather than
+	//	straight from the lights (e.g. reflections), once for all the lights
+	//	None by default.
+	virtual VEC3 calculateIndirectShading(const Shape *shape, VEC3 point, VEC3 normal, VEC3 eyeDir, const Ray &ray) const;
 };
 
 // Uses Phong to look like a plastic
@@ -25,7 +33,7 @@ public:
 	Plastic(float cPhong);
 
 	// Uses Cook-Torrance, from Professor Kim's BDRFs code (see material.cpp)
-	VEC3 calculateShading(const Shape *shape, VEC3 point, VEC3 normal, const Light &light, VEC3 eyeDir) const;
+	VEC3 calculateDirectShading(const Shape *shape, VEC3 point, VEC3 normal, const Light &light, int lightIndex, VEC3 eyeDir, const SamplePath &path) const;
 };
 
 // Uses Cook-Torrance to look like a metal
@@ -39,7 +47,7 @@ public:
 	Metal(float cGaussian, float cReflection);
 
 	// Uses Cook-Torrance, from Professor Kim's BDRFs code (see material.cpp)
-	VEC3 calculateShading(const Shape *shape, VEC3 point, VEC3 normal, const Light &light, VEC3 eyeDir) const;
+	VEC3 calculateDirectShading(const Shape *shape, VEC3 point, VEC3 normal, const Light &light, int lightIndex, VEC3 eyeDir, const SamplePath &path) const;
 };
 
 
@@ -53,8 +61,11 @@ public:
 
 	GlossyPlastic(float cPhong, RayTracer *&rayTracer);
 
-	// Uses Glossy Reflections
-	VEC3 calculateShading(const Shape *shape, VEC3 point, VEC3 normal, const Light &light, VEC3 eyeDir) const;
+	// A little of the plastic's own colour for each light
+	VEC3 calculateDirectShading(const Shape *shape, VEC3 point, VEC3 normal, const Light &light, int lightIndex, VEC3 eyeDir, const SamplePath &path) const;
+	// Uses Glossy Reflections, sampling the Phong lobe around the mirror direction
+	//	Paths are limited to ray.recurse_depth more glossy bounces (see GLOSSY_MAX_DEPTH)
+	VEC3 calculateIndirectShading(const Shape *shape, VEC3 point, VEC3 normal, VEC3 eyeDir, const Ray &ray) const;
 };
 
 
@@ -0,0 +1,146 @@
+#include "numa.h"
+
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+static thread_local int numaNodeOfThread = 0;
+
+// Parses a sysfs list such as "0-7,16-23"
+static vector<int> parseList(const char *text) {
+	vector<int> values;
+	while (*text != '\0' and *text != '\n') {
+		int first, last, length;
+		if (sscanf(text, "%d-%d%n", &first, &last, &length) == 2) {
+			text += length;
+		} else if (sscanf(text, "%d%n", &first, &length) == 1) {
+			last = first;
+			text += length;
+		} else {
+			break;
+		}
+		for (int value = first; value <= last; value++) {
+			values.push_back(value);
+		}
+		if (*text == ',') {
+			text++;
+		}
+	}
+	return values;
+}
+
+// Reads a whole (small) sysfs file, returning false if it doesn't exist
+static bool readSysFile(const char *filename, char *text, int size) {
+	FILE *fp = fopen(filename, "r");
+	if (fp == NULL) {
+		return false;
+	}
+	int length = fread(text, 1, size - 1, fp);
+	text[length] = '\0';
+	fclose(fp);
+	return true;
+}
+
+static vector<NumaNode> detectNodes() {
+	vector<NumaNode> nodes;
+	char text[4096];
+	if (readSysFile("/sys/devices/system/node/online", text, sizeof(text))) {
+		for (int id : parseList(text)) {
+			char filename[256];
+			sprintf(filename, "/sys/devices/system/node/node%d/cpulist", id);
+			if (readSysFile(filename, text, sizeof(text))) {
+				NumaNode node;
+				node.id = id;
+				node.cpus = parseList(text);
+				if (not node.cpus.empty()) {
+					nodes.push_back(node);
+				}
+			}
+		}
+	}
+
+	// No topology: one node with every CPU
+	if (nodes.empty()) {
+		NumaNode node;
+		node.id = 0;
+		for (unsigned int cpu = 0; cpu < max(1u, thread::hardware_concurrency()); cpu++) {
+			node.cpus.push_back(cpu);
+		}
+		nodes.push_back(node);
+	}
+	return nodes;
+}
+
+const vector<NumaNode> &getNumaNodes() {
+	static vector<NumaNode> nodes = detectNodes();
+	return nodes;
+}
+
+int getNumaNodeNum() {
+	return getNumaNodes().size();
+}
+
+#ifdef __linux__
+static bool pinThreadToCpus(const vector<int> &cpus) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu : cpus) {
+		CPU_SET(cpu, &set);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+#else
+static bool pinThreadToCpus(const vector<int> &cpus) {
+	return false;
+}
+#endif
+
+bool pinThreadToCpu(int cpu) {
+	if (not pinThreadToCpus(vector<int>(1, cpu))) {
+		return false;
+	}
+
+	const vector<NumaNode> &nodes = getNumaNodes();
+	for (unsigned int node = 0; node < nodes.size(); node++) {
+		if (find(nodes[node].cpus.begin(), nodes[node].cpus.end(), cpu) != nodes[node].cpus.end()) {
+			numaNodeOfThread = node;
+		}
+	}
+	return true;
+}
+
+int currentNumaNode() {
+	return numaNodeOfThread;
+}
+
+long long getNumaNodeFreeBytes(int node) {
+	char filename[256];
+	char text[4096];
+	sprintf(filename, "/sys/devices/system/node/node%d/meminfo", getNumaNodes()[node].id);
+	if (not readSysFile(filename, text, sizeof(text))) {
+		return -1;
+	}
+
+	// A line reads "Node 0 MemFree:  123456 kB"
+	const char *line = strstr(text, "MemFree:");
+	long long kilobytes;
+	if (line == NULL or sscanf(line, "MemFree: %lld", &kilobytes) != 1) {
+		return -1;
+	}
+	return kilobytes * 1024;
+}
+
+void runOnNumaNode(int node, const function<void()> &work) {
+	thread worker([node, &work] {
+		if (pinThreadToCpus(getNumaNodes()[node].cpus)) {
+			numaNodeOfThread = node;
+		}
+		work();
+	});
+	worker.join();
+}
@@ -0,0 +1,44 @@
+// Helpers for machines with several NUMA nodes (e.g. dual-socket render nodes)
+//	Each node's memory is quicker to reach from its own cores than from the
+//	other node's. Threads can be pinned to cores, so they stay on one node, and
+//	memory first written by a pinned thread ends up on that thread's node.
+//
+//	The topology is read from /sys on Linux. Elsewhere the machine is treated
+//	as a single node and pinning does nothing.
+//
+//	Nodes are numbered here from 0 to getNumaNodeNum() - 1, in the order the system
+//	lists the online ones, which needn't be the system's own numbers (e.g. only
+//	nodes 0 and 2 may be online).
+
+#ifndef _NUMA_H
+#define _NUMA_H
+
+#include <vector>
+#include <functional>
+
+using namespace std;
+
+// A NUMA node: its number to the system, and its CPUs
+struct NumaNode {
+	int id;
+	vector<int> cpus;
+};
+
+// Every online NUMA node
+const vector<NumaNode> &getNumaNodes();
+
+int getNumaNodeNum();
+
+// Pins the calling thread to one CPU, returning false if that isn't supported
+bool pinThreadToCpu(int cpu);
+
+// The node the calling thread is pinned to, or 0 if it isn't pinned
+int currentNumaNode();
+
+// Free memory on the node in bytes, or -1 if unknown
+long long getNumaNodeFreeBytes(int node);
+
+// Runs work on a thread pinned to the node, so memory it first writes is placed there
+void runOnNumaNode(int node, const function<void()> &work);
+
+#endif
@@ -0,0 +1,587 @@
+#include "pagedMesh.h"
+#include "rng.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Changes whenever the file layout does
+static const uint32_t PAGED_MESH_VERSION = 1;
+static const char PAGED_MESH_MAGIC[4] = { 'P', 'M', 'S', 'H' };
+
+// Pages start on multiples of this in the file, so each can be mapped in and out on its own
+static const uint64_t PAGE_ALIGNMENT = 4096;
+
+struct PagedMeshHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	int32_t topNodeNum, pageNum, triangleNum;
+	int32_t unused;
+};
+
+// Set for the thread between startDeferringPages() and finishDeferringPages()
+static thread_local bool deferringPages = false;
+static thread_local bool missedPage = false;
+
+void startDeferringPages() {
+	deferringPages = true;
+	missedPage = false;
+}
+
+bool finishDeferringPages() {
+	bool missed = missedPage;
+	deferringPages = false;
+	missedPage = false;
+	return missed;
+}
+
+bool pagesMissed() {
+	return missedPage;
+}
+
+static bool hitsNode(const PagedNode &node, const Ray &ray, VEC3 invD, float tMax, float &tNear) {
+	AABB box(VEC3(node.lo[0], node.lo[1], node.lo[2]), VEC3(node.hi[0], node.hi[1], node.hi[2]));
+	return box.intersects(ray, invD, tMax, tNear);
+}
+
+// Möller-Trumbore intersection with the triangle of these 9 floats
+static bool intersectsTriangle(const Ray &ray, const float *vertices, float &t) {
+	VEC3 a(vertices[0], vertices[1], vertices[2]);
+	VEC3 edge1 = VEC3(vertices[3], vertices[4], vertices[5]) - a;
+	VEC3 edge2 = VEC3(vertices[6], vertices[7], vertices[8]) - a;
+
+	VEC3 p = ray.d.cross(edge2);
+	double determinant = edge1.dot(p);
+	if (fabs(determinant) < 1e-12) {
+		return false;	// Ray is parallel to the triangle
+	}
+	double inverse = 1.0 / determinant;
+
+	VEC3 toOrigin = ray.o - a;
+	double beta = toOrigin.dot(p) * inverse;
+	if (beta < 0 or beta > 1) {
+		return false;
+	}
+
+	VEC3 q = toOrigin.cross(edge1);
+	double gamma = ray.d.dot(q) * inverse;
+	if (gamma < 0 or beta + gamma > 1) {
+		return false;
+	}
+
+	t = edge2.dot(q) * inverse;
+	return t > 0;
+}
+
+// Copies a node of the BVH into the packed tree's format
+static PagedNode packNode(const BVHNode &node, int kind) {
+	PagedNode packed;
+	for (int i = 0; i < 3; i++) {
+		packed.lo[i] = node.box.lo[i];
+		packed.hi[i] = node.box.hi[i];
+	}
+	packed.kind = kind;
+	packed.rightChild = -1;
+	packed.first = node.first;
+	packed.count = node.count;
+	return packed;
+}
+
+// The node after the last one of the subtree, which is stored depth-first
+static int subtreeEnd(const vector<BVHNode> &nodes, int node) {
+	while (not nodes[node].isLeaf) {
+		node = nodes[node].rightChild;
+	}
+	return node + 1;
+}
+
+// Copies the top of the tree, down to the first nodes with few enough triangles
+//	for a page, which become the pages' roots
+static int packTopNode(const vector<BVHNode> &nodes, int node, int trianglesPerPage,
+	vector<PagedNode> &topNodes, vector<int> &pageRoots)
+{
+	int index = topNodes.size();
+	if (nodes[node].count <= trianglesPerPage) {
+		topNodes.push_back(packNode(nodes[node], PagedNode::PAGE));
+		topNodes[index].first = pageRoots.size();
+		pageRoots.push_back(node);
+		return index;
+	}
+
+	topNodes.push_back(packNode(nodes[node], PagedNode::INTERIOR));
+	packTopNode(nodes, node + 1, trianglesPerPage, topNodes, pageRoots);
+	int right = packTopNode(nodes, nodes[node].rightChild, trianglesPerPage, topNodes, pageRoots);
+	topNodes[index].rightChild = right;
+	return index;
+}
+
+// Reads the vertices and faces; faces with more than three corners are split into fans
+static bool readObj(const string &objFilename, vector<float> &positions, vector<int> &indices) {
+	FILE *fp = fopen(objFilename.c_str(), "r");
+	if (fp == NULL) {
+		cout << "Couldn't open " << objFilename << endl;
+		return false;
+	}
+
+	char line[4096];
+	int lineNumber = 0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineNumber++;
+		if (line[0] == 'v' and isspace(line[1])) {
+			float x, y, z;
+			if (sscanf(line + 2, "%f %f %f", &x, &y, &z) != 3) {
+				cout << objFilename << ":" << lineNumber << ": bad vertex" << endl;
+				fclose(fp);
+				return false;
+			}
+			positions.insert(positions.end(), { x, y, z });
+		} else if (line[0] == 'f' and isspace(line[1])) {
+			// Corners are "v", "v/vt", "v//vn" or "v/vt/vn"; negative v counts back from the latest vertex
+			int vertexNum = positions.size() / 3;
+			vector<int> corners;
+			char *p = line + 2;
+			while (true) {
+				char *end;
+				long vertex = strtol(p, &end, 10);
+				if (end == p) {
+					break;
+				}
+				vertex = vertex < 0 ? vertexNum + vertex : vertex - 1;
+				if (vertex < 0 or vertex >= vertexNum) {
+					cout << objFilename << ":" << lineNumber << ": face uses a missing vertex" << endl;
+					fclose(fp);
+					return false;
+				}
+				corners.push_back(vertex);
+				for (p = end; *p != '\0' and not isspace(*p); p++) {}
+			}
+			for (unsigned int i = 2; i < corners.size(); i++) {
+				indices.insert(indices.end(), { corners[0], corners[i - 1], corners[i] });
+			}
+		}
+	}
+	fclose(fp);
+	return true;
+}
+
+static bool writePadding(FILE *fp, uint64_t &offset) {
+	static const char zeros[PAGE_ALIGNMENT] = { 0 };
+	uint64_t padding = (PAGE_ALIGNMENT - offset % PAGE_ALIGNMENT) % PAGE_ALIGNMENT;
+	offset += padding;
+	return padding == 0 or fwrite(zeros, padding, 1, fp) == 1;
+}
+
+bool PagedMesh::pack(const string &objFilename, const string &filename, int trianglesPerPage) {
+	vector<float> positions;
+	vector<int> indices;
+	if (not readObj(objFilename, positions, indices)) {
+		return false;
+	}
+	int triangleNum = indices.size() / 3;
+	if (triangleNum == 0) {
+		cout << objFilename << " has no triangles" << endl;
+		return false;
+	}
+
+	vector<AABB> boxes(triangleNum);
+	for (int triangle = 0; triangle < triangleNum; triangle++) {
+		for (int corner = 0; corner < 3; corner++) {
+			const float *position = &positions[3 * indices[3 * triangle + corner]];
+			boxes[triangle].expand(VEC3(position[0], position[1], position[2]));
+		}
+	}
+	BVH bvh;
+	bvh.build(boxes);
+	const vector<BVHNode> &nodes = bvh.getNodes();
+	const vector<int> &leafOrder = bvh.getLeafOrder();
+
+	vector<PagedNode> topNodes;
+	vector<int> pageRoots;
+	packTopNode(nodes, 0, max(1, trianglesPerPage), topNodes, pageRoots);
+
+	// Each page holds its subtree's nodes, then the vertices of its triangles in leaf order
+	vector<PageRecord> records(pageRoots.size());
+	vector<vector<PagedNode> > pageNodes(pageRoots.size());
+	uint64_t offset = sizeof(PagedMeshHeader) + topNodes.size() * sizeof(PagedNode) + records.size() * sizeof(PageRecord);
+	offset += (PAGE_ALIGNMENT - offset % PAGE_ALIGNMENT) % PAGE_ALIGNMENT;
+	for (unsigned int page = 0; page < pageRoots.size(); page++) {
+		int root = pageRoots[page];
+		for (int node = root; node < subtreeEnd(nodes, root); node++) {
+			PagedNode packed = packNode(nodes[node], nodes[node].isLeaf ? PagedNode::LEAF : PagedNode::INTERIOR);
+			packed.rightChild = nodes[node].isLeaf ? -1 : nodes[node].rightChild - root;
+			packed.first -= nodes[root].first;
+			pageNodes[page].push_back(packed);
+		}
+
+		PageRecord &record = records[page];
+		record.nodeNum = pageNodes[page].size();
+		record.firstTriangle = nodes[root].first;
+		record.triangleNum = nodes[root].count;
+		record.bytes = record.nodeNum * sizeof(PagedNode) + 9 * sizeof(float) * record.triangleNum;
+		record.offset = offset;
+		offset += record.bytes;
+		offset += (PAGE_ALIGNMENT - offset % PAGE_ALIGNMENT) % PAGE_ALIGNMENT;
+	}
+
+	// The vertices in leaf order, which also identify the mesh
+	vector<float> vertices(9 * triangleNum);
+	uint64_t key = hashKey(PAGED_MESH_VERSION, triangleNum);
+	for (int i = 0; i < triangleNum; i++) {
+		for (int corner = 0; corner < 3; corner++) {
+			memcpy(&vertices[9 * i + 3 * corner], &positions[3 * indices[3 * leafOrder[i] + corner]], 3 * sizeof(float));
+		}
+		for (int j = 0; j < 9; j++) {
+			uint32_t bits;
+			memcpy(&bits, &vertices[9 * i + j], sizeof(bits));
+			key = hashKey(key, bits);
+		}
+	}
+
+	FILE *fp = fopen(filename.c_str(), "wb");
+	if (fp == NULL) {
+		cout << "Couldn't write " << filename << endl;
+		return false;
+	}
+	PagedMeshHeader header;
+	memcpy(header.magic, PAGED_MESH_MAGIC, sizeof(header.magic));
+	header.version = PAGED_MESH_VERSION;
+	header.key = key;
+	header.topNodeNum = topNodes.size();
+	header.pageNum = records.size();
+	header.triangleNum = triangleNum;
+	header.unused = 0;
+
+	uint64_t written = sizeof(header) + topNodes.size() * sizeof(PagedNode) + records.size() * sizeof(PageRecord);
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 and
+		fwrite(topNodes.data(), sizeof(PagedNode), topNodes.size(), fp) == topNodes.size() and
+		fwrite(records.data(), sizeof(PageRecord), records.size(), fp) == records.size() and
+		writePadding(fp, written);
+	for (unsigned int page = 0; ok and page < records.size(); page++) {
+		const PageRecord &record = records[page];
+		ok = fwrite(pageNodes[page].data(), sizeof(PagedNode), record.nodeNum, fp) == (size_t) record.nodeNum and
+			fwrite(&vertices[9 * record.firstTriangle], 9 * sizeof(float), record.triangleNum, fp) == (size_t) record.triangleNum;
+		written += record.bytes;
+		ok = ok and writePadding(fp, written);
+	}
+	if (fclose(fp) != 0 or not ok) {
+		cout << "Couldn't write " << filename << endl;
+		return false;
+	}
+
+	cout << "Packed " << triangleNum << " triangles into " << records.size() << " pages (" << written / (1 << 20) << " MB)" << endl;
+	return true;
+}
+
+PagedMesh::PagedMesh(const Material &mat, VEC3 colour, size_t residentBudget)
+	: Shape(mat, colour), key(0), fd(-1), mapped(NULL), mappedBytes(0),
+	residentBudget(residentBudget), residentBytes(0), loadNum(0), evictionNum(0), stopping(false)
+{}
+
+PagedMesh::~PagedMesh() {
+	{
+		lock_guard<mutex> guard(requestMutex);
+		stopping = true;
+	}
+	requested.notify_all();
+	if (pager.joinable()) {
+		pager.join();
+	}
+	if (mapped != NULL) {
+		munmap((void *) mapped, mappedBytes);
+	}
+	if (fd != -1) {
+		close(fd);
+	}
+}
+
+bool PagedMesh::load(const string &filename) {
+	fd = open(filename.c_str(), O_RDONLY);
+	struct stat status;
+	if (fd == -1 or fstat(fd, &status) != 0 or (size_t) status.st_size < sizeof(PagedMeshHeader)) {
+		return false;
+	}
+	mappedBytes = status.st_size;
+	void *mapping = mmap(NULL, mappedBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mapping == MAP_FAILED) {
+		return false;
+	}
+	mapped = (const char *) mapping;
+
+	// Pages are only read in when asked for, rather than the kernel guessing at what's next
+	madvise(mapping, mappedBytes, MADV_RANDOM);
+
+	PagedMeshHeader header;
+	memcpy(&header, mapped, sizeof(header));
+	uint64_t tableBytes = sizeof(header) + (uint64_t) header.topNodeNum * sizeof(PagedNode) +
+		(uint64_t) header.pageNum * sizeof(PageRecord);
+	if (memcmp(header.magic, PAGED_MESH_MAGIC, sizeof(header.magic)) != 0 or header.version != PAGED_MESH_VERSION or
+		header.topNodeNum <= 0 or header.pageNum <= 0 or tableBytes > mappedBytes)
+	{
+		return false;
+	}
+
+	// The top of the tree and the page table stay in memory
+	const char *table = mapped + sizeof(header);
+	topNodes.resize(header.topNodeNum);
+	memcpy(topNodes.data(), table, topNodes.size() * sizeof(PagedNode));
+	pageRecords.resize(header.pageNum);
+	memcpy(pageRecords.data(), table + topNodes.size() * sizeof(PagedNode), pageRecords.size() * sizeof(PageRecord));
+	for (const PageRecord &record : pageRecords) {
+		if (record.offset % PAGE_ALIGNMENT != 0 or record.offset + record.bytes > mappedBytes or record.nodeNum <= 0 or
+			record.bytes != record.nodeNum * sizeof(PagedNode) + 9 * sizeof(float) * record.triangleNum)
+		{
+			return false;
+		}
+	}
+	madvise(mapping, mappedBytes, MADV_DONTNEED);
+	key = header.key;
+
+	pages = vector<PageState>(pageRecords.size());
+	for (PageState &page : pages) {
+		page.state.store(NOT_RESIDENT);
+		page.lastUsed.store(0);
+	}
+	pager = thread(&PagedMesh::pagerLoop, this);
+	return true;
+}
+
+const PagedNode *PagedMesh::pageNodes(int page) const {
+	return (const PagedNode *) (mapped + pageRecords[page].offset);
+}
+
+const float *PagedMesh::pageVertices(int page) const {
+	return (const float *) (pageNodes(page) + pageRecords[page].nodeNum);
+}
+
+// The kernel works in whole memory pages, which may be bigger than PAGE_ALIGNMENT
+static void advise(const char *start, size_t bytes, int advice) {
+	uintptr_t memoryPage = sysconf(_SC_PAGESIZE);
+	uintptr_t first = (uintptr_t) start / memoryPage * memoryPage;
+	madvise((void *) first, (uintptr_t) start + bytes - first, advice);
+}
+
+void PagedMesh::requestPage(int page) const {
+	int expected = NOT_RESIDENT;
+	if (not pages[page].state.compare_exchange_strong(expected, QUEUED)) {
+		return;	// Already asked for, or already in
+	}
+	{
+		lock_guard<mutex> guard(requestMutex);
+		requests.push_back(page);
+	}
+	requested.notify_one();
+}
+
+void PagedMesh::pagerLoop() {
+	while (true) {
+		int page;
+		{
+			unique_lock<mutex> guard(requestMutex);
+			requested.wait(guard, [this] { return stopping or not requests.empty(); });
+			if (stopping) {
+				return;
+			}
+			page = requests.front();
+			requests.pop_front();
+		}
+		loadPage(page);
+	}
+}
+
+// Reading a byte of every memory page of it makes sure the whole page is in before rays are let in
+void PagedMesh::loadPage(int page) {
+	const PageRecord &record = pageRecords[page];
+	const char *start = mapped + record.offset;
+	advise(start, record.bytes, MADV_WILLNEED);
+	long memoryPage = sysconf(_SC_PAGESIZE);
+	for (size_t i = 0; i < record.bytes; i += memoryPage) {
+		*(const volatile char *) (start + i);
+	}
+
+	residentBytes += record.bytes;
+	pages[page].lastUsed.store(++loadNum, memory_order_relaxed);
+	pages[page].state.store(RESIDENT, memory_order_release);
+	evictPages(page);
+}
+
+void PagedMesh::evictPages(int keep) {
+	while (residentBytes > residentBudget) {
+		int oldest = -1;
+		uint64_t oldestUse = UINT64_MAX;
+		for (unsigned int page = 0; page < pages.size(); page++) {
+			uint64_t lastUsed = pages[page].lastUsed.load(memory_order_relaxed);
+			if ((int) page != keep and pages[page].state.load(memory_order_relaxed) == RESIDENT and lastUsed < oldestUse) {
+				oldest = page;
+				oldestUse = lastUsed;
+			}
+		}
+		if (oldest == -1) {
+			return;
+		}
+
+		// A ray still in the page reads it back in from the file
+		pages[oldest].state.store(NOT_RESIDENT, memory_order_release);
+		advise(mapped + pageRecords[oldest].offset, pageRecords[oldest].bytes, MADV_DONTNEED);
+		residentBytes -= pageRecords[oldest].bytes;
+		evictionNum++;
+	}
+}
+
+void PagedMesh::intersectPage(int page, const Ray &ray, VEC3 invD, float &closestTime, int &closestTriangle) const {
+	const PagedNode *nodes = pageNodes(page);
+	const float *vertices = pageVertices(page);
+
+	int stack[64];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0) {
+		const PagedNode &node = nodes[stack[--stackSize]];
+		float tNear;
+		if (not hitsNode(node, ray, invD, closestTime, tNear)) {
+			continue;
+		}
+
+		if (node.kind == PagedNode::LEAF) {
+			for (int i = node.first; i < node.first + node.count; i++) {
+				float t;
+				if (intersectsTriangle(ray, vertices + 9 * i, t) and t < closestTime) {
+					closestTime = t;
+					closestTriangle = pageRecords[page].firstTriangle + i;
+				}
+			}
+			continue;
+		}
+
+		// Visit the nearer child first, so the further one can be culled
+		int left = &node - nodes + 1;
+		int right = node.rightChild;
+		float tLeft = FLT_MAX, tRight = FLT_MAX;
+		bool hitLeft = hitsNode(nodes[left], ray, invD, closestTime, tLeft);
+		bool hitRight = hitsNode(nodes[right], ray, invD, closestTime, tRight);
+		if (hitLeft and hitRight and tLeft < tRight) {
+			stack[stackSize++] = right;
+			stack[stackSize++] = left;
+		} else {
+			if (hitLeft) {
+				stack[stackSize++] = left;
+			}
+			if (hitRight) {
+				stack[stackSize++] = right;
+			}
+		}
+	}
+}
+
+bool PagedMesh::intersectsPart(const Ray &ray, float &t, int &part) const {
+	part = -1;
+
+	// A try that will be traced again needn't go any further
+	if (topNodes.empty() or (deferringPages and missedPage)) {
+		return false;
+	}
+
+	VEC3 invD(1.0 / ray.d[0], 1.0 / ray.d[1], 1.0 / ray.d[2]);
+	float closestTime = FLT_MAX;
+	int closestTriangle = -1;
+	uint64_t now = loadNum.load(memory_order_relaxed);
+
+	int stack[64];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0) {
+		const PagedNode &node = topNodes[stack[--stackSize]];
+		float tNear;
+		if (not hitsNode(node, ray, invD, closestTime, tNear)) {
+			continue;
+		}
+
+		if (node.kind == PagedNode::PAGE) {
+			int page = node.first;
+			if (pages[page].state.load(memory_order_acquire) != RESIDENT) {
+				requestPage(page);
+				if (deferringPages) {
+					missedPage = true;
+					return false;
+				}
+			}
+			if (pages[page].lastUsed.load(memory_order_relaxed) < now) {
+				pages[page].lastUsed.store(now, memory_order_relaxed);
+			}
+			intersectPage(page, ray, invD, closestTime, closestTriangle);
+			continue;
+		}
+
+		int left = &node - &topNodes[0] + 1;
+		int right = node.rightChild;
+		float tLeft = FLT_MAX, tRight = FLT_MAX;
+		bool hitLeft = hitsNode(topNodes[left], ray, invD, closestTime, tLeft);
+		bool hitRight = hitsNode(topNodes[right], ray, invD, closestTime, tRight);
+		if (hitLeft and hitRight and tLeft < tRight) {
+			stack[stackSize++] = right;
+			stack[stackSize++] = left;
+		} else {
+			if (hitLeft) {
+				stack[stackSize++] = left;
+			}
+			if (hitRight) {
+				stack[stackSize++] = right;
+			}
+		}
+	}
+
+	t = closestTime;
+	part = closestTriangle;
+	return closestTriangle != -1;
+}
+
+bool PagedMesh::intersects(const Ray &ray, float &t) const {
+	int part;
+	return intersectsPart(ray, t, part);
+}
+
+// Without the part, the triangle is found again by re-tracing the ray
+VEC3 PagedMesh::getNormalAt(VEC3 point, const Ray &ray) const {
+	float t;
+	int part;
+	intersectsPart(ray, t, part);
+	return getPartNormalAt(point, ray, part);
+}
+
+// The ray has just been in the triangle's page, so it's almost always still in memory
+VEC3 PagedMesh::getPartNormalAt(VEC3 point, const Ray &ray, int part) const {
+	if (part < 0 or pageRecords.empty()) {
+		return -ray.d;
+	}
+
+	// The last page starting at or before the triangle
+	int page = upper_bound(pageRecords.begin(), pageRecords.end(), part, [](int triangle, const PageRecord &record) {
+		return triangle < record.firstTriangle;
+	}) - pageRecords.begin() - 1;
+	const float *vertices = pageVertices(page) + 9 * (part - pageRecords[page].firstTriangle);
+
+	VEC3 a(vertices[0], vertices[1], vertices[2]);
+	VEC3 b(vertices[3], vertices[4], vertices[5]);
+	VEC3 c(vertices[6], vertices[7], vertices[8]);
+	VEC3 normal = ((b - a).cross(c - a)).normalized();
+
+	// Reverse normal if it's pointing away from the ray origin
+	if ((-ray.d).dot(normal) < 0) {
+		normal = -normal;
+	}
+	return normal;
+}
+
+AABB PagedMesh::getBoundingBox() const {
+	if (topNodes.empty()) {
+		return AABB();
+	}
+	const PagedNode &root = topNodes[0];
+	return AABB(VEC3(root.lo[0], root.lo[1], root.lo[2]), VEC3(root.hi[0], root.hi[1], root.hi[2]));
+}
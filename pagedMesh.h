@@ -0,0 +1,129 @@
+// An out-of-core triangle mesh, for sets too big to keep in memory
+//	The mesh is packed once ("previz pack") into a file laid out by its BVH: the
+//	top of the tree stays in memory, and every subtree of up to a page's worth of
+//	triangles, with its own nodes and vertices, is a page of the file. The file is
+//	memory-mapped, and a pager thread reads pages in as rays ask for them and
+//	gives the least recently used ones back once the resident pages go over a
+//	budget.
+//
+//	A ray that reaches a page that isn't in memory asks for it. While a thread is
+//	deferring misses (see startDeferringPages) the ray skips the page, and the
+//	renderer sets the pixel aside and traces it again once the page has had time to
+//	arrive, rather than the thread stalling on the disk. Otherwise the ray reads the
+//	page straight from the file. Pages are only ever read, so a page given back
+//	while a ray is still in it is read in again by the ray; nothing is ever wrong,
+//	only slower.
+
+#ifndef _PAGED_MESH_H
+#define _PAGED_MESH_H
+
+#include <vector>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include "SETTINGS.h"
+#include "shapes.h"
+#include "bvh.h"
+
+using namespace std;
+
+// A node of the packed tree, as stored in the file
+struct PagedNode {
+	float lo[3], hi[3];	// Bounding box
+	int32_t kind;	// INTERIOR, LEAF (in a page) or PAGE (a page's root, in the top of the tree)
+	int32_t rightChild;	// For interior nodes; the left child is the next node
+	int32_t first, count;	// For leaves, triangles within the page; for page roots, the page and its triangles
+
+	enum { INTERIOR, LEAF, PAGE };
+};
+
+// Where a page is in the file, and what's in it
+struct PageRecord {
+	uint64_t offset;	// Page-aligned; the page's nodes and then 9 floats per triangle
+	uint32_t bytes;
+	int32_t nodeNum;
+	int32_t firstTriangle, triangleNum;	// The page's triangles are a range of the whole mesh's
+};
+
+class PagedMesh : public Shape {
+	// Pages move from NOT_RESIDENT to QUEUED when asked for, to RESIDENT once read
+	//	in, and back to NOT_RESIDENT when evicted
+	enum { NOT_RESIDENT, QUEUED, RESIDENT };
+	struct PageState {
+		atomic<int> state;
+		atomic<uint64_t> lastUsed;	// The page load count when a ray last went into the page
+	};
+
+	vector<PagedNode> topNodes;
+	vector<PageRecord> pageRecords;
+	mutable vector<PageState> pages;	// Rays change what's resident, but not the shape
+	uint64_t key;	// Identifies the packed mesh
+
+	int fd;
+	const char *mapped;	// The whole file, read-only
+	size_t mappedBytes;
+
+	size_t residentBudget;	// Bytes of pages to keep in memory at most
+	size_t residentBytes;	// Only changed by the pager thread
+	atomic<uint64_t> loadNum;	// Pages read in so far, also the clock for least recently used
+	atomic<uint64_t> evictionNum;
+
+	// Pages asked for, read in by the pager thread in order
+	thread pager;
+	mutable mutex requestMutex;
+	mutable condition_variable requested;
+	mutable deque<int> requests;
+	bool stopping;
+
+	void pagerLoop();
+	void loadPage(int page);
+	// Gives back least recently used pages until the resident ones fit the budget, keeping keep
+	void evictPages(int keep);
+	void requestPage(int page) const;
+
+	const PagedNode *pageNodes(int page) const;
+	const float *pageVertices(int page) const;
+
+	// Closest hit in one page, updating closestTime and closestTriangle (within the mesh)
+	void intersectPage(int page, const Ray &ray, VEC3 invD, float &closestTime, int &closestTriangle) const;
+
+public:
+	// Nothing is loaded until load(); residentBudget is in bytes
+	PagedMesh(const Material &mat, VEC3 colour, size_t residentBudget);
+	~PagedMesh();
+
+	// Maps a file made by pack() and starts the pager, returning false if it couldn't
+	bool load(const string &filename);
+
+	// Packs the triangles of a Wavefront OBJ file (its v and f lines) into a file for
+	//	load(), with up to trianglesPerPage triangles per page, returning false if it couldn't
+	//	The whole mesh is held in memory while it's packed.
+	static bool pack(const string &objFilename, const string &filename, int trianglesPerPage);
+
+	uint64_t getKey() const { return key; }
+	int getPageNum() const { return pageRecords.size(); }
+	uint64_t getLoadNum() const { return loadNum; }
+	uint64_t getEvictionNum() const { return evictionNum; }
+
+	// The part is the triangle hit
+	VEC3 getNormalAt(VEC3 point, const Ray &ray) const override;
+	VEC3 getPartNormalAt(VEC3 point, const Ray &ray, int part) const override;
+	bool intersects(const Ray &ray, float &t) const override;
+	bool intersectsPart(const Ray &ray, float &t, int &part) const override;
+	AABB getBoundingBox() const override;
+};
+
+// Rays traced on this thread after startDeferringPages() skip pages that aren't in
+//	memory (and ask for them), until finishDeferringPages(), which returns whether any
+//	did. Whatever was traced in between is then wrong, and must be traced again.
+void startDeferringPages();
+bool finishDeferringPages();
+
+// Whether a ray on this thread has skipped a page since startDeferringPages()
+bool pagesMissed();
+
+#endif
@@ -2,30 +2,46 @@
 
 PhysicsWorld::PhysicsWorld(const vector<const Shape*> &shapes) 
 	: shapes(shapes)
-{}
+{
+	vector<AABB> boxes;
+	boxes.reserve(shapes.size());
+	for (const Shape *shape : shapes) {
+		boxes.push_back(shape->getBoundingBox());
+	}
+	bvh.build(boxes);
 
-bool PhysicsWorld::existsClosestIntersection(const Ray &ray, const Shape *&intersectShape, VEC3 &point) const {
-	float closestTime = -1;  // the t of the closest intersection             // CAN THIS EVER FAIL???
+	// Lay the shapes out in leaf order, so a subtree's shapes sit next to each other
+	const vector<int> &leafOrder = bvh.getLeafOrder();
+	leafShapes.reserve(shapes.size());
+	for (int index : leafOrder) {
+		leafShapes.push_back(shapes[index]);
+	}
+}
 
-	// Check intersection for each shape
-	for (const Shape *shape : shapes) {											// CAN WE MAKE THIS MORE EFFICIENT??
-		// Check if ray intersects with the shape
-		float latestPoint = 0;
-		bool didIntersect = shape->intersects(ray, latestPoint);
-		bool isClosest = (closestTime == -1) or latestPoint < closestTime;
+bool PhysicsWorld::existsClosestIntersection(const Ray &ray, const Shape *&intersectShape, VEC3 &point) const {
+	int part;
+	return existsClosestIntersection(ray, intersectShape, point, part);
+}
 
-		// Save intersection
-		if (didIntersect and isClosest) {
-			//cout << latestPoint << endl;;
-			closestTime = latestPoint;
-			intersectShape = shape;
+bool PhysicsWorld::existsClosestIntersection(const Ray &ray, const Shape *&intersectShape, VEC3 &point, int &part) const {
+	// Only shapes whose bounding boxes the ray passes through are tested
+	//	closestHit keeps closestTime up to date, so the part of the closest hit so far is kept with it
+	float closestTime;
+	int closestIndex;
+	bool intersects = bvh.closestHit(ray, [&](int i, float &t) {
+		int shapePart;
+		if (leafShapes[i]->intersectsPart(ray, t, shapePart) and t < closestTime) {
+			part = shapePart;
+			return true;
 		}
-	}
+		return false;
+	}, closestTime, closestIndex);
 
 	// Calculate intersection point
-	if (closestTime != -1) {
+	if (intersects) {
+		intersectShape = leafShapes[closestIndex];
 		point = ray.o + closestTime * ray.d;
 		return true;
 	}
 	return false;
-}
\ No newline at end of file
+}
@@ -5,17 +5,24 @@
 #define _PHYSICSWORLD_H
 
 #include "shapes.h"
+#include "bvh.h"
 
 class PhysicsWorld {
 	const vector<const Shape *> &shapes;	// The shapes defining the entire world
+	BVH bvh;	// Acceleration structure over the shapes
+	vector<const Shape *> leafShapes;	// The shapes in BVH leaf order, so each subtree is contiguous
 
 public:
+	// Builds the BVH over the shapes; the shapes must not move while the world is in use
 	PhysicsWorld(const vector<const Shape*> &shapes);
 
 	// Returns true if the ray intersects with a shape in the world
 	// 	Sets intersectShape to the closest shape with which the ray intersects
 	//	Sets point to the point at which the ray hits the shape
 	bool existsClosestIntersection(const Ray &ray, const Shape *&intersectShape, VEC3 &point) const;
+
+	// As above, and sets part to the part of the shape that was hit (see Shape::intersectsPart)
+	bool existsClosestIntersection(const Ray &ray, const Shape *&intersectShape, VEC3 &point, int &part) const;
 };
 
 #endif
\ No newline at end of file
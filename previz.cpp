@@ -17,9 +17,16 @@
 #include <cstdlib>
 #include <ctime>
 #include <cmath>
+#include <cstring>
 #include <iostream>
 #include <float.h>
 #include <time.h>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
 #include "SETTINGS.h"
 
 #include "ray.h"
@@ -28,10 +35,24 @@
 #include "texture.h"
 #include "raytracer.h"
 #include "shader.h"
+#include "threadPool.h"
+#include "tiles.h"
+#include "denoiser.h"
+#include "temporal.h"
+#include "radianceCache.h"
+#include "lightmap.h"
+#include "pagedMesh.h"
 
 #include "skeleton.h"
 #include "displaySkeleton.h"
 #include "motion.h"
+#include "skinnedMesh.h"
+#include "renderContext.h"
+#include "farm.h"
+#include "server.h"
+#include "boundedQueue.h"
+#include "frameWriter.h"
+#include "frames/QUICKTIME_MOVIE.h"
 
 using namespace std;
 
@@ -50,31 +71,60 @@ int FRAME_INCREMENT = 8;	// How many frames of the stickfigure to skip per frame
 
 int SCENE_CHANGE_FRAME = 100;
 
-// Stick-man classes
-DisplaySkeleton displayer;    
+// Stick-man classes, used to load the motion that every render context shares
 Skeleton* skeleton;
 Motion* motion;
 
 extern const int WINDOW_WIDTH;
 extern const int WINDOW_HEIGHT;
+extern const int STRATIFIED_SAMPLING_ROOT;
+extern const bool USE_SKINNED_CHARACTER;
+extern const int SKIN_RINGS_PER_BONE;
+extern const int SKIN_SEGMENTS_PER_RING;
+extern const int RENDER_THREAD_NUM;
+extern const int TILE_SIZE;
+extern const int FRAMES_IN_FLIGHT;
+extern const int RENDER_STAGE_NUM;
+extern const int OUTPUT_BUFFER_NUM;
+extern const bool OUTPUT_DIRECT_IO;
+extern const bool WRITE_MOVIE;
+extern const bool WRITE_FRAME_PPMS;
+extern const bool PIN_RENDER_THREADS;
+extern const int PREVIEW_RESOLUTION_DIVISOR;
+extern const int PREVIEW_SAMPLING_ROOT;
+extern const double PROGRESSIVE_SECONDS_PER_FRAME;
+extern const float PROGRESSIVE_ERROR_TARGET;
+extern const bool DENOISE;
+extern const bool TEMPORAL_ACCUMULATION;
+extern const bool RADIANCE_CACHE;
+extern const int RADIANCE_CACHE_ENTRIES;
+extern const float RADIANCE_CACHE_CELL_SIZE;
+extern const int RADIANCE_CACHE_SAMPLES;
+extern const bool LIGHTMAPS;
+extern const char LIGHTMAP_FILENAME[];
+extern const char OUT_OF_CORE_MESH_FILENAME[];
+extern const int OUT_OF_CORE_TRIANGLES_PER_PAGE;
+extern const int OUT_OF_CORE_RESIDENT_MB;
+extern const int OUT_OF_CORE_PIXEL_RETRIES;
 
 //VEC3 eye(-3, 0.5, 1);	// original
 //VEC3 eye(-6, 0.5, 1);
 
-// Current parameters for the camera
-VEC3 eye;
-VEC3 lookingAt;
-VEC3 up;
+// Worker threads that render the tiles of every frame
+ThreadPool *renderPool = NULL;
 
-vector<const Shape *> shapes;
-vector<const Light> lights;
+// Shadows at the hits of glossy reflections, kept from frame to frame (NULL if not used)
+RadianceCache *radianceCache = NULL;
 
-// Materials for rendering
-RayTracer *tracer = NULL;
-RayTracer *&rayTracer = tracer;
+// Baked shadows of the static shapes, loaded or baked before rendering (NULL if not used)
+Lightmaps *lightmaps = NULL;
+
+// Mesh too big for memory, paged in from disk and shared by every context (NULL if not used)
+PagedMesh *pagedMesh = NULL;
+
+// Materials for rendering (glossy plastic belongs to each RenderContext, since it traces rays)
 extern const Plastic plastic(10.0);
 extern const Metal metal(0.2, 0.5);
-extern const GlossyPlastic glossyPlastic(10.0, rayTracer);
 
 extern const Texture brushedMetal("textures/demo_brushed_metal.ppm", 800, 533);
 extern const Texture marbleCheckerboard("textures/marble_checkerboard.ppm", 1200, 802);
@@ -86,12 +136,9 @@ extern const Texture emptyFrame("textures/empty_frame.ppm", 1920, 1309);
 
 //////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////
-void writePPM(const string& filename, float& xRes, float& yRes, const float* values)
+void writePPM(const string& filename, int xRes, int yRes, const unsigned char* pixels)
 {
-	int totalCells = (int) xRes * (int) yRes;
-	unsigned char* pixels = new unsigned char[3 * totalCells];
-	for (int i = 0; i < 3 * totalCells; i++)
-		pixels[i] = values[i];
+	int totalCells = xRes * yRes;
 
 	FILE *fp;
 	fp = fopen(filename.c_str(), "wb");
@@ -103,10 +150,9 @@ void writePPM(const string& filename, float& xRes, float& yRes, const float* val
 		exit(0);
 	}
 
-	fprintf(fp, "P6\n%d %d\n255\n", (int) xRes, (int) yRes);
+	fprintf(fp, "P6\n%d %d\n255\n", xRes, yRes);
 	fwrite(pixels, 1, totalCells * 3, fp);
 	fclose(fp);
-	delete[] pixels;
 }
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -118,80 +164,418 @@ float clamp(float value)
 	return value;
 }
 
-void renderImage(const string& filename) 
+// Converts a colour channel to a byte, rounding down
+unsigned char toByte(float value)
+{
+	float scaled = clamp(value) * 255.0;
+	return scaled;
+}
+
+// Calls renderPixel(row, column) for every pixel of the tile
+//	With an out-of-core mesh, a pixel whose rays reach pages of it that aren't in
+//	memory is set aside while they are read in, and the rest of the tile goes on.
+//	Pixels set aside are traced again after the others, up to
+//	OUT_OF_CORE_PIXEL_RETRIES times, and then one last time waiting for their pages.
+//	renderPixel must write its pixel whole, over whatever a try set aside wrote.
+void forEachTilePixel(const Tile &tile, const function<void(int, int)> &renderPixel)
+{
+	vector<pair<int, int> > setAside;
+	for (int row = tile.firstRow; row < tile.lastRow; row++) {
+		for (int column = tile.firstColumn; column < tile.lastColumn; column++) {
+			if (pagedMesh == NULL) {
+				renderPixel(row, column);
+				continue;
+			}
+			startDeferringPages();
+			renderPixel(row, column);
+			if (finishDeferringPages()) {
+				setAside.push_back(make_pair(row, column));
+			}
+		}
+	}
+
+	for (int retry = 0; retry < OUT_OF_CORE_PIXEL_RETRIES and not setAside.empty(); retry++) {
+		vector<pair<int, int> > stillMissing;
+		for (const pair<int, int> &pixel : setAside) {
+			startDeferringPages();
+			renderPixel(pixel.first, pixel.second);
+			if (finishDeferringPages()) {
+				stillMissing.push_back(pixel);
+			}
+		}
+		setAside.swap(stillMissing);
+	}
+	for (const pair<int, int> &pixel : setAside) {
+		renderPixel(pixel.first, pixel.second);
+	}
+}
+
+// Renders the pixels of one tile into an 8-bit image outWidth pixels wide,
+//	whose top left pixel is at (outColumn, outRow) of the frame
+void renderTile(const RayTracer &tracer, const Camera &camera, const Tile &tile, unsigned char* ppmOut, int outWidth, int outColumn, int outRow)
+{
+	forEachTilePixel(tile, [&](int row, int column) {
+		// Row 0 is the top of the image, at the top of the screen
+		int x = camera.screenLeft + column;
+		int y = camera.screenTop - row;
+		VEC3 colour = tracer.calculateAveragedPixelcolour(x, y);
+
+		// set, in final image
+		int startPos = 3 * (outWidth * (row - outRow) + column - outColumn);
+		ppmOut[startPos] = toByte(colour[0]);
+		ppmOut[startPos + 1] = toByte(colour[1]);
+		ppmOut[startPos + 2] = toByte(colour[2]);
+	});
+}
+
+// Finds the denoiser's features (see denoiser.h) for the pixels of one tile
+void findTileFeatures(const RayTracer &tracer, const Camera &camera, const Tile &tile, DenoiseBuffers &buffers)
+{
+	forEachTilePixel(tile, [&](int row, int column) {
+		VEC3 albedo, normal;
+		float depth;
+		tracer.calculatePixelFeatures(camera.screenLeft + column, camera.screenTop - row, albedo, normal, depth);
+		buffers.setFeatures(buffers.width * row + column, albedo, normal, depth);
+	});
+}
+
+// Lets the frames rendering at once take turns in frame order, starting from the first
+class FrameOrder {
+	int next;	// Frame whose turn it is
+	mutex lock;
+	condition_variable turnTaken;
+
+public:
+	FrameOrder(int first) : next(first) {}
+
+	// Waits for the frames before to have had their turn
+	void waitForTurn(int frame) {
+		unique_lock<mutex> guard(lock);
+		turnTaken.wait(guard, [&] { return next == frame; });
+	}
+
+	// Ends the frame's turn, which must be the current one
+	void endTurn(int frame) {
+		{
+			lock_guard<mutex> guard(lock);
+			next = frame + 1;
+		}
+		turnTaken.notify_all();
+	}
+};
+
+// The history of a series of frames (see temporal.h), which frames rendering at
+//	once blend into one after another, in order
+struct FrameHistory {
+	TemporalHistory frames;
+	FrameOrder order;
+
+	FrameHistory(int firstFrame) : order(firstFrame) {}
+};
+
+// Writes the colours in the buffers out as 8-bit RGB pixels
+void writeBufferPixels(const DenoiseBuffers &buffers, unsigned char *pixels)
+{
+	for (int pixel = 0; pixel < buffers.width * buffers.height; pixel++) {
+		VEC3 colour = buffers.getColour(pixel);
+		pixels[3 * pixel] = toByte(colour[0]);
+		pixels[3 * pixel + 1] = toByte(colour[1]);
+		pixels[3 * pixel + 2] = toByte(colour[2]);
+	}
+}
+
+// Blends the colours in the buffers with the frames before (if given their history)
+//	and denoises them (if DENOISE is on), then writes them out as 8-bit RGB pixels
+//	Only the blending waits for the frames before; the tracing has been done already.
+void writeFilteredPixels(DenoiseBuffers &buffers, const Camera &camera, int frame, FrameHistory *history,
+	ThreadPool &pool, unsigned char *pixels)
+{
+	if (history != NULL) {
+		history->order.waitForTurn(frame);
+		if (frame == SCENE_CHANGE_FRAME) {
+			history->frames.reset();
+		}
+		history->frames.accumulate(buffers, camera, frame, pool);
+		history->order.endTurn(frame);
+	}
+	if (DENOISE) {
+		denoise(buffers, pool);
+	}
+	writeBufferPixels(buffers, pixels);
+}
+
+// Farm tiles of a frame to be denoised bring back each pixel's colour and features
+//	as floats, rather than its 8-bit colour, so the coordinator can denoise the
+//	whole frame once every tile is in, the same as renderImage would have
+static const int FARM_PIXEL_FLOATS = 10;	// Colour, albedo, normal and depth
+
+// Bytes of each pixel of a farm tile
+int farmPixelBytes()
+{
+	return DENOISE ? FARM_PIXEL_FLOATS * sizeof(float) : 3;
+}
+
+void packFarmPixel(const DenoiseBuffers &buffers, int pixel, unsigned char *bytes)
 {
-	Camera camera(WINDOW_WIDTH, WINDOW_HEIGHT, eye, lookingAt, up, nearPlane, fovy);
-
-	// allocate the final image
-	const int totalCells = camera.xRes * camera.yRes;
-	float* ppmOut = new float[3 * totalCells];
-
-	// Create rendering objects
-	PhysicsWorld world(shapes);	// Calculates intersections
-	Shader shader(lights, world, eye);	// Calculates colours
-	if (rayTracer != NULL) {
-		delete rayTracer;
-	}
-	rayTracer = new RayTracer(camera, shader, world);
-	//RayTracer rayTracer(camera, shader, world);	// Interface handling all raytracing
-
-	for (int y = camera.screenBot; y <= camera.screenTop; y++) {                       // WHAT IF IT'S NOT DIVISIBLE BY 2?
-		for (int x = camera.screenLeft; x <= camera.screenRight; x++) {
-			//cout << "tracing a ray" << endl;
-			// Get the colour
-			VEC3 colour = rayTracer->calculateAveragedPixelcolour(x, y);
-			//Ray ray = rayTracer->generateAtCoord(x, y);
-			//VEC3 colour = rayTracer->calculateColour(ray);
-			//cout << "getting the colour" << endl;
-
-			// set, in final image
-			int startPos = 3 * ((camera.xRes * (camera.screenTop - y)) + (x - camera.screenLeft));
-			ppmOut[startPos] = clamp(colour[0]) * 255.0;
-			ppmOut[startPos + 1] = clamp(colour[1]) * 255.0;
-			ppmOut[startPos + 2] = clamp(colour[2]) * 255.0;
-			//ppmOut[3 * (y * camera.xRes + x)] = clamp(color[0]) * 255.0f;
-			//ppmOut[3 * (y * camera.xRes + x) + 1] = clamp(color[1]) * 255.0f;
-			//ppmOut[3 * (y * camera.xRes + x) + 2] = clamp(color[2]) * 255.0f;
+	float values[FARM_PIXEL_FLOATS];
+	for (int c = 0; c < 3; c++) {
+		values[c] = buffers.colour[c][pixel];
+		values[3 + c] = buffers.albedo[c][pixel];
+		values[6 + c] = buffers.normal[c][pixel];
+	}
+	values[9] = buffers.depth[pixel];
+	memcpy(bytes, values, sizeof(values));
+}
+
+void unpackFarmPixel(const unsigned char *bytes, DenoiseBuffers &buffers, int pixel)
+{
+	float values[FARM_PIXEL_FLOATS];
+	memcpy(values, bytes, sizeof(values));
+	for (int c = 0; c < 3; c++) {
+		buffers.colour[c][pixel] = values[c];
+		buffers.albedo[c][pixel] = values[3 + c];
+		buffers.normal[c][pixel] = values[6 + c];
+	}
+	buffers.depth[pixel] = values[9];
+}
+
+// Builds the camera and tracer for the context's scene, and renders with them
+void traceFrame(RenderContext &context, int frame, const function<void(const RayTracer &, const Camera &)> &render)
+{
+	Camera camera(context.width, context.height, context.eye, context.lookingAt, context.up, nearPlane, fovy);
+
+	// Create rendering objects; the world was built along with the scene
+	PhysicsWorld &world = *context.world;	// Calculates intersections
+	if (radianceCache != NULL) {
+		radianceCache->startFrame(frame, context.movingBounds, context.lights);
+	}
+	Shader shader(context.lights, world, context.eye, radianceCache, lightmaps, context.movingWorld);	// Calculates colours
+	RayTracer tracer(camera, shader, world, frame, context.samplingRoot);	// Interface handling all raytracing
+	context.tracer = &tracer;	// For the glossy material's reflection rays
+
+	render(tracer, camera);
+	context.tracer = NULL;
+}
+
+// Renders passes over the whole frame into an accumulation buffer, until
+//	PROGRESSIVE_SECONDS_PER_FRAME have passed or every pixel is within
+//	PROGRESSIVE_ERROR_TARGET, then writes out the average of every sample so far
+//	The first pass always finishes, and is the usual single-pass image. After that,
+//	tiles not started before the deadline wait for the next frame, and pixels that
+//	have converged get no more rays.
+void renderImageProgressive(RenderContext &context, int frame, ThreadPool &pool, unsigned char *pixels,
+	FrameHistory *history)
+{
+	chrono::steady_clock::time_point deadline = chrono::steady_clock::now() +
+		chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(PROGRESSIVE_SECONDS_PER_FRAME));
+
+	traceFrame(context, frame, [&](const RayTracer &tracer, const Camera &camera) {
+		int width = camera.xRes;
+		int height = camera.yRes;
+		int binNum = context.samplingRoot * context.samplingRoot;
+		float errorTarget = PROGRESSIVE_ERROR_TARGET * PROGRESSIVE_ERROR_TARGET;
+
+		// Running sums of every pixel's samples
+		vector<VEC3> colourSums(width * height, VEC3(0, 0, 0));
+		vector<float> luminanceSums(width * height, 0);
+		vector<float> luminanceSquaredSums(width * height, 0);
+		vector<int> sampleNums(width * height, 0);
+		auto isConverged = [&](int pixel) {
+			int n = sampleNums[pixel];
+			if (n < 2) {
+				return false;
+			}
+			float mean = luminanceSums[pixel] / n;
+			float variance = max(0.0f, (luminanceSquaredSums[pixel] - n * mean * mean) / (n - 1));
+			return variance / n <= errorTarget;
+		};
+
+		vector<Tile> tiles = createTiles(width, height, TILE_SIZE);
+		for (int pass = 0; ; pass++) {
+			atomic<int> unconvergedNum(0);
+			pool.run(tiles.size(), [&](int i) {
+				if (pass > 0 and chrono::steady_clock::now() >= deadline) {
+					return;
+				}
+				forEachTilePixel(tiles[i], [&](int row, int column) {
+					int pixel = width * row + column;
+					if (pass > 0 and isConverged(pixel)) {
+						return;
+					}
+					VEC3 colourSum(0, 0, 0);
+					float luminanceSum = 0, luminanceSquaredSum = 0;
+					for (int bin = 0; bin < binNum; bin++) {
+						VEC3 sample = tracer.calculateSampleColour(camera.screenLeft + column,
+							camera.screenTop - row, sampleNums[pixel] + bin);
+						float luminance = displayedLuminance(sample);
+						colourSum += sample;
+						luminanceSum += luminance;
+						luminanceSquaredSum += luminance * luminance;
+					}
+
+					// A try set aside for an out-of-core mesh's pages is traced again, so adds nothing
+					if (pagesMissed()) {
+						return;
+					}
+					colourSums[pixel] += colourSum;
+					luminanceSums[pixel] += luminanceSum;
+					luminanceSquaredSums[pixel] += luminanceSquaredSum;
+					sampleNums[pixel] += binNum;
+					if (not isConverged(pixel)) {
+						unconvergedNum++;
+					}
+				});
+			});
+			if (unconvergedNum == 0 or chrono::steady_clock::now() >= deadline) {
+				break;
+			}
+		}
+
+		if (DENOISE or history != NULL) {
+			DenoiseBuffers buffers(width, height);
+			for (int pixel = 0; pixel < width * height; pixel++) {
+				buffers.setColour(pixel, colourSums[pixel] / (float) sampleNums[pixel]);
+			}
+			pool.run(tiles.size(), [&](int i) {
+				findTileFeatures(tracer, camera, tiles[i], buffers);
+			});
+			writeFilteredPixels(buffers, camera, frame, history, pool, pixels);
+			return;
+		}
+
+		for (int pixel = 0; pixel < width * height; pixel++) {
+			VEC3 colour = colourSums[pixel] / (float) sampleNums[pixel];
+			pixels[3 * pixel] = toByte(colour[0]);
+			pixels[3 * pixel + 1] = toByte(colour[1]);
+			pixels[3 * pixel + 2] = toByte(colour[2]);
 		}
+	});
+}
+
+// Renders the frame tile by tile on the thread pool, straight into
+//	context.width x context.height 8-bit RGB pixels
+//	Given the history of the frames rendered before it, the frame is blended with
+//	them (see temporal.h), and becomes their history for the next frame.
+void renderImage(RenderContext &context, int frame, ThreadPool &pool, unsigned char *pixels,
+	FrameHistory *history = NULL)
+{
+	if (PROGRESSIVE_SECONDS_PER_FRAME > 0) {
+		renderImageProgressive(context, frame, pool, pixels, history);
+		return;
 	}
-	writePPM(filename, camera.xRes, camera.yRes, ppmOut);
 
-	delete[] ppmOut;
+	traceFrame(context, frame, [&](const RayTracer &tracer, const Camera &camera) {
+		// Tiles come in Hilbert order; the pool balances out the expensive ones
+		vector<Tile> tiles = createTiles(camera.xRes, camera.yRes, TILE_SIZE);
+
+		// The denoiser and the history need the colours as floats, and the features alongside
+		if (DENOISE or history != NULL) {
+			DenoiseBuffers buffers(camera.xRes, camera.yRes);
+			pool.run(tiles.size(), [&](int i) {
+				forEachTilePixel(tiles[i], [&](int row, int column) {
+					VEC3 colour = tracer.calculateAveragedPixelcolour(camera.screenLeft + column, camera.screenTop - row);
+					buffers.setColour(buffers.width * row + column, colour);
+				});
+				findTileFeatures(tracer, camera, tiles[i], buffers);
+			});
+			writeFilteredPixels(buffers, camera, frame, history, pool, pixels);
+			return;
+		}
+
+		pool.run(tiles.size(), [&](int i) {
+			renderTile(tracer, camera, tiles[i], pixels, camera.xRes, 0, 0);
+		});
+	});
+}
+
+// Renders just the given tiles of the frame on the thread pool, each into its own
+//	pixels of farmPixelBytes(): 8-bit RGB, or if the frame is to be denoised, its
+//	colours and features for the coordinator to denoise (see denoiseFarmFrame)
+void renderImageTiles(RenderContext &context, int frame, ThreadPool &pool, const vector<Tile> &tiles,
+	vector<vector<unsigned char> > &pixels, vector<double> &seconds)
+{
+	pixels.resize(tiles.size());
+	seconds.resize(tiles.size());
+	traceFrame(context, frame, [&](const RayTracer &tracer, const Camera &camera) {
+		// Only the given tiles' part of the buffers is filled in
+		DenoiseBuffers buffers(DENOISE ? camera.xRes : 0, DENOISE ? camera.yRes : 0);
+
+		pool.run(tiles.size(), [&](int i) {
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+			const Tile &tile = tiles[i];
+			int tileWidth = tile.lastColumn - tile.firstColumn;
+			int tileCells = tileWidth * (tile.lastRow - tile.firstRow);
+			pixels[i].resize(farmPixelBytes() * tileCells);
+			if (DENOISE) {
+				forEachTilePixel(tile, [&](int row, int column) {
+					VEC3 colour = tracer.calculateAveragedPixelcolour(camera.screenLeft + column, camera.screenTop - row);
+					buffers.setColour(buffers.width * row + column, colour);
+				});
+				findTileFeatures(tracer, camera, tile, buffers);
+				for (int row = tile.firstRow; row < tile.lastRow; row++) {
+					for (int column = tile.firstColumn; column < tile.lastColumn; column++) {
+						int tilePixel = tileWidth * (row - tile.firstRow) + column - tile.firstColumn;
+						packFarmPixel(buffers, buffers.width * row + column, &pixels[i][farmPixelBytes() * tilePixel]);
+					}
+				}
+			} else {
+				renderTile(tracer, camera, tile, pixels[i].data(), tileWidth, tile.firstColumn, tile.firstRow);
+			}
+
+			seconds[i] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		});
+	});
+}
+
+// Denoises a frame put together from farm tiles of colours and features (see
+//	renderImageTiles) into width x height 8-bit RGB pixels
+void denoiseFarmFrame(const vector<unsigned char> &tilePixels, int width, int height, ThreadPool &pool,
+	vector<unsigned char> &pixels)
+{
+	DenoiseBuffers buffers(width, height);
+	for (int pixel = 0; pixel < width * height; pixel++) {
+		unpackFarmPixel(&tilePixels[(size_t) farmPixelBytes() * pixel], buffers, pixel);
+	}
+	denoise(buffers, pool);
+	pixels.resize(3 * width * height);
+	writeBufferPixels(buffers, pixels.data());
 }
 
 
 //////////////////////////////////////////////////////////////////////////////////
 // Load up a new motion captured frame
 //////////////////////////////////////////////////////////////////////////////////
-void setSkeletonsToSpecifiedFrame(int frameIndex)
+void setSkeletonsToSpecifiedFrame(RenderContext &context, int frameIndex)
 {
 	if (frameIndex < 0)
 	{
 		printf("Error in SetSkeletonsToSpecifiedFrame: frameIndex %d is illegal.\n", frameIndex);
 		exit(0);
 	}
-	if (displayer.GetSkeletonMotion(0) != NULL)
+	if (context.motion != NULL)
 	{
 		int postureID;
-		if (frameIndex >= displayer.GetSkeletonMotion(0)->GetNumFrames())
+		if (frameIndex >= context.motion->GetNumFrames())
 		{
 			cout << " We hit the last frame! You might want to pick a different sequence. " << endl;
-			postureID = displayer.GetSkeletonMotion(0)->GetNumFrames() - 1;
+			postureID = context.motion->GetNumFrames() - 1;
 		}
 		else 
 			postureID = frameIndex;
-		displayer.GetSkeleton(0)->setPosture(* (displayer.GetSkeletonMotion(0)->GetPosture(postureID)));
+		context.displayer.GetSkeleton(0)->setPosture(* (context.motion->GetPosture(postureID)));
 	}
 }
 
 
 
 // Calculates the camera position and direction for this frame
-void setCamera(int frame) {
+void setCamera(RenderContext &context, int frame) {
 	// Camera starting position
+	VEC3 &eye = context.eye;
 	eye = sEYE;
-	lookingAt = sLOOKINGAT;
-	up = sUP;
+	context.lookingAt = sLOOKINGAT;
+	context.up = sUP;
 
 	// Increment position of camera for every previous frame
 	for (int curFrame = 0; curFrame < frame; curFrame++)
@@ -212,7 +596,7 @@ void setCamera(int frame) {
 ////////////////////////////////////////////////////////////////////////////////
 
 // Creates the triangles for the floor
-void createFloor() {
+void createFloor(RenderContext &context) {
 	for (int x = -4; x < 8; x+=2) {
 		for (int z = -2; z < 8; z+=2) {
 			//shapes.push_back(new Sphere(VEC3(x, floorLevel-1, z), 1, VEC3(0.5, 0.5, 0.5), 10));
@@ -223,8 +607,8 @@ void createFloor() {
 			triangle1->setTextureCoords(VEC2(0, 0), VEC2(1, 0), VEC2(1, 1));
 			triangle2->setTextureCoords(VEC2(0, 0), VEC2(0, 1), VEC2(1, 1));
 
-			shapes.push_back(triangle1);
-			shapes.push_back(triangle2);
+			context.shapes.push_back(triangle1);
+			context.shapes.push_back(triangle2);
 		}
 	}
 
@@ -233,7 +617,7 @@ void createFloor() {
 	//shapes.push_back(new Triangle(VEC3(3, -1, 2), VEC3(5, -1, 0), VEC3(5, -1, 4), VEC3(0, 1, 1), 10));
 }
 
-void createWall() {
+void createWall(RenderContext &context) {
 	// Create ridge at base of back wall
 	float ridgeHeight = 0.4;	// The height and depth of the ridge
 	Triangle *triangle1 = new Triangle(VEC3(8, FLOOR_LEVEL, -2), VEC3(8, FLOOR_LEVEL, 8), VEC3(8+ridgeHeight, FLOOR_LEVEL+ridgeHeight, -2), metal, &swimmingMarble);//VEC3(0.5, 0.5, 0.5)));//VEC3(0.5, 0.5, 0.5), 10));
@@ -242,8 +626,8 @@ void createWall() {
 	triangle1->setTextureCoords(VEC2(0, 0.2), VEC2(0, 1), VEC2(0.4, 0.2));
 	triangle2->setTextureCoords(VEC2(0, 1), VEC2(0.4, 0.2), VEC2(0.4, 1));
 
-	shapes.push_back(triangle1);
-	shapes.push_back(triangle2);
+	context.shapes.push_back(triangle1);
+	context.shapes.push_back(triangle2);
 
 	// Create back wall
 	float wallDepth = 8 + ridgeHeight;	// The depth of the entire back wall
@@ -255,8 +639,8 @@ void createWall() {
 	triangle3->setTextureCoords(VEC2(0, 0.2), VEC2(0, 1), VEC2(0.4, 0.2));
 	triangle4->setTextureCoords(VEC2(0, 1), VEC2(0.4, 0.2), VEC2(0.4, 1));
 
-	shapes.push_back(triangle3);
-	shapes.push_back(triangle4);
+	context.shapes.push_back(triangle3);
+	context.shapes.push_back(triangle4);
 
 	// Create ridge at base of right wall
 	float ridgeRight = 8;	// How far on the right the ridge is
@@ -266,8 +650,8 @@ void createWall() {
 	triangle5->setTextureCoords(VEC2(0, 0.2), VEC2(0, 1), VEC2(0.4, 0.2));
 	triangle6->setTextureCoords(VEC2(0, 1), VEC2(0.4, 0.2), VEC2(0.4, 1));
 
-	shapes.push_back(triangle5);
-	shapes.push_back(triangle6);
+	context.shapes.push_back(triangle5);
+	context.shapes.push_back(triangle6);
 
 	// Create right wall
 	Triangle *triangle7 = new Triangle(VEC3(8, wallBase, ridgeRight+ridgeHeight), VEC3(8, wallBase+wallHeight, ridgeRight+ridgeHeight), VEC3(-4, wallBase, ridgeRight+ridgeHeight), metal, &swimmingWall);//VEC3(0.5, 0.5, 0.5)));//VEC3(0.5, 0.5, 0.5), 10));
@@ -276,12 +660,12 @@ void createWall() {
 	triangle7->setTextureCoords(VEC2(0, 0.2), VEC2(0, 1), VEC2(0.4, 0.2));
 	triangle8->setTextureCoords(VEC2(0, 1), VEC2(0.4, 0.2), VEC2(0.4, 1));
 
-	shapes.push_back(triangle7);
-	shapes.push_back(triangle8);
+	context.shapes.push_back(triangle7);
+	context.shapes.push_back(triangle8);
 }
 
 // Creates a cube with back-bottom-left corner at location, side lengths, and height. (and texture + color!)
-void createCube(VEC3 loc, float side, float height, const Material& material,  VEC3 color) {
+void createCube(RenderContext &context, VEC3 loc, float side, float height, const Material& material,  VEC3 color) {
 
 	VEC3 A(loc[0] - side, loc[1], loc[2]);
 	VEC3 B(loc[0] - side, loc[1] + side + height, loc[2]);
@@ -293,17 +677,17 @@ void createCube(VEC3 loc, float side, float height, const Material& material,  V
 	VEC3 H(loc[0], loc[1], loc[2] + side);
 
 	// front face
-	shapes.push_back(new Triangle(A, B, D, material, color));					
-	shapes.push_back(new Triangle(C, D, B, material, color));
+	context.shapes.push_back(new Triangle(A, B, D, material, color));					
+	context.shapes.push_back(new Triangle(C, D, B, material, color));
 	// left face
-	shapes.push_back(new Triangle(E, F, A, material, color));
-	shapes.push_back(new Triangle(B, A, F, material, color));
+	context.shapes.push_back(new Triangle(E, F, A, material, color));
+	context.shapes.push_back(new Triangle(B, A, F, material, color));
 	// right face
-	shapes.push_back(new Triangle(C, G, D, material, color));
-	shapes.push_back(new Triangle(H, D, G, material, color));
+	context.shapes.push_back(new Triangle(C, G, D, material, color));
+	context.shapes.push_back(new Triangle(H, D, G, material, color));
 	// back face
-	shapes.push_back(new Triangle(F, G, E, material, color));
-	shapes.push_back(new Triangle(H, E, G, material, color));
+	context.shapes.push_back(new Triangle(F, G, E, material, color));
+	context.shapes.push_back(new Triangle(H, E, G, material, color));
 }
 
 
@@ -313,8 +697,9 @@ VEC3 computeStickfigureMovement(int frame)
 	return VEC3(0, 0, (float) frame * STICKFIGURE_SPEED);
 }
 
-void createSkeleton(int frameNumber)
+void createSkeleton(RenderContext &context, int frameNumber)
 {
+	DisplaySkeleton &displayer = context.displayer;
 	displayer.ComputeBonePositions(DisplaySkeleton::BONES_AND_LOCAL_FRAMES);
 
 	// retrieve all the bones of the skeleton
@@ -326,6 +711,15 @@ void createSkeleton(int frameNumber)
 	// Get stickfigure movement vector (to add to position)
 	VEC3 stickfigureMovement = computeStickfigureMovement(frameNumber);
 
+	// Move the skin with the bones instead of building cylinders
+	if (USE_SKINNED_CHARACTER) {
+		context.character->deform(displayer, stickfigureMovement, *renderPool);
+		context.shapes.push_back(context.character);
+		context.movingShapes.push_back(context.character);
+		context.movingBounds.expand(context.character->getBoundingBox());
+		return;
+	}
+
 	// build a sphere list, but skip the first bone, 
 	// it's just the origin
 	int totalBones = rotations.size();
@@ -355,26 +749,34 @@ void createSkeleton(int frameNumber)
 		// store the spheres
 		VEC3 center = (rightVertex.head<3>() + leftVertex.head<3>()) / 2;
 		VEC3 up = rightVertex.head<3>() - leftVertex.head<3>();
-		shapes.push_back(new Cylinder(center + stickfigureMovement, 0.05, lengths[x], up, plastic, VEC3(1, 0, 0)));
+		context.shapes.push_back(new Cylinder(center + stickfigureMovement, 0.05, lengths[x], up, plastic, VEC3(1, 0, 0)));
+		context.movingShapes.push_back(context.shapes.back());
+		context.movingBounds.expand(context.shapes.back()->getBoundingBox());
 	}
 }
 
 
 
-void buildFirstScene(int frameNumber)
+void buildFirstScene(RenderContext &context, int frameNumber)
 {
-	shapes.clear();															// DO WE NEED TO DELETE THE SPHERES?
+	context.clearShapes();
 
-	createFloor();
-	createWall();
+	createFloor(context);
+	createWall(context);
 	// createGlossyCube();
-	createCube(VEC3(2, 0, 3), 2, 4, glossyPlastic, VEC3(0, 0, 0));		// create a glossy cube!
+	createCube(context, VEC3(2, 0, 3), 2, 4, context.glossyPlastic, VEC3(0, 0, 0));		// create a glossy cube!
 
-	createSkeleton(frameNumber);
+	createSkeleton(context, frameNumber);
 
+	if (context.pagedMesh != NULL) {
+		context.shapes.push_back(context.pagedMesh);
+	}
+
+	vector<Light> &lights = context.lights;
 	lights.clear();													// REMOVE; LIGHTS NEVER NEED TO MOVE
-	lights.push_back(Light{ VEC3(-3, 1.5, 1), VEC3(1, 1, 1) });//VEC3(-1, 1.5, 3), VEC3(7, 2.5, 1) });
-	lights.push_back(Light{ VEC3(1, 2.5, -1), VEC3(1, 1, 1) });//VEC3(-1, 1.5, 3), VEC3(7, 2.5, 1) });
+	// 3 x 3 horizontal panels
+	lights.push_back(rectangleLight(VEC3(-3, 1.5, 1), VEC3(1.5, 0, 0), VEC3(0, 0, 1.5), VEC3(1, 1, 1)));//VEC3(-1, 1.5, 3), VEC3(7, 2.5, 1) });
+	lights.push_back(rectangleLight(VEC3(1, 2.5, -1), VEC3(1.5, 0, 0), VEC3(0, 0, 1.5), VEC3(1, 1, 1)));//VEC3(-1, 1.5, 3), VEC3(7, 2.5, 1) });
 
 	
 
@@ -430,7 +832,7 @@ void buildFirstScene(int frameNumber)
 ////////////////////////////////////////////////////////////////////////////////
 
 
-void buildSecondScene(int frameNumber) {
+void buildSecondScene(RenderContext &context, int frameNumber) {
 
 }
 
@@ -439,32 +841,341 @@ void buildSecondScene(int frameNumber) {
 // Build a list of spheres in the scene
 //////////////////////////////////////////////////////////////////////////////////
 
-void buildScene(int frameNumber) {
+void buildScene(RenderContext &context, int frameNumber) {
 	if (frameNumber < SCENE_CHANGE_FRAME) {
-		buildFirstScene(frameNumber);
+		buildFirstScene(context, frameNumber);
 	} else {
-		buildSecondScene(frameNumber);
+		buildSecondScene(context, frameNumber);
 	}
 }
 
+//////////////////////////////////////////////////////////////////////////////////
+// Create a context for rendering frames, with its own skeleton and skin
+//////////////////////////////////////////////////////////////////////////////////
+RenderContext *createRenderContext(const string &skeletonFilename)
+{
+	RenderContext *context = new RenderContext(skeletonFilename, motion);
+	context->pagedMesh = pagedMesh;
+
+	// Skin the skeleton in its first posture, which becomes the bind pose
+	if (USE_SKINNED_CHARACTER) {
+		context->character = new SkinnedMesh(context->displayer, 0.05, plastic, VEC3(1, 0, 0),
+			SKIN_RINGS_PER_BONE, SKIN_SEGMENTS_PER_RING);
+	}
+	return context;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Pose the skeleton, build the scene and its BVH, and place the camera for one frame
+//////////////////////////////////////////////////////////////////////////////////
+void prepareFrame(RenderContext &context, int x)
+{
+	setSkeletonsToSpecifiedFrame(context, x * FRAME_INCREMENT);
+	buildScene(context, x);
+	context.buildWorld();
+	//cout << "finished building scene" << endl;
+	setCamera(context, x);
+}
+
+// The file a frame is written to, numbered for the movie maker
+string frameFilename(int x)
+{
+	char buffer[256];
+	sprintf(buffer, "./frames/frame.%04i.ppm", x);
+	return buffer;
+}
+
+// Writes out a finished frame
+void writeFrame(int x, const vector<unsigned char> &pixels, int width, int height)
+{
+	writePPM(frameFilename(x), width, height, pixels.data());
+}
+
+// A built frame waiting to render
+struct FrameInFlight {
+	int frame;
+	time_t startTime;	// When its scene started building
+	RenderContext *context;
+
+	FrameInFlight() : frame(0), startTime(0), context(NULL) {}
+};
+
+//////////////////////////////////////////////////////////////////////////////////
+// Build, render and write out the frames in a pipeline: while frames N and N+1
+// render on the pool (RENDER_STAGE_NUM of them), frame N+2's scene is built and
+// frame N-1 is written out.
+// Building and writing have their own threads, and wait on the queue between
+// them and rendering when they get ahead.
+//////////////////////////////////////////////////////////////////////////////////
+void renderFrames(const vector<RenderContext *> &contexts, int startFrame, int endFrame)
+{
+	// Contexts go round from building to rendering and back again, so the
+	//	number of contexts limits how far building can get ahead
+	BoundedQueue<RenderContext *> freeContexts(contexts.size());
+	for (RenderContext *context : contexts) {
+		freeContexts.push(context);
+	}
+	BoundedQueue<FrameInFlight> builtFrames(contexts.size());
+
+	// Frames go straight into the movie, named after the frames it covers
+	QUICKTIME_MOVIE *movie = NULL;
+	if (WRITE_MOVIE) {
+		char movieFilename[256];
+		sprintf(movieFilename, "./frames/movie.%04i-%04i.mov", startFrame, endFrame);
+		movie = new QUICKTIME_MOVIE(movieFilename);
+	}
+
+	// Frames are rendered into the writer's buffers and written from there
+	//	Every frame rendering holds a buffer, so there's at least one more to write from.
+	FrameWriter *writer = new FrameWriter(WINDOW_WIDTH, WINDOW_HEIGHT, max(OUTPUT_BUFFER_NUM, RENDER_STAGE_NUM + 1),
+		OUTPUT_DIRECT_IO, movie);
+
+	// With pinned workers, each tile's part of the buffers is first written by the
+	//	worker that tile is dealt to, so its pages land on that worker's node
+	if (PIN_RENDER_THREADS) {
+		vector<Tile> tiles = createTiles(WINDOW_WIDTH, WINDOW_HEIGHT, TILE_SIZE);
+		writer->forEachBuffer([&](unsigned char *pixels) {
+			renderPool->run(tiles.size(), [&](int i) {
+				const Tile &tile = tiles[i];
+				for (int row = tile.firstRow; row < tile.lastRow; row++) {
+					memset(pixels + 3 * (WINDOW_WIDTH * row + tile.firstColumn), 0, 3 * (tile.lastColumn - tile.firstColumn));
+				}
+			});
+		});
+	}
+
+	thread builder([&] {
+		for (int x = startFrame; x <= endFrame; x++) {
+			FrameInFlight built;
+			built.frame = x;
+			built.startTime = time(NULL);
+			freeContexts.pop(built.context);
+			prepareFrame(*built.context, x);
+			builtFrames.push(move(built));
+		}
+		builtFrames.close();
+	});
+
+	// Frames render a few at a time, sharing the pool, so its threads have the next
+	//	frame's tiles to go on with through the tail of each frame. They still blend
+	//	into the history and go to the writer in frame order.
+	FrameHistory *history = TEMPORAL_ACCUMULATION ? new FrameHistory(startFrame) : NULL;
+	FrameOrder writeOrder(startFrame);
+
+	// The radiance cache follows one frame at a time, so frames render one at a time with it
+	int stageNum = radianceCache != NULL ? 1 : max(1, min(RENDER_STAGE_NUM, (int) contexts.size() - 1));
+	vector<thread> stages;
+	for (int i = 0; i < stageNum; i++) {
+		stages.push_back(thread([&] {
+			FrameInFlight frame;
+			while (builtFrames.pop(frame)) {
+				unsigned char *pixels = writer->acquire();
+				renderImage(*frame.context, frame.frame, *renderPool, pixels, history);
+				freeContexts.push(frame.context);
+
+				writeOrder.waitForTurn(frame.frame);
+				writer->submit(pixels, WRITE_FRAME_PPMS ? frameFilename(frame.frame) : "");
+				time_t end_time = time(NULL);
+				cout << "Rendered " + to_string(frame.frame) + " frames (" + to_string(end_time - frame.startTime) + "s)\n" << flush;
+				writeOrder.endTurn(frame.frame);
+			}
+		}));
+	}
+
+	for (thread &stage : stages) {
+		stage.join();
+	}
+	builder.join();
+	delete history;
+
+	// The writer hands its last frames to the movie before the movie is finished
+	delete writer;
+	delete movie;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Reads the lightmaps of the first scene's static shapes from the last bake, or
+// bakes them again (and saves them) if there is none, it's of another scene, or
+// rebake is set. The static shapes are those of frame 0 that aren't moving.
+//////////////////////////////////////////////////////////////////////////////////
+void prepareLightmaps(const string &skeletonFilename, bool rebake)
+{
+	RenderContext *context = createRenderContext(skeletonFilename);
+	prepareFrame(*context, 0);
+
+	vector<const Shape *> staticShapes;
+	for (const Shape *shape : context->shapes) {
+		if (find(context->movingShapes.begin(), context->movingShapes.end(), shape) == context->movingShapes.end()) {
+			staticShapes.push_back(shape);
+		}
+	}
+
+	lightmaps = new Lightmaps();
+	uint64_t key = Lightmaps::makeSceneKey(staticShapes, context->lights);
+	if (rebake or not lightmaps->load(LIGHTMAP_FILENAME, key)) {
+		time_t start_time = time(NULL);
+		lightmaps->bake(staticShapes, context->lights, *renderPool);
+		cout << "Baked lightmaps (" + to_string(time(NULL) - start_time) + "s)\n";
+		if (not lightmaps->save(LIGHTMAP_FILENAME)) {
+			cout << "Couldn't write the lightmaps to " << LIGHTMAP_FILENAME << "; they'll be baked again next time" << endl;
+		}
+	}
+	delete context;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Renders one frame with 1, 2, 4, ... threads, up to the number of cores,
+// and reports how the render time scales
+//////////////////////////////////////////////////////////////////////////////////
+void runThreadScalingBenchmark(RenderContext &context, int frame)
+{
+	prepareFrame(context, frame);
+
+	int maxThreads = max(1u, thread::hardware_concurrency());
+	vector<int> threadCounts;
+	for (int threadNum = 1; threadNum < maxThreads; threadNum *= 2) {
+		threadCounts.push_back(threadNum);
+	}
+	threadCounts.push_back(maxThreads);
+
+	double singleThreadSeconds = 0;
+	for (int threadNum : threadCounts) {
+		ThreadPool pool(threadNum);
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		vector<unsigned char> pixels(3 * WINDOW_WIDTH * WINDOW_HEIGHT);
+		if (radianceCache != NULL) {
+			radianceCache->clear();	// Every run starts from nothing, as the first would
+		}
+		renderImage(context, frame, pool, pixels.data());
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		writePPM("./frames/benchmark.ppm", WINDOW_WIDTH, WINDOW_HEIGHT, pixels.data());
+
+		if (threadNum == 1) {
+			singleThreadSeconds = seconds;
+		}
+		double speedup = singleThreadSeconds / seconds;
+		printf("%3d threads: %8.3fs  speedup %6.2fx  efficiency %5.1f%%\n",
+			threadNum, seconds, speedup, 100 * speedup / threadNum);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Skins a character of about vertexTarget vertices through the clip, and
+// reports how long each deform (skinning, triangle boxes and BVH refit) takes
+//////////////////////////////////////////////////////////////////////////////////
+void runSkinningBenchmark(RenderContext &context, int vertexTarget)
+{
+	// Scale the rings and the segments around them alike, from the configured skin's vertex count
+	SkinnedMesh configured(context.displayer, 0.05, plastic, VEC3(1, 0, 0), SKIN_RINGS_PER_BONE, SKIN_SEGMENTS_PER_RING);
+	float scale = sqrt((float) vertexTarget / configured.getVertexCount());
+	int rings = max(1, (int) lround(SKIN_RINGS_PER_BONE * scale));
+	int segments = max(3, (int) lround(SKIN_SEGMENTS_PER_RING * scale));
+	SkinnedMesh mesh(context.displayer, 0.05, plastic, VEC3(1, 0, 0), rings, segments);
+	printf("%d vertices, %d triangles, %d threads\n", mesh.getVertexCount(), mesh.getTriangleCount(),
+		renderPool->getThreadNum());
+
+	int frameNum = 0;
+	double totalSeconds = 0, slowestSeconds = 0;
+	for (int x = 0; x * FRAME_INCREMENT < context.motion->GetNumFrames(); x++) {
+		setSkeletonsToSpecifiedFrame(context, x * FRAME_INCREMENT);
+		context.displayer.ComputeBonePositions(DisplaySkeleton::BONES_AND_LOCAL_FRAMES);
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		mesh.deform(context.displayer, computeStickfigureMovement(x), *renderPool);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		totalSeconds += seconds;
+		slowestSeconds = max(slowestSeconds, seconds);
+		frameNum++;
+	}
+	printf("%d frames: %.3fms per deform on average, %.3fms at most\n", frameNum,
+		1000 * totalSeconds / max(1, frameNum), 1000 * slowestSeconds);
+}
+
 //////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////
 int main(int argc, char** argv)
 {
 
+	// "previz benchmark <frame>" measures thread scaling instead of rendering the clip
+	bool benchmark = argc > 1 and string(argv[1]) == "benchmark";
+
+	// "previz skinning [vertices]" times deforming a character of that many vertices (100000 by default)
+	bool skinning = argc > 1 and string(argv[1]) == "skinning";
+
+	// "previz bake" bakes the lightmaps again, even if the saved ones are up to date
+	bool bake = argc > 1 and string(argv[1]) == "bake";
+
+	// "previz farm <start> <end> [local workers] [port]" hands the frames out to
+	//	worker processes, and "previz worker <host> <port> [threads]" is one of them.
+	//	"previz farmtiles <frame> [local workers] [port]" spreads one frame's tiles over them.
+	bool farm = argc > 1 and string(argv[1]) == "farm";
+	bool farmTiles = argc > 2 and string(argv[1]) == "farmtiles";
+	bool worker = argc > 3 and string(argv[1]) == "worker";
+
+	// "previz serve [socket]" keeps everything loaded and renders jobs sent with
+	//	"previz job <socket> <start> <end> [preview|final] [eye x y z] [lookat x y z] [scale n] [samples n]"
+	bool serve = argc > 1 and string(argv[1]) == "serve";
+	if (argc > 4 and string(argv[1]) == "job") {
+		string line = "render";
+		for (int i = 3; i < argc; i++) {
+			line += string(" ") + argv[i];
+		}
+		return submitRenderJob(argv[2], line) ? 0 : 1;
+	}
+
+	// "previz pack <mesh.obj> <file>" packs a mesh for OUT_OF_CORE_MESH_FILENAME
+	if (argc > 3 and string(argv[1]) == "pack") {
+		return PagedMesh::pack(argv[2], argv[3], OUT_OF_CORE_TRIANGLES_PER_PAGE) ? 0 : 1;
+	}
+
 	// Set frames between which to render, inclusive
 	int startFrame = 0;
 	int endFrame = 299;
-	if (argc > 1) {
-		startFrame = atoi(argv[1]);
+	int argument = farm ? 2 : 1;
+	if (argc > argument and not benchmark and not skinning and not worker and not farmTiles and not serve and not bake) {
+		startFrame = atoi(argv[argument]);
 		cout << "startFrame: " << startFrame << endl;
 	}
-	if (argc > 2) {
-		endFrame = atoi(argv[2]);
+	if (argc > argument + 1 and not skinning and not worker and not farmTiles and not serve and not bake) {
+		endFrame = atoi(argv[argument + 1]);
 	}
 
-	// Initialise the random generator
-	srand(time(NULL));
+	// The coordinator only hands out work and finishes and writes out frames, so needs no scene of its own
+	if (farm or farmTiles) {
+		int localWorkerArgument = farm ? 4 : 3;
+		int localWorkerNum = argc > localWorkerArgument ? atoi(argv[localWorkerArgument]) : 1;
+		int port = argc > localWorkerArgument + 1 ? atoi(argv[localWorkerArgument + 1]) : 0;
+
+		// Local workers share this machine's cores between them
+		int cores = max(1u, thread::hardware_concurrency());
+		int threadsPerWorker = max(1, cores / max(1, localWorkerNum));
+
+		if (farm) {
+			bool finished = runFarmCoordinator(startFrame, endFrame, localWorkerNum, threadsPerWorker, port, argv[0], writeFrame);
+			return finished ? 0 : 1;
+		}
+
+		int frame = atoi(argv[2]);
+		vector<unsigned char> pixels;
+		time_t start_time = time(NULL);
+		if (not runTileFarmCoordinator(frame, WINDOW_WIDTH, WINDOW_HEIGHT, TILE_SIZE, farmPixelBytes(), localWorkerNum,
+			threadsPerWorker, port, argv[0], pixels))
+		{
+			return 1;
+		}
+
+		// The denoiser needs the whole frame, so runs here once the workers are done with it
+		if (DENOISE) {
+			ThreadPool pool(cores);
+			vector<unsigned char> tilePixels;
+			tilePixels.swap(pixels);
+			denoiseFarmFrame(tilePixels, WINDOW_WIDTH, WINDOW_HEIGHT, pool, pixels);
+		}
+		writeFrame(frame, pixels, WINDOW_WIDTH, WINDOW_HEIGHT);
+		cout << "Rendered frame " + to_string(frame) + " (" + to_string(time(NULL) - start_time) + "s)\n";
+		return 0;
+	}
 
 	string skeletonFilename("01.asf");
 	string motionFilename("126_11.amc");
@@ -474,38 +1185,165 @@ int main(int argc, char** argv)
 	// load up skeleton stuff
 	skeleton = new Skeleton(skeletonFilename.c_str(), MOCAP_SCALE);
 	skeleton->setBasePosture();
-	displayer.LoadSkeleton(skeleton);
 
-	// load up the motion
+	// load up the motion, which all render contexts share
 	motion = new Motion(motionFilename.c_str(), MOCAP_SCALE, skeleton);
-	displayer.LoadMotion(motion);
-	skeleton->setPosture(*(displayer.GetSkeletonMotion(0)->GetPosture(0)));
 
 	// Setup the stars
 	//initialiseStars();
 
-	// Note we're going 4 frames at a time, otherwise the animation
-	// is really slow.
-	int FRAME_INCREMENT = 8;
-	for (int x = startFrame; x <= endFrame; x++)
-	{
-		time_t start_time = time(NULL);
+	renderPool = new ThreadPool(worker and argc > 4 ? atoi(argv[4]) : RENDER_THREAD_NUM, PIN_RENDER_THREADS);
+	if (RADIANCE_CACHE) {
+		radianceCache = new RadianceCache(RADIANCE_CACHE_ENTRIES, RADIANCE_CACHE_CELL_SIZE, RADIANCE_CACHE_SAMPLES);
+	}
+
+	// The out-of-core mesh is in every scene, and shadows the static shapes, so comes before the lightmaps
+	if (OUT_OF_CORE_MESH_FILENAME[0] != '\0') {
+		pagedMesh = new PagedMesh(plastic, VEC3(0.6, 0.6, 0.6), (size_t) OUT_OF_CORE_RESIDENT_MB << 20);
+		if (not pagedMesh->load(OUT_OF_CORE_MESH_FILENAME)) {
+			cout << "Couldn't load the out-of-core mesh from " << OUT_OF_CORE_MESH_FILENAME
+				<< "; pack one with \"previz pack <mesh.obj> " << OUT_OF_CORE_MESH_FILENAME << "\"" << endl;
+			exit(1);
+		}
+	}
+
+	// Pinned workers read their own node's copy of the textures
+	if (PIN_RENDER_THREADS) {
+		const Texture *textures[] = { &brushedMetal, &marbleCheckerboard, &blueWood, &swimmingFloor,
+			&swimmingWall, &swimmingMarble, &emptyFrame };
+		for (const Texture *texture : textures) {
+			texture->replicatePerNode();
+		}
+	}
 
-		setSkeletonsToSpecifiedFrame(x * FRAME_INCREMENT);
-		buildScene(x);
-		//cout << "finished building scene" << endl;
-		setCamera(x);
+	// Skinning needs no lightmaps, so is timed before they are baked
+	if (skinning) {
+		RenderContext *context = createRenderContext(skeletonFilename);
+		runSkinningBenchmark(*context, argc > 2 ? atoi(argv[2]) : 100000);
+		delete context;
+		delete renderPool;
+		delete radianceCache;
+		delete pagedMesh;
+		return 0;
+	}
+
+	// Every way of rendering below shades the static shapes from the same lightmaps
+	if (LIGHTMAPS or bake) {
+		prepareLightmaps(skeletonFilename, bake);
+	}
+	if (bake) {
+		delete lightmaps;
+		delete pagedMesh;
+		delete radianceCache;
+		delete renderPool;
+		return 0;
+	}
 
-		char buffer[256];
-		sprintf(buffer, "./frames/frame.%04i.ppm", x);
-		//renderImage(windowWidth, windowHeight, buffer);
-		renderImage(buffer);
+	// Workers render one frame at a time, using every thread they were given for it
+	if (worker) {
+		RenderContext *context = createRenderContext(skeletonFilename);
+		int preparedFrame = -1;	// Tiles of one frame come in several chunks; build its scene once
+		uint64_t token = argc > 5 ? strtoull(argv[5], NULL, 10) : 0;	// Given to the local workers the coordinator starts
+		bool connected = runFarmWorker(argv[2], atoi(argv[3]), token,
+			[context, &preparedFrame](int x, vector<unsigned char> &pixels, int &width, int &height) {
+				prepareFrame(*context, x);
+				preparedFrame = x;
+				width = WINDOW_WIDTH;
+				height = WINDOW_HEIGHT;
+				pixels.resize(3 * width * height);
+				renderImage(*context, x, *renderPool, pixels.data());
+			},
+			[context, &preparedFrame](int x, const vector<Tile> &tiles, vector<vector<unsigned char> > &pixels, vector<double> &seconds) {
+				if (x != preparedFrame) {
+					prepareFrame(*context, x);
+					preparedFrame = x;
+				}
+				renderImageTiles(*context, x, *renderPool, tiles, pixels, seconds);
+			});
+		delete context;
+		delete renderPool;
+		delete radianceCache;
+		delete lightmaps;
+		delete pagedMesh;
+		return connected ? 0 : 1;
+	}
 
-		time_t end_time = time(NULL);
+	// The server renders every job with one context, one frame at a time
+	if (serve) {
+		RenderContext *context = createRenderContext(skeletonFilename);
+		string lastJobName;
+		bool served = runRenderServer(argc > 2 ? argv[2] : "./previz.sock",
+			[context, &lastJobName](const RenderJob &job, int x) -> string {
+				// Jobs take turns a frame at a time; one job's cached shadows (e.g. a
+				//	preview's) mustn't end up in another's frames
+				if (radianceCache != NULL and job.name != lastJobName) {
+					radianceCache->clear();
+				}
+				lastJobName = job.name;
+
+				int scale = job.scale > 0 ? job.scale : (job.preview ? PREVIEW_RESOLUTION_DIVISOR : 1);
+				context->width = max(1, WINDOW_WIDTH / scale);
+				context->height = max(1, WINDOW_HEIGHT / scale);
+				context->samplingRoot = job.samplingRoot > 0 ? job.samplingRoot :
+					(job.preview ? PREVIEW_SAMPLING_ROOT : STRATIFIED_SAMPLING_ROOT);
+
+				prepareFrame(*context, x);
+				if (job.hasEye) {
+					context->eye = job.eye;
+				}
+				if (job.hasLookingAt) {
+					context->lookingAt = job.lookingAt;
+				}
+
+				vector<unsigned char> pixels(3 * context->width * context->height);
+				renderImage(*context, x, *renderPool, pixels.data());
+
+				char filename[512];
+				sprintf(filename, "./frames/%s.%04i.ppm", job.name.c_str(), x);
+				writePPM(filename, context->width, context->height, pixels.data());
+				return string(filename);
+			});
+		delete context;
+		delete renderPool;
+		delete radianceCache;
+		delete lightmaps;
+		delete pagedMesh;
+		return served ? 0 : 1;
+	}
 
-		cout << "Rendered " + to_string(x) + " frames (" << end_time - start_time << "s)" << endl;
+	if (benchmark) {
+		RenderContext *context = createRenderContext(skeletonFilename);
+		runThreadScalingBenchmark(*context, argc > 2 ? atoi(argv[2]) : 0);
+		delete context;
+		delete renderPool;
+		delete radianceCache;
+		delete lightmaps;
+		delete pagedMesh;
+		return 0;
 	}
 
+	// Keep FRAMES_IN_FLIGHT frames in the pipeline, each with its own context,
+	//	so the next frame's scene can be built while the frames before render
+	vector<RenderContext *> contexts;
+	for (int i = 0; i < max(FRAMES_IN_FLIGHT, RENDER_STAGE_NUM + 1); i++) {
+		contexts.push_back(createRenderContext(skeletonFilename));
+	}
+
+	// Note we're going 8 frames at a time (FRAME_INCREMENT), otherwise the
+	// animation is really slow.
+	renderFrames(contexts, startFrame, endFrame);
+	if (pagedMesh != NULL) {
+		cout << "Out-of-core mesh: " << pagedMesh->getLoadNum() << " pages read in and "
+			<< pagedMesh->getEvictionNum() << " given back, of " << pagedMesh->getPageNum() << endl;
+	}
+
+	for (RenderContext *context : contexts) {
+		delete context;
+	}
+	delete renderPool;
+	delete radianceCache;
+	delete lightmaps;
+	delete pagedMesh;
 	return 0;
 }
 
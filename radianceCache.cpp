@@ -0,0 +1,220 @@
+#include "radianceCache.h"
+#include "rng.h"
+
+#include <cmath>
+#include <cstring>
+
+// Cells are numbered from -CELL_RANGE to CELL_RANGE - 1 along each axis, in 15 bits
+static const int CELL_RANGE = 1 << 14;
+
+// The light index is stored plus one, in 12 bits, so no key is 0
+static const int MAX_LIGHTS = (1 << 12) - 1;
+
+// Entries tried after the one a key hashes to, before giving up on it
+static const int MAX_PROBES = 16;
+
+// Pieces the space between a cell and a light is split into, to check it for moving shapes
+static const int SHADOW_PIECES = 8;
+
+// The sample count and sum of an entry, packed together so they can be updated at once
+static uint64_t packSamples(uint32_t count, float sum) {
+	uint32_t sumBits;
+	memcpy(&sumBits, &sum, sizeof(sum));
+	return ((uint64_t) count << 32) | sumBits;
+}
+
+static void unpackSamples(uint64_t samples, uint32_t &count, float &sum) {
+	count = samples >> 32;
+	uint32_t sumBits = samples;
+	memcpy(&sum, &sumBits, sizeof(sum));
+}
+
+static bool overlaps(const AABB &a, const AABB &b) {
+	for (int i = 0; i < 3; i++) {
+		if (a.lo[i] > b.hi[i] or b.lo[i] > a.hi[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+RadianceCache::RadianceCache(int entryNum, float cellSize, int sampleNum)
+	: cellSize(cellSize), sampleNum(sampleNum), frame(-1), lightsKey(0)
+{
+	int size = 1;
+	while (size < entryNum) {
+		size *= 2;
+	}
+	entries = vector<Entry>(size);
+	mask = size - 1;
+	clear();
+}
+
+void RadianceCache::clear() {
+	for (Entry &entry : entries) {
+		entry.key.store(0, memory_order_relaxed);
+		entry.samples.store(0, memory_order_relaxed);
+	}
+	frame = -1;
+}
+
+// Bits 0-44 are the cell, 15 for each axis; 45-51 the normal, each component
+//	rounded to a multiple of 1/2; and 52-63 the light
+bool RadianceCache::makeKey(VEC3 point, VEC3 normal, int lightIndex, uint64_t &key) const {
+	if (lightIndex < 0 or lightIndex >= MAX_LIGHTS) {
+		return false;
+	}
+
+	key = 0;
+	for (int i = 0; i < 3; i++) {
+		float cell = floor(point[i] / cellSize);
+		if (not (fabs(cell) < CELL_RANGE)) {
+			return false;
+		}
+		key |= (uint64_t) ((int) cell + CELL_RANGE) << (15 * i);
+	}
+
+	int direction = 0;
+	for (int i = 0; i < 3; i++) {
+		direction = 5 * direction + (int) lround(2 * normal[i]) + 2;
+	}
+	key |= (uint64_t) direction << 45;
+	key |= (uint64_t) (lightIndex + 1) << 52;
+	return true;
+}
+
+void RadianceCache::unpackKey(uint64_t key, VEC3 &centre, int &lightIndex) const {
+	for (int i = 0; i < 3; i++) {
+		int cell = (int) ((key >> (15 * i)) & (2 * CELL_RANGE - 1)) - CELL_RANGE;
+		centre[i] = (cell + 0.5f) * cellSize;
+	}
+	lightIndex = (int) (key >> 52) - 1;
+}
+
+// Linear probing; entries keep their key until the whole cache is cleared, so an
+//	unused entry always ends the search
+RadianceCache::Entry *RadianceCache::findEntry(uint64_t key, bool add) {
+	uint64_t slot = mixBits(key);
+	for (int probe = 0; probe < MAX_PROBES; probe++) {
+		Entry &entry = entries[(slot + probe) & mask];
+		uint64_t found = entry.key.load(memory_order_acquire);
+		if (found == key) {
+			return &entry;
+		}
+		if (found != 0) {
+			continue;
+		}
+		if (not add) {
+			return NULL;
+		}
+
+		// Claim it, unless another thread just did (maybe for the same key)
+		if (entry.key.compare_exchange_strong(found, key) or found == key) {
+			return &entry;
+		}
+	}
+	return NULL;
+}
+
+// The space between the cell and the light lies within the boxes that grow evenly
+//	from the cell's to the light's. Each piece of that is checked by the box around
+//	the boxes at its ends.
+bool RadianceCache::mayBlock(const AABB &bounds, VEC3 centre, const Light &light) const {
+	AABB lightBox = lightBounds(light);
+	AABB cellBox(centre - VEC3::Constant(cellSize / 2), centre + VEC3::Constant(cellSize / 2));
+
+	for (int i = 0; i < SHADOW_PIECES; i++) {
+		AABB piece;
+		for (int end = i; end <= i + 1; end++) {
+			float t = end / (float) SHADOW_PIECES;
+			piece.expand(cellBox.lo + t * (lightBox.lo - cellBox.lo));
+			piece.expand(cellBox.hi + t * (lightBox.hi - cellBox.hi));
+		}
+		if (overlaps(piece, bounds)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void RadianceCache::startFrame(int frame, const AABB &movingBounds, const vector<Light> &lights) {
+	uint64_t key = hashKey(0, lights.size());
+	for (const Light &light : lights) {
+		for (int i = 0; i < 3; i++) {
+			key = hashKey(hashKey(key, lround(light.pos[i] * 1024)), lround(light.colour[i] * 1024));
+		}
+	}
+
+	// More tiles of the same frame
+	if (frame == this->frame and key == lightsKey) {
+		return;
+	}
+
+	if (frame != this->frame + 1 or key != lightsKey) {
+		clear();
+	} else {
+		// Empty what the moving shapes could have changed, where they were and where they are now
+		AABB changed = this->movingBounds;
+		changed.expand(movingBounds);
+		for (Entry &entry : entries) {
+			uint64_t entryKey = entry.key.load(memory_order_relaxed);
+			if (entryKey == 0) {
+				continue;
+			}
+			VEC3 centre;
+			int lightIndex;
+			unpackKey(entryKey, centre, lightIndex);
+			if (lightIndex >= (int) lights.size() or mayBlock(changed, centre, lights[lightIndex])) {
+				entry.samples.store(0, memory_order_relaxed);
+			}
+		}
+	}
+
+	this->frame = frame;
+	this->movingBounds = movingBounds;
+	lightsKey = key;
+}
+
+bool RadianceCache::lookup(VEC3 point, VEC3 normal, int lightIndex, float &visibility) {
+	uint64_t key;
+	if (not makeKey(point, normal, lightIndex, key)) {
+		return false;
+	}
+	Entry *entry = findEntry(key, false);
+	if (entry == NULL) {
+		return false;
+	}
+
+	uint32_t count;
+	float sum;
+	unpackSamples(entry->samples.load(memory_order_relaxed), count, sum);
+	if ((int) count < sampleNum) {
+		return false;
+	}
+	visibility = sum / count;
+	return true;
+}
+
+void RadianceCache::add(VEC3 point, VEC3 normal, int lightIndex, float visibility) {
+	uint64_t key;
+	if (not makeKey(point, normal, lightIndex, key)) {
+		return;
+	}
+	Entry *entry = findEntry(key, true);
+	if (entry == NULL) {
+		return;	// Too full around here; the point is just shaded without the cache
+	}
+
+	uint64_t samples = entry->samples.load(memory_order_relaxed);
+	while (true) {
+		uint32_t count;
+		float sum;
+		unpackSamples(samples, count, sum);
+		if ((int) count >= sampleNum) {
+			return;
+		}
+		if (entry->samples.compare_exchange_weak(samples, packSamples(count + 1, sum + visibility))) {
+			return;
+		}
+	}
+}
@@ -0,0 +1,86 @@
+// A cache of the light reaching points in the scene, for the hits of glossy reflections
+//	Each glossy ray lands somewhere on the floor or walls and shades the point there,
+//	sampling every light's soft shadow with shadow rays of its own, and the rays of
+//	neighbouring pixels land close together and ask nearly the same question. The
+//	cache divides space into a grid of cells, and keeps, for each cell, direction
+//	the surface faces in it and light, the average visible share of the light
+//	found by the hits there. Once a cell has enough samples, later hits take the
+//	average instead of tracing shadow rays.
+//
+//	What is cached is how much of each light gets through, rather than the shaded
+//	colour: it doesn't depend on where the eye is or on the surface's texture, so
+//	reflections keep their texture, and the cache stays right as the camera moves.
+//	The lights and most of the scene never move, so the cache is kept from frame to
+//	frame; only cells whose view of a light the moving shapes (the skeleton) could
+//	have blocked or uncovered since the last frame are emptied.
+//
+//	The cells live in one open-addressed hash table, filled in by whichever render
+//	thread gets there first, with atomics rather than locks. So unlike the rest of
+//	the renderer, the image isn't reproducible with the cache on: it depends on
+//	the order the threads got to the cells, and on which frames came before.
+
+#ifndef _RADIANCE_CACHE_H
+#define _RADIANCE_CACHE_H
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include "SETTINGS.h"
+#include "light.h"
+#include "bvh.h"
+
+using namespace std;
+
+class RadianceCache {
+	// One cell's samples for one light
+	struct Entry {
+		atomic<uint64_t> key;	// Cell, surface direction and light, packed (see makeKey), 0 if unused
+		atomic<uint64_t> samples;	// Number of samples in the high 32 bits, the bits of their float sum in the low 32
+	};
+
+	vector<Entry> entries;	// A power of 2 of them
+	uint64_t mask;	// entries.size() - 1
+	float cellSize;
+	int sampleNum;	// Samples a cell needs before it's used
+	int frame;	// Frame the cache was last made ready for, or -1
+	AABB movingBounds;	// Bounds of the moving shapes in that frame
+	uint64_t lightsKey;	// Hash of the lights in that frame, which change with the scene
+
+	// Packs the cell around the point, the direction of the normal and the light into a key,
+	//	or returns false if they don't fit
+	bool makeKey(VEC3 point, VEC3 normal, int lightIndex, uint64_t &key) const;
+
+	// The centre of a key's cell, and its light
+	void unpackKey(uint64_t key, VEC3 &centre, int &lightIndex) const;
+
+	// The entry for the key, or NULL if it isn't in the table (or, when adding, the table is too full for it)
+	Entry *findEntry(uint64_t key, bool add);
+
+	// Whether the moving shapes within bounds could come between the cell and the light
+	bool mayBlock(const AABB &bounds, VEC3 centre, const Light &light) const;
+
+	// Holds atomics, so can't be copied
+	RadianceCache(const RadianceCache &);
+	RadianceCache &operator=(const RadianceCache &);
+
+public:
+	// entryNum is rounded up to a power of 2
+	RadianceCache(int entryNum, float cellSize, int sampleNum);
+
+	// Empties the whole cache
+	void clear();
+
+	// Gets the cache ready to render a frame, in which the moving shapes are within
+	//	movingBounds. Following on from the last frame, only what they could have
+	//	changed is emptied; otherwise (or if the lights changed) everything is.
+	void startFrame(int frame, const AABB &movingBounds, const vector<Light> &lights);
+
+	// Sets the average visible share of the light at points like this one, and
+	//	returns true, if enough samples have been added to trust it
+	bool lookup(VEC3 point, VEC3 normal, int lightIndex, float &visibility);
+
+	// Adds a sample of the visible share of the light at this point
+	void add(VEC3 point, VEC3 normal, int lightIndex, float visibility);
+};
+
+#endif
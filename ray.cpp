@@ -1,7 +1,7 @@
 #include "ray.h"
 
-Ray::Ray(VEC3 o, VEC3 d, int recurse_depth) 
-	: o(o), d(d), recurse_depth(recurse_depth)
+Ray::Ray(VEC3 o, VEC3 d, int recurse_depth, const SamplePath &path, float throughput) 
+	: o(o), d(d), recurse_depth(recurse_depth), path(path), throughput(throughput)
 {
 	d.normalize();						// IS THIS NEEDED? REMOVE OTHER NORMALIZATIONS?
 }
@@ -4,15 +4,19 @@
 #define _RAY_H
 
 #include <vector>
+#include <cstdint>
 #include "SETTINGS.h"
+#include "sampler.h"
 
 // Represents a ray shooting out into space
 class Ray {                                                              // IS THIS INEFFICIENT?
 public:
 	VEC3 o, d;  // Store origin and direction
-	int recurse_depth;
+	int recurse_depth;	// Number of glossy bounces the ray's path may still take
+	SamplePath path;	// The sample this ray belongs to, for its random numbers (see sampler.h)
+	float throughput;	// Share of the ray's colour that reaches the pixel, for Russian roulette
 
-	Ray(VEC3 o, VEC3 d, int recurse_depth = 10);						// ADD METHOD FOR GENERATING RAY WITHOUT SHADOW ACNE
+	Ray(VEC3 o, VEC3 d, int recurse_depth = 10, const SamplePath &path = SamplePath(), float throughput = 1);						// ADD METHOD FOR GENERATING RAY WITHOUT SHADOW ACNE
 };
 
 #endif
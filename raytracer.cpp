@@ -1,6 +1,11 @@
 #include "raytracer.h"
+#include "rng.h"
 
-extern const int STRATIFIED_SAMPLING_ROOT;
+extern const bool ADAPTIVE_SAMPLING;
+extern const int ADAPTIVE_MAX_SAMPLES;
+extern const float ADAPTIVE_ERROR_TARGET;
+extern const int SAMPLE_SEQUENCE;
+extern const int GLOSSY_MAX_DEPTH;
 
 Camera::Camera(float xRes, float yRes, VEC3 eye, VEC3 lookingAt, VEC3 up, float nearPlane, float fovy) 
 	: xRes(xRes), yRes(yRes), eye(eye), lookingAt(lookingAt),
@@ -46,25 +51,71 @@ void RayTracer::initialise_camera_frame() {
 	std::tie(u, v, w) = basis;
 }
 
-RayTracer::RayTracer(Camera &camera, Shader &shader, PhysicsWorld &world) 
-	: camera(camera), shader(shader), world(world)
+CameraProjection::CameraProjection(const Camera &camera)
+	: eye(camera.eye), nearPlane(camera.nearPlane), width(camera.xRes), height(camera.yRes)
+{
+	VEC3 gaze = (camera.lookingAt - camera.eye).normalized();
+	std::tie(u, v, w) = create_basis_vectors(gaze, camera.up);
+	top = tan(camera.fovy * M_PI / 360) * camera.nearPlane;
+	right = top * (camera.xRes / camera.yRes);
+}
+
+// As in generateAtCoord, where the rays aim at a point s on the viewing plane
+VEC3 CameraProjection::direction(float column, float row) const {
+	float x2 = -right + 2 * right * (column + 0.5) / width;
+	float y2 = -top + 2 * top * (height - row - 0.5) / height;
+	VEC3 s = (x2 * (-u)) + (y2 * v) - (nearPlane * w);
+	return (s - eye).normalized();
+}
+
+// Follows the ray from the eye through the point back to the viewing plane
+bool CameraProjection::project(VEC3 point, float &column, float &row) const {
+	VEC3 toPoint = point - eye;
+	float along = w.dot(toPoint);
+	float distance = -nearPlane - w.dot(eye);
+	if (along >= 0 or distance >= 0) {
+		return false;	// The plane is in front of the eye, along -w
+	}
+	VEC3 s = eye + (distance / along) * toPoint;
+
+	float x2 = (-u).dot(s);
+	float y2 = v.dot(s);
+	column = (x2 + right) / (2 * right) * width - 0.5;
+	row = height - 0.5 - (y2 + top) / (2 * top) * height;
+	return true;
+}
+
+RayTracer::RayTracer(Camera &camera, Shader &shader, PhysicsWorld &world, int frame, int samplingRoot) 
+	: camera(camera), shader(shader), world(world), frame(frame), samplingRoot(samplingRoot)
 {
 	initialise_viewing_plane_dimensions();
 	initialise_camera_frame();
-	stratifiedBinNum = pow(STRATIFIED_SAMPLING_ROOT, 2);
-	binWidth = 1 / (float) STRATIFIED_SAMPLING_ROOT;
-	binHeight = 1 / (float) STRATIFIED_SAMPLING_ROOT;
+	stratifiedBinNum = pow(samplingRoot, 2);
+	binWidth = 1 / (float) samplingRoot;
+	binHeight = 1 / (float) samplingRoot;
 }
 
 // Generate the ray that goes through this pixel, using perspective projection
 //  Coord (0, 0) is in the center
-//	binNum is the number of the bin used for stratified sampling
+//	binNum is the number of the sample; sample i lands in bin i % stratifiedBinNum
 Ray RayTracer::generateAtCoord(float x, float y, int binNum) const {
+	// Every sample of every pixel gets its own random numbers
+	int pixelX = x - camera.screenLeft;
+	int pixelY = y - camera.screenBot;
+	SamplePath path(frame, pixelX, pixelY, pixelY * camera.xRes + pixelX, binNum);
+
 	// Distributed ray tracing: jitter the pixel inside its bin
-	float randX = (float) rand() / (float) RAND_MAX;						// REMOVE RANDOMNESS WHEN THERE'S JUST 1 BIN
-	float randY = (float) rand() / (float) RAND_MAX;
-	x += -0.5 + binWidth * (randX + (float) (binNum % STRATIFIED_SAMPLING_ROOT));
-	y += -0.5 + binHeight * (randY + (float) (binNum / STRATIFIED_SAMPLING_ROOT));
+	//	The low-discrepancy sequences spread their points over the pixel by themselves.
+	float randX, randY;
+	sample2D(path, CAMERA_DIMENSION, CAMERA_STREAM, 0, 0, 1, randX, randY);
+	if (SAMPLE_SEQUENCE == RANDOM_SEQUENCE) {
+		int bin = binNum % stratifiedBinNum;
+		x += -0.5 + binWidth * (randX + (float) (bin % samplingRoot));
+		y += -0.5 + binHeight * (randY + (float) (bin / samplingRoot));
+	} else {
+		x += -0.5 + randX;
+		y += -0.5 + randY;
+	}
 
 	// Translate camera corner to origin (e.g. range [0, 480])
 	x -= camera.screenLeft;                                                // MAKE THE ITERATION MORE EFFICIENT
@@ -76,7 +127,7 @@ Ray RayTracer::generateAtCoord(float x, float y, int binNum) const {
 	
 	// Calculate lookAt point for this ray
 	VEC3 s = (x2 * (-u)) + (y2 * v) - (camera.nearPlane * w);
-	return Ray(camera.eye, (s - camera.eye).normalized());
+	return Ray(camera.eye, (s - camera.eye).normalized(), GLOSSY_MAX_DEPTH, path);
 };
 
 // Calculates the colour of this ray based on the world
@@ -84,17 +135,22 @@ VEC3 RayTracer::calculateColour(const Ray &ray) const {
 	// Get intersection of ray with world
 	const Shape* intersectShape = NULL;
 	VEC3 intersectPoint;
-	world.existsClosestIntersection(ray, intersectShape, intersectPoint);
+	int intersectPart = -1;
+	world.existsClosestIntersection(ray, intersectShape, intersectPoint, intersectPart);
 
 	// Calculate shading at intersection point
 	//cout << "calculating shading" << endl;
-	VEC3 shaded = shader.calculateShading(intersectPoint, intersectShape, ray);
+	VEC3 shaded = shader.calculateShading(intersectPoint, intersectShape, intersectPart, ray);
 	return shaded;
 }
 
 // Calculates the colour for this pixel by averaging it
 //	over all stratified sampling bins
 VEC3 RayTracer::calculateAveragedPixelcolour(int x, int y) const {
+	if (ADAPTIVE_SAMPLING) {
+		return calculateAdaptivePixelcolour(x, y);
+	}
+
 	VEC3 colour(0, 0, 0);
 
 	// Sum colours for ray going through each sampling bin
@@ -105,3 +161,77 @@ VEC3 RayTracer::calculateAveragedPixelcolour(int x, int y) const {
 
 	return colour / (float) stratifiedBinNum;
 }
+
+float displayedLuminance(const VEC3 &colour) {
+	VEC3 clamped = colour.cwiseMax(0.0).cwiseMin(1.0);
+	return 0.2126 * clamped[0] + 0.7152 * clamped[1] + 0.0722 * clamped[2];
+}
+
+// Samples the pixel in rounds of one ray per stratified bin, until the
+//	standard error of its mean luminance is within ADAPTIVE_ERROR_TARGET or
+//	it has had ADAPTIVE_MAX_SAMPLES rays
+VEC3 RayTracer::calculateAdaptivePixelcolour(int x, int y) const {
+	VEC3 colour(0, 0, 0);
+	float luminanceSum = 0;
+	float luminanceSquaredSum = 0;
+
+	int sampleNum = 0;
+	while (true) {
+		for (int bin = 0; bin < stratifiedBinNum; bin++, sampleNum++) {
+			VEC3 sample = calculateColour(generateAtCoord(x, y, sampleNum));
+			float luminance = displayedLuminance(sample);
+			colour += sample;
+			luminanceSum += luminance;
+			luminanceSquaredSum += luminance * luminance;
+		}
+		if (sampleNum + stratifiedBinNum > ADAPTIVE_MAX_SAMPLES) {
+			break;
+		}
+		if (sampleNum < 2) {
+			continue;	// One sample says nothing about the variance
+		}
+
+		// Sample variance, and from it the variance of the mean
+		float mean = luminanceSum / sampleNum;
+		float variance = max(0.0f, (luminanceSquaredSum - sampleNum * mean * mean) / (sampleNum - 1));
+		if (variance / sampleNum <= ADAPTIVE_ERROR_TARGET * ADAPTIVE_ERROR_TARGET) {
+			break;
+		}
+	}
+
+	return colour / (float) sampleNum;
+}
+
+VEC3 RayTracer::calculateSampleColour(int x, int y, int sample) const {
+	return calculateColour(generateAtCoord(x, y, sample));
+}
+
+// Only intersects the camera rays, so costs little next to shading them
+void RayTracer::calculatePixelFeatures(int x, int y, VEC3 &albedo, VEC3 &normal, float &depth) const {
+	albedo = VEC3(0, 0, 0);
+	normal = VEC3(0, 0, 0);
+	depth = 0;
+
+	int hitNum = 0;
+	for (int i = 0; i < stratifiedBinNum; i++) {
+		Ray ray = generateAtCoord(x, y, i);
+		const Shape* intersectShape = NULL;
+		VEC3 intersectPoint;
+		int intersectPart;
+		if (not world.existsClosestIntersection(ray, intersectShape, intersectPoint, intersectPart)) {
+			continue;
+		}
+		albedo += intersectShape->getColourAt(intersectPoint);
+		normal += intersectShape->getPartNormalAt(intersectPoint, ray, intersectPart);
+		depth += (intersectPoint - ray.o).norm();
+		hitNum++;
+	}
+
+	if (hitNum > 0) {
+		albedo /= (float) hitNum;
+		if (normal.norm() > 0) {
+			normal.normalize();
+		}
+		depth /= hitNum;
+	}
+}
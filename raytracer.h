@@ -31,6 +31,26 @@ public:
 	Camera(float xRes, float yRes, VEC3 eye, VEC3 lookingAt, VEC3 up, float nearPlane, float fovy);
 };
 
+// Maps points in the world to where the camera sees them in its image, and back,
+//	along the same rays as the RayTracer's (a pixel's rays all pass through its centre
+//	on average). Columns and rows count from the top left pixel, whose centre is (0, 0).
+class CameraProjection {
+	VEC3 eye;
+	VEC3 u, v, w;	// The camera frame, as in the RayTracer
+	float nearPlane;
+	float width, height;	// Image size in pixels
+	float right, top;	// Half the size of the viewing plane
+
+public:
+	CameraProjection(const Camera &camera);
+
+	// Direction of the ray from the eye through this point of the image
+	VEC3 direction(float column, float row) const;
+
+	// Sets where in the image the point appears, or returns false if it's behind the camera
+	bool project(VEC3 point, float &column, float &row) const;
+};
+
 /*
 class Shader {
 public:
@@ -49,6 +69,8 @@ class RayTracer {
 	Camera &camera;  // Camera object viewing the world
 	Shader &shader;
 	PhysicsWorld &world;	// Object that computes intersections of rays and shapes
+	int frame;	// Frame being rendered, part of every sample's random key
+	int samplingRoot;	// Square root of stratifiedBinNum
 	int stratifiedBinNum;	// Number of bins for distributed ray generation using "stratified" sampling
 	float binWidth, binHeight;	// Size of each bin used for "stratified" sampling (1 is the width of a pixel)
 
@@ -63,7 +85,8 @@ class RayTracer {
 	Ray generateAtCoord(float x, float y, int binNum) const;
 
 public:
-	RayTracer(Camera &camera, Shader &shader, PhysicsWorld &world);
+	// samplingRoot^2 rays are traced through each pixel (see STRATIFIED_SAMPLING_ROOT)
+	RayTracer(Camera &camera, Shader &shader, PhysicsWorld &world, int frame, int samplingRoot);
 
 	// Calculates the colour of the ray
 	// Determines where the ray interesects the scene and computes
@@ -73,6 +96,23 @@ public:
 	// Calculates the colour of this pixel by generating multipl
 	//	distributed rays and averaging the colours
 	VEC3 calculateAveragedPixelcolour(int x, int y) const;
+
+	// Like calculateAveragedPixelcolour, but keeps adding rays to noisy pixels
+	//	(see ADAPTIVE_SAMPLING)
+	VEC3 calculateAdaptivePixelcolour(int x, int y) const;
+
+	// Calculates the colour of a single ray through this pixel, for renderers that
+	//	add up the samples themselves. Sample i lands in stratified bin i % samplingRoot^2.
+	VEC3 calculateSampleColour(int x, int y, int sample) const;
+
+	// Finds what the pixel sees, for the denoiser (see denoiser.h): the surface's own
+	//	colour and normal, and its distance, averaged over the pixel's camera rays
+	//	Pixels that see nothing get zeros.
+	void calculatePixelFeatures(int x, int y, VEC3 &albedo, VEC3 &normal, float &depth) const;
 };
 
+// Brightness of a colour as it will be displayed (clamped to [0, 1]),
+//	which is what the noise of a pixel is measured in
+float displayedLuminance(const VEC3 &colour);
+
 #endif
@@ -19,3 +19,169 @@ extern const int SHADOW_LIGHT_SAMPLE_NUM = 2;		// 9 is pretty nice
 // Glossy reflections: number of random samples to shoot out of point on glass
 //	for the blurry, frosted-glass reflection effect
 extern const int GLOSSY_REFLECTION_SAMPLE_NUM = 4;		// 16 is pretty nice
+
+// Glossy recursion: a path reflects off at most GLOSSY_MAX_DEPTH glossy surfaces.
+//	Only the first one splits it into GLOSSY_REFLECTION_SAMPLE_NUM rays, so a
+//	pixel never traces more than (samples x reflection samples x depth) of them.
+//	After RUSSIAN_ROULETTE_DEPTH bounces, paths that can add little are ended
+//	at random (Russian roulette), and the rest weighted up to make up for them.
+extern const int GLOSSY_MAX_DEPTH = 4;
+extern const int RUSSIAN_ROULETTE_DEPTH = 2;
+
+// Sample sequence for the camera, soft shadow and glossy samples: 0 is independent
+//	random numbers, 1 scrambled Sobol, 2 Halton, 3 Sobol with blue-noise offsets.
+//	The low-discrepancy sequences (1-3) spread the samples of each pixel evenly, so
+//	noise falls faster as samples are added; blue noise leaves what noise is left
+//	fine-grained instead of blotchy, which helps most at low sample counts.
+extern const int SAMPLE_SEQUENCE = 1;
+
+// Many lights: in scenes with at least LIGHT_TREE_MIN_LIGHTS lights, each point
+//	is shaded by LIGHT_TREE_SAMPLE_NUM lights picked from a light tree, likelier
+//	the more they could light it, instead of by every light. The cost then grows
+//	with the log of the number of lights, at the price of some noise.
+extern const int LIGHT_TREE_MIN_LIGHTS = 8;
+extern const int LIGHT_TREE_SAMPLE_NUM = 2;
+
+// Skinned character: wrap the skeleton in a deforming mesh instead of cylinders.
+//	The mesh has a tube around every bone, with this many rings along the bone
+//	and vertices around each ring.
+extern const bool USE_SKINNED_CHARACTER = true;
+extern const int SKIN_RINGS_PER_BONE = 8;
+extern const int SKIN_SEGMENTS_PER_RING = 16;
+
+// Multithreading: number of threads rendering each frame (0 uses every core),
+//	and the width and height in pixels of the tiles they render
+extern const int RENDER_THREAD_NUM = 0;
+extern const int TILE_SIZE = 16;
+
+// NUMA: pin each render thread to a core, spread evenly over the NUMA nodes
+//	(sockets). Each node then gets its own copy of the textures, memory allowing,
+//	and the frame buffers are placed next to the threads rendering each tile.
+extern const bool PIN_RENDER_THREADS = false;
+
+// Number of frames in the pipeline at once, each with its own copy of the scene
+//	(at least one more than RENDER_STAGE_NUM). Frames render while the next ones
+//	are built, so the cores aren't left idle while a frame's scene is built or its
+//	image written out.
+extern const int FRAMES_IN_FLIGHT = 3;
+
+// Number of frames rendering at once, all on the one pool. The threads that run
+//	out of one frame's tiles go on with the next frame's, rather than waiting for
+//	the last tiles of the frame. Frames still come out in order. With the radiance
+//	cache on, frames render one at a time.
+extern const int RENDER_STAGE_NUM = 2;
+
+// Frame output: number of frame buffers the output thread writes from. Rendering
+//	only waits on the disk once they are all queued up. Direct I/O writes the
+//	frames around the OS page cache, which they would otherwise fill up.
+extern const int OUTPUT_BUFFER_NUM = 3;
+extern const bool OUTPUT_DIRECT_IO = false;
+
+// Movie output: compress the frames straight into frames/movie.<start>-<end>.mov
+//	as they render, and/or write each frame out as a PPM (for frames/movieMaker
+//	or the effect tests). Turning the PPMs off, when only the movie is wanted,
+//	saves writing them out and reading them back.
+extern const bool WRITE_MOVIE = true;
+extern const bool WRITE_FRAME_PPMS = true;
+
+// Render server: preview jobs are rendered this many times smaller in each
+//	direction than final ones, with PREVIEW_SAMPLING_ROOT^2 rays per pixel,
+//	unless the job asks for something else
+extern const int PREVIEW_RESOLUTION_DIVISOR = 4;
+extern const int PREVIEW_SAMPLING_ROOT = 1;
+
+// Adaptive sampling: instead of always tracing STRATIFIED_SAMPLING_ROOT^2 rays
+//	per pixel, trace that many and then keep adding as many again while the
+//	pixel is still noisy: until the standard error of its brightness is within
+//	ADAPTIVE_ERROR_TARGET (out of 1), or it has ADAPTIVE_MAX_SAMPLES rays. Flat
+//	areas stop early, and penumbras and glossy reflections get the extra rays.
+extern const bool ADAPTIVE_SAMPLING = false;
+extern const int ADAPTIVE_MAX_SAMPLES = 16;
+extern const float ADAPTIVE_ERROR_TARGET = 0.01;
+
+// Progressive rendering (e.g. for dailies): give every frame a fixed time rather
+//	than a fixed number of rays. Passes of STRATIFIED_SAMPLING_ROOT^2 rays per
+//	pixel are added up until PROGRESSIVE_SECONDS_PER_FRAME have passed or the
+//	standard error of every pixel's brightness is within PROGRESSIVE_ERROR_TARGET,
+//	and the best image so far is written out. 0 seconds renders a single pass.
+extern const double PROGRESSIVE_SECONDS_PER_FRAME = 0;
+extern const float PROGRESSIVE_ERROR_TARGET = 0.005;
+
+// Denoising: smooth away the noise left by the few rays per pixel, after the
+//	frame is rendered, with an edge-avoiding filter guided by each pixel's surface
+//	colour, normal and depth (see denoiser.h). Each of the DENOISE_ITERATIONS
+//	passes reaches twice as far as the last. Neighbours are blurred in less the
+//	more their colour (out of 1) differs by DENOISE_COLOUR_SIGMA, their surface's
+//	colour by DENOISE_ALBEDO_SIGMA, and their depth by DENOISE_DEPTH_SIGMA times
+//	what the surface's slope would explain.
+//	Frames split into tiles over a render farm are denoised by the coordinator,
+//	once every tile is in.
+extern const bool DENOISE = true;
+extern const int DENOISE_ITERATIONS = 5;
+extern const float DENOISE_COLOUR_SIGMA = 0.25;
+extern const float DENOISE_ALBEDO_SIGMA = 0.3;
+extern const float DENOISE_DEPTH_SIGMA = 1;
+
+// Temporal accumulation: average each pixel over the frames its surface has been
+//	in view, found by following the pixel's point back to where the last frame's
+//	camera saw it (see temporal.h). A frame counts as much as the frames before it
+//	put together until TEMPORAL_MAX_FRAMES are averaged, after which each new frame
+//	counts for 1 / TEMPORAL_MAX_FRAMES. Following points back resamples the history,
+//	which softens fine texture a little more every frame as the camera moves, and
+//	keeping few frames stops that adding up. The history is thrown away where the
+//	point is further off the surface seen there than TEMPORAL_DEPTH_TOLERANCE times
+//	its distance, or the cosine between their normals is under
+//	TEMPORAL_NORMAL_TOLERANCE, and kept within TEMPORAL_CLAMP_SIGMA standard
+//	deviations of the colours around the pixel (0 to not clamp it). The denoiser
+//	blurs less where more frames were averaged.
+//	Only clips rendered frame after frame build up history, not render farms or
+//	the render server.
+//	Off by default, since it gives up reproducible images: a frame's pixels depend
+//	on the frame the run started from, so the same frame comes out differently
+//	from a render farm or the render server than from a local render of the clip.
+extern const bool TEMPORAL_ACCUMULATION = false;
+extern const int TEMPORAL_MAX_FRAMES = 4;
+extern const float TEMPORAL_DEPTH_TOLERANCE = 0.02;
+extern const float TEMPORAL_NORMAL_TOLERANCE = 0.9;
+extern const float TEMPORAL_CLAMP_SIGMA = 1;
+
+// Radiance cache: the points hit by glossy reflections share their soft shadows
+//	through a grid of RADIANCE_CACHE_CELL_SIZE cells in world space (see
+//	radianceCache.h). Once RADIANCE_CACHE_SAMPLES hits in a cell facing the same
+//	way have traced their shadow rays to a light, later hits there use the average
+//	instead. The cache holds up to RADIANCE_CACHE_ENTRIES cells and lights, and
+//	lasts from frame to frame, losing only the cells the skeleton could shadow.
+//	Off by default, since it gives up reproducible images: which hits fill a cell
+//	depends on how the threads were scheduled, and what a frame finds in the cache
+//	on the frames rendered before it. The same frame then comes out (slightly)
+//	differently from run to run, and from a render farm than from a local render.
+//	With it on, frames render one at a time (see RENDER_STAGE_NUM), and the render
+//	server empties it for each job.
+extern const bool RADIANCE_CACHE = false;
+extern const int RADIANCE_CACHE_ENTRIES = 1 << 20;
+extern const float RADIANCE_CACHE_CELL_SIZE = 0.05;
+extern const int RADIANCE_CACHE_SAMPLES = 16;
+
+// Lightmaps: bake how much of each light reaches the static triangles past the
+//	other static shapes, into texels about LIGHTMAP_TEXEL_SIZE across laid out
+//	over their texture coordinates, from LIGHTMAP_SAMPLE_ROOT^2 shadow rays per
+//	texel and light (see lightmap.h). The bake is kept in LIGHTMAP_FILENAME and
+//	only redone when the scene or these settings change, or by "previz bake".
+//	Rendering then traces shadow rays at baked points against the skeleton only.
+extern const bool LIGHTMAPS = true;
+extern const char LIGHTMAP_FILENAME[] = "./lightmaps.bin";
+extern const float LIGHTMAP_TEXEL_SIZE = 0.05;
+extern const int LIGHTMAP_SAMPLE_ROOT = 8;
+
+// Out-of-core mesh: add the triangles packed into OUT_OF_CORE_MESH_FILENAME to the
+//	first scene, where they are in the OBJ's own coordinates, without ever loading
+//	all of them (see pagedMesh.h). "previz pack <mesh.obj> <file>" packs a mesh,
+//	OUT_OF_CORE_TRIANGLES_PER_PAGE triangles to a page, and up to
+//	OUT_OF_CORE_RESIDENT_MB of the pages are kept in memory. A pixel whose rays
+//	reach pages that aren't in memory is set aside while they are read in, and
+//	traced again after the rest of its tile, up to OUT_OF_CORE_PIXEL_RETRIES times
+//	before its thread waits for them. An empty name adds no mesh.
+extern const char OUT_OF_CORE_MESH_FILENAME[] = "";
+extern const int OUT_OF_CORE_TRIANGLES_PER_PAGE = 1024;
+extern const int OUT_OF_CORE_RESIDENT_MB = 1024;
+extern const int OUT_OF_CORE_PIXEL_RETRIES = 2;
@@ -0,0 +1,44 @@
+#include "renderContext.h"
+
+extern const int WINDOW_WIDTH;
+extern const int WINDOW_HEIGHT;
+extern const int STRATIFIED_SAMPLING_ROOT;
+
+RenderContext::RenderContext(const string &skeletonFilename, Motion *motion)
+	: motion(motion), character(NULL), pagedMesh(NULL), world(NULL), movingWorld(NULL),
+	width(WINDOW_WIDTH), height(WINDOW_HEIGHT), samplingRoot(STRATIFIED_SAMPLING_ROOT),
+	tracer(NULL), glossyPlastic(10.0, tracer)
+{
+	Skeleton *skeleton = new Skeleton(skeletonFilename.c_str(), MOCAP_SCALE);
+	skeleton->setBasePosture();
+	displayer.LoadSkeleton(skeleton);
+	skeleton->setPosture(*(motion->GetPosture(0)));
+}
+
+RenderContext::~RenderContext() {
+	clearShapes();
+	delete character;
+}
+
+void RenderContext::clearShapes() {
+	delete world;
+	world = NULL;
+	delete movingWorld;
+	movingWorld = NULL;
+
+	for (const Shape *shape : shapes) {
+		if (shape != character and shape != pagedMesh) {
+			delete shape;
+		}
+	}
+	shapes.clear();
+	movingShapes.clear();
+	movingBounds = AABB();
+}
+
+void RenderContext::buildWorld() {
+	delete world;
+	world = new PhysicsWorld(shapes);
+	delete movingWorld;
+	movingWorld = movingShapes.empty() ? NULL : new PhysicsWorld(movingShapes);
+}
@@ -0,0 +1,69 @@
+// A RenderContext holds everything needed to build and render one frame
+//	Each frame in flight gets its own context, so several frames can be built
+//	and rendered at the same time. Textures, stateless materials and the motion
+//	capture data are shared read-only between contexts; anything that changes
+//	per frame (the skeleton's pose, the shapes, the camera) lives in here.
+
+#ifndef _RENDER_CONTEXT_H
+#define _RENDER_CONTEXT_H
+
+#include <vector>
+#include <string>
+#include "SETTINGS.h"
+#include "shapes.h"
+#include "light.h"
+#include "material.h"
+#include "raytracer.h"
+#include "physicsWorld.h"
+#include "skeleton.h"
+#include "displaySkeleton.h"
+#include "motion.h"
+#include "skinnedMesh.h"
+#include "pagedMesh.h"
+
+using namespace std;
+
+class RenderContext {
+public:
+	DisplaySkeleton displayer;	// Owns this context's own copy of the skeleton
+	Motion *motion;	// Shared between contexts; only read
+
+	vector<const Shape *> shapes;
+	vector<Light> lights;
+	SkinnedMesh *character;	// Skin deformed each frame, reused rather than rebuilt (may be NULL)
+	const PagedMesh *pagedMesh;	// Out-of-core mesh shared by every context and not owned (may be NULL)
+	PhysicsWorld *world;	// Acceleration structure over the shapes, NULL until built
+	vector<const Shape *> movingShapes;	// Those of the shapes that move from frame to frame (the skeleton)
+	PhysicsWorld *movingWorld;	// Acceleration structure over just them, NULL if there are none
+	AABB movingBounds;	// Their bounds
+
+	// Current parameters for the camera
+	VEC3 eye, lookingAt, up;
+
+	// Image size and rays per pixel (as samplingRoot^2); the settings in
+	//	renderConfig.cpp unless changed, e.g. by the render server for previews
+	int width, height;
+	int samplingRoot;
+
+	RayTracer *tracer;	// Tracer for the frame being rendered, NULL between renders
+	GlossyPlastic glossyPlastic;	// Traces its reflections with this context's tracer
+
+	// Loads a skeleton of its own from the ASF file, posed at the motion's first frame
+	//	Skeleton parsing is not thread-safe, so create contexts on one thread
+	RenderContext(const string &skeletonFilename, Motion *motion);
+	~RenderContext();
+
+	// Deletes the shapes of the previous frame, except for the meshes, and their worlds
+	//	Also empties movingShapes and movingBounds
+	void clearShapes();
+
+	// Builds the worlds' acceleration structures over the current shapes
+	void buildWorld();
+
+private:
+	// Contexts own their shapes and skeleton, so they can't be copied
+	RenderContext(const RenderContext &);
+	RenderContext &operator=(const RenderContext &);
+};
+
+#endif
@@ -0,0 +1,47 @@
+// Counter-based random numbers for distributed ray tracing
+//	rand() keeps hidden global state, so its numbers depend on which thread asks
+//	first, and it locks on some platforms. Here every random number is instead a
+//	hash of where it is used: a key naming the sample (frame, pixel, sample
+//	index, and which effect is sampling) and a counter for the dimension. The
+//	same sample always gets the same numbers, whichever thread renders it and
+//	in whatever order, and nothing is shared between threads.
+
+#ifndef _RNG_H
+#define _RNG_H
+
+#include <cstdint>
+
+// Streams for the different effects, so they never share random numbers
+enum RandomStreamId {
+	CAMERA_STREAM = 1, SHADOW_STREAM, GLOSSY_STREAM, GLOSSY_RAY_STREAM, LIGHT_STREAM, ROULETTE_STREAM
+};
+
+// Scrambles a 64-bit value so nearby inputs give unrelated outputs
+//	This is the finaliser of SplitMix64; it is a bijection, so distinct
+//	counters can never collide.
+inline uint64_t mixBits(uint64_t value) {
+	value ^= value >> 30;
+	value *= 0xbf58476d1ce4e5b9ULL;
+	value ^= value >> 27;
+	value *= 0x94d049bb133111ebULL;
+	value ^= value >> 31;
+	return value;
+}
+
+// Combines a key with a further value into a new key
+inline uint64_t hashKey(uint64_t key, uint64_t value) {
+	return mixBits(key ^ mixBits(value + 0x9e3779b97f4a7c15ULL));
+}
+
+// Key for one camera sample of one pixel in one frame
+inline uint64_t makeSampleKey(int frame, int pixel, int sample) {
+	return hashKey(hashKey(hashKey(0, frame), pixel), sample);
+}
+
+// The random number in [0, 1) for this dimension of this key
+inline float randomFloat(uint64_t key, uint32_t dimension) {
+	// Keep 24 bits, which a float represents exactly
+	return (hashKey(key, dimension) >> 40) * (1.0f / 16777216.0f);
+}
+
+#endif
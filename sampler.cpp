@@ -0,0 +1,266 @@
+#include "sampler.h"
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+extern const int SAMPLE_SEQUENCE;
+
+// The blue-noise mask is tiled over the image, BLUE_NOISE_SIZE pixels square
+static const int BLUE_NOISE_SIZE = 64;
+static const float BLUE_NOISE_SIGMA = 1.9;
+
+//////////////////////////////////////////////////////////////////////////////////
+// Paths
+//////////////////////////////////////////////////////////////////////////////////
+
+SamplePath::SamplePath(int frame, int pixelX, int pixelY, int pixel, uint32_t index)
+	: key(makeSampleKey(frame, pixel, index)), frame(frame), pixelX(pixelX), pixelY(pixelY),
+	index(index), bounce(0)
+{}
+
+SamplePath SamplePath::reflect(RandomStreamId stream, uint64_t seed, int split, int splitNum) const {
+	SamplePath reflected = *this;
+	reflected.key = hashKey(hashKey(hashKey(key, stream), seed), split);
+	reflected.index = index * splitNum + split;
+	reflected.bounce = bounce + 1;
+	return reflected;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Sequences
+//////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t reverseBits(uint32_t x) {
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+	x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+	x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+	x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+	return x;
+}
+
+// Laine and Karras' hash, which only lets each bit affect the bits above it
+static uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed) {
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return x;
+}
+
+// Owen scrambling: randomly flips each bit of a fraction, depending on the bits above it
+static uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+	return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+}
+
+// The first two dimensions of the Sobol sequence, as 32-bit fractions
+static void sobol2D(uint32_t index, uint32_t &x, uint32_t &y) {
+	x = reverseBits(index);
+	y = 0;
+	for (uint32_t direction = 1u << 31; index != 0; index >>= 1, direction ^= direction >> 1) {
+		if (index & 1) {
+			y ^= direction;
+		}
+	}
+}
+
+static float radicalInverse(int base, uint32_t index) {
+	float inverseBase = 1.0f / base;
+	float scale = inverseBase;
+	float value = 0;
+	while (index > 0) {
+		value += (index % base) * scale;
+		index /= base;
+		scale *= inverseBase;
+	}
+	return value;
+}
+
+static float toUnitFloat(uint32_t x) {
+	return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+static float fraction(float x) {
+	x -= floor(x);
+	return x < 1 ? x : 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Blue noise
+//////////////////////////////////////////////////////////////////////////////////
+
+// Adds (or with sign -1, removes) a point's share of the energy of every pixel
+static void spreadEnergy(vector<float> &energy, const vector<float> &kernel, int point, float sign) {
+	int pointX = point % BLUE_NOISE_SIZE;
+	int pointY = point / BLUE_NOISE_SIZE;
+	for (int y = 0; y < BLUE_NOISE_SIZE; y++) {
+		int dy = (y - pointY + BLUE_NOISE_SIZE) % BLUE_NOISE_SIZE;
+		for (int x = 0; x < BLUE_NOISE_SIZE; x++) {
+			int dx = (x - pointX + BLUE_NOISE_SIZE) % BLUE_NOISE_SIZE;
+			energy[y * BLUE_NOISE_SIZE + x] += sign * kernel[dy * BLUE_NOISE_SIZE + dx];
+		}
+	}
+}
+
+// The pixel with the most (tightest cluster) or least (largest void) energy
+//	among those that are or aren't set
+static int findExtreme(const vector<float> &energy, const vector<bool> &set, bool wantSet, bool wantMost) {
+	int best = -1;
+	for (unsigned int i = 0; i < energy.size(); i++) {
+		if (set[i] != wantSet) {
+			continue;
+		}
+		if (best < 0 or (wantMost ? energy[i] > energy[best] : energy[i] < energy[best])) {
+			best = i;
+		}
+	}
+	return best;
+}
+
+// Ulichney's void-and-cluster method: ranks the pixels so that the first n of
+//	them are always spread as evenly as possible, for every n
+static vector<float> createBlueNoiseMask() {
+	int cellNum = BLUE_NOISE_SIZE * BLUE_NOISE_SIZE;
+
+	// Energy falls off as a Gaussian of the (wrapped around) distance
+	vector<float> kernel(cellNum);
+	for (int y = 0; y < BLUE_NOISE_SIZE; y++) {
+		for (int x = 0; x < BLUE_NOISE_SIZE; x++) {
+			int dx = min(x, BLUE_NOISE_SIZE - x);
+			int dy = min(y, BLUE_NOISE_SIZE - y);
+			kernel[y * BLUE_NOISE_SIZE + x] = exp(-(dx * dx + dy * dy) / (2 * BLUE_NOISE_SIGMA * BLUE_NOISE_SIGMA));
+		}
+	}
+
+	// Start from a tenth of the pixels, set at random, and even them out by
+	//	moving the most crowded one to the emptiest spot until that changes nothing
+	vector<bool> initial(cellNum, false);
+	vector<float> initialEnergy(cellNum, 0);
+	int initialNum = 0;
+	for (int i = 0; i < cellNum; i++) {
+		if (randomFloat(hashKey(0, BLUE_NOISE_SIZE), i) < 0.1) {
+			initial[i] = true;
+			spreadEnergy(initialEnergy, kernel, i, 1);
+			initialNum++;
+		}
+	}
+	while (true) {
+		int cluster = findExtreme(initialEnergy, initial, true, true);
+		initial[cluster] = false;
+		spreadEnergy(initialEnergy, kernel, cluster, -1);
+		int emptiest = findExtreme(initialEnergy, initial, false, false);
+		initial[emptiest] = true;
+		spreadEnergy(initialEnergy, kernel, emptiest, 1);
+		if (emptiest == cluster) {
+			break;
+		}
+	}
+
+	vector<int> ranks(cellNum);
+
+	// The initial pixels are ranked by taking away the most crowded one each time
+	vector<bool> set = initial;
+	vector<float> energy = initialEnergy;
+	for (int rank = initialNum - 1; rank >= 0; rank--) {
+		int cluster = findExtreme(energy, set, true, true);
+		set[cluster] = false;
+		spreadEnergy(energy, kernel, cluster, -1);
+		ranks[cluster] = rank;
+	}
+
+	// The rest by filling in the emptiest spot each time
+	set = initial;
+	energy = initialEnergy;
+	for (int rank = initialNum; rank < cellNum; rank++) {
+		int emptiest = findExtreme(energy, set, false, false);
+		set[emptiest] = true;
+		spreadEnergy(energy, kernel, emptiest, 1);
+		ranks[emptiest] = rank;
+	}
+
+	vector<float> mask(cellNum);
+	for (int i = 0; i < cellNum; i++) {
+		mask[i] = (ranks[i] + 0.5f) / cellNum;
+	}
+	return mask;
+}
+
+// The mask's value at this pixel, with the mask shifted by a random amount for each key
+static float blueNoise(int pixelX, int pixelY, uint64_t key) {
+	static const vector<float> mask = createBlueNoiseMask();
+	int x = (pixelX + (hashKey(key, 0) % BLUE_NOISE_SIZE)) % BLUE_NOISE_SIZE;
+	int y = (pixelY + (hashKey(key, 1) % BLUE_NOISE_SIZE)) % BLUE_NOISE_SIZE;
+	return mask[y * BLUE_NOISE_SIZE + x];
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////
+
+void sample2D(const SamplePath &path, int dimension, RandomStreamId stream, uint64_t seed,
+	int split, int splitNum, float &u, float &v)
+{
+	if (SAMPLE_SEQUENCE == RANDOM_SEQUENCE) {
+		uint64_t key = hashKey(hashKey(path.key, stream), seed);
+		u = randomFloat(key, 2 * split);
+		v = randomFloat(key, 2 * split + 1);
+
+		// Split draws are stratified: jittered on a grid if they make a square, else in strips
+		int root = sqrt((float) splitNum) + 0.5f;
+		if (root * root == splitNum) {
+			u = (split % root + u) / root;
+			v = (split / root + v) / root;
+		} else {
+			u = (split + u) / splitNum;
+		}
+		return;
+	}
+
+	dimension += DIMENSIONS_PER_BOUNCE * path.bounce;
+	uint32_t index = path.index * splitNum + split;
+	uint64_t frameKey = hashKey(hashKey(hashKey(0, path.frame), dimension), seed);
+	uint64_t pixelKey = hashKey(hashKey(frameKey, path.pixelX), path.pixelY);
+
+	if (SAMPLE_SEQUENCE == HALTON_SEQUENCE) {
+		u = fraction(radicalInverse(2, index) + randomFloat(pixelKey, 0));
+		v = fraction(radicalInverse(3, index) + randomFloat(pixelKey, 1));
+		return;
+	}
+
+	// Blue noise scrambles the same way for every pixel, and shifts each pixel's points instead
+	uint64_t scrambleKey = SAMPLE_SEQUENCE == BLUE_NOISE_SEQUENCE ? frameKey : pixelKey;
+	uint32_t x, y;
+	sobol2D(nestedUniformScramble(index, hashKey(scrambleKey, 0)), x, y);
+	u = toUnitFloat(nestedUniformScramble(x, hashKey(scrambleKey, 1)));
+	v = toUnitFloat(nestedUniformScramble(y, hashKey(scrambleKey, 2)));
+
+	if (SAMPLE_SEQUENCE == BLUE_NOISE_SEQUENCE) {
+		u = fraction(u + blueNoise(path.pixelX, path.pixelY, hashKey(frameKey, 0)));
+		v = fraction(v + blueNoise(path.pixelX, path.pixelY, hashKey(frameKey, 1)));
+	}
+}
+
+void squareToDisc(float u, float v, float &x, float &y) {
+	float a = 2 * u - 1;
+	float b = 2 * v - 1;
+	if (a == 0 and b == 0) {
+		x = 0;
+		y = 0;
+		return;
+	}
+
+	// Concentric squares map to concentric circles
+	float radius, angle;
+	if (fabs(a) > fabs(b)) {
+		radius = a;
+		angle = (M_PI / 4) * (b / a);
+	} else {
+		radius = b;
+		angle = M_PI / 2 - (M_PI / 4) * (a / b);
+	}
+	x = radius * cos(angle);
+	y = radius * sin(angle);
+}
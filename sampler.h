@@ -0,0 +1,66 @@
+// Low-discrepancy sample sequences for distributed ray tracing
+//	Independent random numbers (rng.h) clump together and leave gaps, so the
+//	noise of a pixel falls slowly as samples are added. Here the samples of a
+//	pixel are instead successive points of a sequence that covers the unit
+//	square evenly, whatever the number of points taken:
+//
+//	- Sobol: the (0, 2) sequence, shuffled and Owen-scrambled with hashes
+//	  (Burley, "Practical Hash-based Owen Scrambling", 2020)
+//	- Halton: bases 2 and 3, each pixel's points shifted by a random offset
+//	- Blue noise: the Sobol points, shifted per pixel by a blue-noise mask, so
+//	  neighbouring pixels err in different directions and what's left of the
+//	  noise is fine-grained rather than blotchy
+//
+//	Every effect takes its numbers in pairs, from a fixed layout of dimensions:
+//	the camera first, then a block for each bounce. Each pair is a separately
+//	scrambled 2D sequence, so pairs don't correlate with each other, and each
+//	pixel and frame gets its own scrambling.
+
+#ifndef _SAMPLER_H
+#define _SAMPLER_H
+
+#include <cstdint>
+#include "rng.h"
+
+// The sequences to choose from with SAMPLE_SEQUENCE (see renderConfig.cpp)
+enum SampleSequence {
+	RANDOM_SEQUENCE = 0, SOBOL_SEQUENCE, HALTON_SEQUENCE, BLUE_NOISE_SEQUENCE
+};
+
+// Where each effect takes its pair of dimensions from
+enum SampleDimension {
+	CAMERA_DIMENSION = 0,	// Jitter inside the pixel
+	SHADOW_DIMENSION = 2,	// Point on an area light
+	GLOSSY_DIMENSION = 4,	// Point on the glossy reflection disc
+	LIGHT_DIMENSION = 6,	// Light picked from the light tree (see lightTree.h)
+	DIMENSIONS_PER_BOUNCE = 6	// Shadow, glossy and light move on this far for every reflection
+};
+
+// Identifies the sample a ray belongs to, for its random numbers
+struct SamplePath {
+	uint64_t key;	// Key for independent random numbers (see rng.h)
+	int frame, pixelX, pixelY;	// The pixel's sequence is scrambled by these
+	uint32_t index;	// Index of the sample in its pixel's sequence
+	int bounce;	// Surfaces the path has reflected off so far
+
+	SamplePath() : key(0), frame(0), pixelX(0), pixelY(0), index(0), bounce(0) {}
+	SamplePath(int frame, int pixelX, int pixelY, int pixel, uint32_t index);
+
+	// The path of a ray reflected off the surface this path has reached
+	//	The ray is reflection split of splitNum, and takes its own points of the sequence.
+	SamplePath reflect(RandomStreamId stream, uint64_t seed, int split, int splitNum) const;
+};
+
+// Two numbers in [0, 1) for the pair of dimensions starting at dimension
+//	(moved on for the path's bounce). The draw is split of splitNum taken at the
+//	same point, e.g. the shadow rays to one light, which are spread over the
+//	sequence together. stream and seed tell apart the uses of the same dimensions,
+//	e.g. the lights; with random sampling they pick the key instead.
+void sample2D(const SamplePath &path, int dimension, RandomStreamId stream, uint64_t seed,
+	int split, int splitNum, float &u, float &v);
+
+// Maps a point of the unit square to the unit disc, keeping areas in proportion
+//	(Shirley and Chiu's concentric mapping), so evenly spread points stay that way
+void squareToDisc(float u, float v, float &x, float &y);
+
+#endif
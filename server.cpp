@@ -0,0 +1,318 @@
+#include "server.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <sstream>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+typedef chrono::steady_clock Clock;
+
+// Longest job line a client may send
+static const size_t MAX_LINE_LENGTH = 4096;
+
+// Reading a job from a client that has connected gives up after this long
+static const int RECEIVE_TIMEOUT_SECONDS = 5;
+
+//////////////////////////////////////////////////////////////////////////////////
+// Jobs and sockets
+//////////////////////////////////////////////////////////////////////////////////
+
+bool parseRenderJob(const string &line, RenderJob &job) {
+	job.preview = false;
+	job.hasEye = false;
+	job.hasLookingAt = false;
+	job.scale = 0;
+	job.samplingRoot = 0;
+
+	istringstream words(line);
+	string word;
+	if (not (words >> word) or word != "render" or not (words >> job.startFrame >> job.endFrame)) {
+		return false;
+	}
+	if (job.startFrame < 0 or job.endFrame < job.startFrame) {
+		return false;
+	}
+
+	while (words >> word) {
+		bool parsed = true;
+		if (word == "preview" or word == "final") {
+			job.preview = word == "preview";
+		} else if (word == "eye") {
+			parsed = (bool) (words >> job.eye[0] >> job.eye[1] >> job.eye[2]);
+			job.hasEye = true;
+		} else if (word == "lookat") {
+			parsed = (bool) (words >> job.lookingAt[0] >> job.lookingAt[1] >> job.lookingAt[2]);
+			job.hasLookingAt = true;
+		} else if (word == "scale") {
+			parsed = (words >> job.scale) and job.scale > 0;
+		} else if (word == "samples") {
+			parsed = (words >> job.samplingRoot) and job.samplingRoot > 0;
+		} else {
+			parsed = false;
+		}
+		if (not parsed) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool sendLine(int socket, const string &line) {
+	string text = line + "\n";
+	const char *bytes = text.c_str();
+	size_t size = text.size();
+	while (size > 0) {
+		ssize_t sent = send(socket, bytes, size, 0);
+		if (sent < 0 and errno == EINTR) {
+			continue;
+		}
+		if (sent <= 0) {
+			return false;
+		}
+		bytes += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+// Reads up to the next newline, returning false if the line never finishes
+//	The socket is read a byte at a time, so nothing after the line is consumed.
+static bool receiveLine(int socket, string &line) {
+	line.clear();
+	while (line.size() < MAX_LINE_LENGTH) {
+		char c;
+		ssize_t received = recv(socket, &c, 1, 0);
+		if (received < 0 and errno == EINTR) {
+			continue;
+		}
+		if (received <= 0) {
+			return false;
+		}
+		if (c == '\n') {
+			return true;
+		}
+		line += c;
+	}
+	return false;
+}
+
+static bool socketAddress(const string &socketPath, sockaddr_un &address) {
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof(address.sun_path)) {
+		cout << " The socket path \"" << socketPath << "\" is too long. Bailing ... " << endl;
+		return false;
+	}
+	strcpy(address.sun_path, socketPath.c_str());
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Server
+//////////////////////////////////////////////////////////////////////////////////
+
+struct ServerJob {
+	RenderJob job;
+	int socket;	// The client that sent it, which gets told about each frame
+	int nextFrame;
+};
+
+class RenderServer {
+	int listener;
+	JobFrameFunction renderFrame;
+
+	// Jobs not yet finished, in the order they came in; shared with the acceptor thread
+	mutex lock;
+	condition_variable jobAdded;
+	deque<ServerJob *> jobs;
+	int nextJobId;
+
+	void acceptJobs();
+	void readJob(int s);
+	ServerJob *nextJob();
+	void finishJob(ServerJob *job, const string &reply);
+
+public:
+	RenderServer(JobFrameFunction renderFrame) : listener(-1), renderFrame(renderFrame), nextJobId(0) {}
+	bool listenOn(const string &socketPath);
+	void run();
+};
+
+bool RenderServer::listenOn(const string &socketPath) {
+	sockaddr_un address;
+	if (not socketAddress(socketPath, address)) {
+		return false;
+	}
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0) {
+		return false;
+	}
+	fcntl(listener, F_SETFD, fcntl(listener, F_GETFD) | FD_CLOEXEC);
+
+	// A server that was killed leaves its socket file behind
+	unlink(socketPath.c_str());
+	if (bind(listener, (sockaddr *) &address, sizeof(address)) != 0 or listen(listener, 16) != 0) {
+		cout << " Could not listen on \"" << socketPath << "\". Bailing ... " << endl;
+		close(listener);
+		return false;
+	}
+	return true;
+}
+
+// Takes each client's connection, on a thread of its own so jobs can arrive
+//	(and previews jump the queue) while a frame renders
+//	Each connection's job is read on yet another thread, so a client that
+//	connects and then sends nothing holds up nobody else's job.
+void RenderServer::acceptJobs() {
+	while (true) {
+		int s = accept(listener, NULL, NULL);
+		if (s < 0) {
+			if (errno != EINTR) {
+				this_thread::sleep_for(chrono::milliseconds(100));
+			}
+			continue;
+		}
+		fcntl(s, F_SETFD, fcntl(s, F_GETFD) | FD_CLOEXEC);
+		timeval timeout = { RECEIVE_TIMEOUT_SECONDS, 0 };
+		setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+		thread reader(&RenderServer::readJob, this, s);
+		reader.detach();
+	}
+}
+
+// Reads the client's job and queues it up, or tells it what was wrong and hangs up
+void RenderServer::readJob(int s) {
+	string line;
+	ServerJob *job = new ServerJob;
+	if (not receiveLine(s, line) or not parseRenderJob(line, job->job)) {
+		sendLine(s, "error: expected \"render <start> <end> [preview|final] [eye x y z] "
+			"[lookat x y z] [scale n] [samples n]\"");
+		close(s);
+		delete job;
+		return;
+	}
+	job->socket = s;
+	job->nextFrame = job->job.startFrame;
+
+	lock_guard<mutex> guard(lock);
+	int id = nextJobId++;
+	job->job.name = "job" + to_string(id);
+	if (sendLine(s, "queued " + to_string(id))) {
+		cout << "Queued " << (job->job.preview ? "preview" : "final") << " job " << id << ": " << line << endl;
+		jobs.push_back(job);
+		jobAdded.notify_one();
+	} else {
+		close(s);
+		delete job;
+	}
+}
+
+// The job to render a frame of next: the oldest preview, or else the oldest final job
+ServerJob *RenderServer::nextJob() {
+	unique_lock<mutex> guard(lock);
+	jobAdded.wait(guard, [this] { return not jobs.empty(); });
+	for (ServerJob *job : jobs) {
+		if (job->job.preview) {
+			return job;
+		}
+	}
+	return jobs.front();
+}
+
+void RenderServer::finishJob(ServerJob *job, const string &reply) {
+	{
+		lock_guard<mutex> guard(lock);
+		for (deque<ServerJob *>::iterator i = jobs.begin(); i != jobs.end(); i++) {
+			if (*i == job) {
+				jobs.erase(i);
+				break;
+			}
+		}
+	}
+	sendLine(job->socket, reply);
+	close(job->socket);
+	cout << "Finished " << job->job.name << " (" << reply << ")" << endl;
+	delete job;
+}
+
+void RenderServer::run() {
+	thread acceptor(&RenderServer::acceptJobs, this);
+	acceptor.detach();
+
+	while (true) {
+		// Only this thread changes a queued job, so it can render without the lock
+		ServerJob *job = nextJob();
+		int frame = job->nextFrame++;
+
+		Clock::time_point start = Clock::now();
+		string filename = renderFrame(job->job, frame);
+		double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+		char reply[64];
+		sprintf(reply, " %.3f", seconds);
+		if (not sendLine(job->socket, "frame " + to_string(frame) + " " + filename + reply)) {
+			finishJob(job, "cancelled");	// The client has gone, so nobody wants the rest
+		} else if (job->nextFrame > job->job.endFrame) {
+			finishJob(job, "done");
+		}
+	}
+}
+
+bool runRenderServer(const string &socketPath, JobFrameFunction renderFrame) {
+	signal(SIGPIPE, SIG_IGN);
+
+	RenderServer server(renderFrame);
+	if (not server.listenOn(socketPath)) {
+		return false;
+	}
+	cout << "Render server listening on " << socketPath << endl;
+	server.run();
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Client
+//////////////////////////////////////////////////////////////////////////////////
+
+bool submitRenderJob(const string &socketPath, const string &line) {
+	signal(SIGPIPE, SIG_IGN);
+
+	sockaddr_un address;
+	if (not socketAddress(socketPath, address)) {
+		return false;
+	}
+	int s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s < 0 or connect(s, (sockaddr *) &address, sizeof(address)) != 0) {
+		cout << " Could not connect to the render server at \"" << socketPath << "\". Bailing ... " << endl;
+		if (s >= 0) {
+			close(s);
+		}
+		return false;
+	}
+
+	bool finished = false;
+	string reply;
+	if (sendLine(s, line)) {
+		// Frames can take a while, so wait as long as it takes
+		while (receiveLine(s, reply)) {
+			cout << reply << endl;
+			if (reply == "done") {
+				finished = true;
+			}
+		}
+	}
+	close(s);
+	return finished;
+}
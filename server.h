@@ -0,0 +1,50 @@
+// A render server keeps the scene loaded between renders, and takes jobs over a Unix socket
+//	"previz serve [socket]" loads the skeleton, motion and textures and starts the
+//	render threads once, then renders whatever jobs clients send. A job is a line
+//	of text:
+//
+//		render <start> <end> [preview|final] [eye x y z] [lookat x y z] [scale n] [samples n]
+//
+//	eye and lookat replace the animated camera, scale divides the resolution and
+//	samples sets the square root of the rays per pixel. "previz job <socket> ..."
+//	sends one and prints the server's replies: "queued <id>", then
+//	"frame <n> <file> <seconds>" as each frame is written, then "done".
+//
+//	Jobs are rendered a frame at a time. Preview jobs go ahead of final ones,
+//	so a queued or half-finished final render waits at most one frame before a
+//	new preview starts. Jobs of the same kind run in the order they came in.
+
+#ifndef _SERVER_H
+#define _SERVER_H
+
+#include <string>
+#include <functional>
+#include "SETTINGS.h"
+
+using namespace std;
+
+struct RenderJob {
+	int startFrame, endFrame;	// Inclusive
+	bool preview;
+	bool hasEye, hasLookingAt;
+	VEC3 eye, lookingAt;	// Replace the animated camera, where given
+	int scale;	// Divides the width and height, or 0 for the default
+	int samplingRoot;	// Rays per pixel is its square, or 0 for the default
+	string name;	// Set by the server; frames go to ./frames/<name>.%04i.ppm
+};
+
+// Renders one frame of the job and writes it out, returning the file's name
+typedef function<string(const RenderJob &job, int frame)> JobFrameFunction;
+
+// Reads a job from its line of text, returning false if it's malformed
+bool parseRenderJob(const string &line, RenderJob &job);
+
+// Listens on the socket and renders jobs as they come, until the process is killed
+//	Returns false if the socket could not be set up.
+bool runRenderServer(const string &socketPath, JobFrameFunction renderFrame);
+
+// Sends a job to the server, and prints its replies until the job is done
+//	Returns false if the server could not be reached or didn't finish the job.
+bool submitRenderJob(const string &socketPath, const string &line);
+
+#endif
@@ -1,22 +1,32 @@
 #include "shader.h"
 #include "material.h"
+#include "sampler.h"
+#include "rng.h"
+#include "pagedMesh.h"
 
 extern const int SHADOW_LIGHT_SAMPLE_NUM;	// Number of samples to use for soft shadows
+extern const int LIGHT_TREE_MIN_LIGHTS;	// Fewest lights to sample from a light tree
+extern const int LIGHT_TREE_SAMPLE_NUM;	// Number of lights to pick for each point
+
+Shader::Shader(const vector<Light> &lights, const PhysicsWorld &world, VEC3 eye, RadianceCache *cache,
+	const Lightmaps *lightmaps, const PhysicsWorld *movingWorld)
+	: lights(lights), world(world), eye(eye), cache(cache), lightmaps(lightmaps), movingWorld(movingWorld)
+{
+	if ((int) lights.size() >= LIGHT_TREE_MIN_LIGHTS) {
+		lightTree.build(lights);
+	}
+}
 
-Shader::Shader(const vector<const Light> &lights, const PhysicsWorld &world, VEC3 eye)
-	: lights(lights), world(world), eye(eye)
-{}
-
-// Returns true if a point is blocked from the light
-bool Shader::isOccludedFromLight(VEC3 point, const Light &light) const {
-	VEC3 dir = (light.pos - point);
+// Returns true if a point is blocked from a point on a light
+bool Shader::isOccludedFromLight(VEC3 point, VEC3 lightPoint, const PhysicsWorld &occluders) const {
+	VEC3 dir = (lightPoint - point);
 	const float shadowAcneFix = 0.01;  // Prevents light from intersecting with point itself
 	Ray ray(point + dir * shadowAcneFix, dir);                                      // IS THIS A CORRECT FIX??
 	
 	// Check if reverse light ray hits a shape
 	const Shape* intersectShape = NULL;
 	VEC3 intersectPoint;
-	bool intersects = world.existsClosestIntersection(ray, intersectShape, intersectPoint);
+	bool intersects = occluders.existsClosestIntersection(ray, intersectShape, intersectPoint);
 
 	// Check if the hit shape was in front of the light
 	if (intersects) {
@@ -26,7 +36,7 @@ bool Shader::isOccludedFromLight(VEC3 point, const Light &light) const {
 				continue;
 			} else {
 				// Check if, along this component, shape is closer than light
-				float timeToLight = (light.pos[i] - ray.o[i]) / ray.d[i];
+				float timeToLight = (lightPoint[i] - ray.o[i]) / ray.d[i];
 				float timeToShape = (intersectPoint[i] - ray.o[i]) / ray.d[i];
 				intersects = timeToShape < timeToLight;
 				break;
@@ -41,56 +51,126 @@ bool Shader::isOccludedFromLight(VEC3 point, const Light &light) const {
 // Calculates the fraction of the light surface visible from this point
 //	Used for soft shadows. Uses random sampling to avoid strobing.
 //	Approximates the visibility integral by sampling points on the light.
-float Shader::computeShadowVisibilityIntegral(VEC3 point, const Light &light) const {
-	// Calculate random points on the light surface
+float Shader::computeShadowVisibilityIntegral(VEC3 point, const Light &light, int lightIndex, const SamplePath &path, const PhysicsWorld &occluders) const {
+	// A point light is either seen or not
+	if (light.shape == POINT_LIGHT) {
+		return isOccludedFromLight(point, light.pos, occluders) ? 0 : 1;
+	}
+
 	float visibility = 0;
-	float lightWidth = 3;
+	float totalWeight = 0;
 
 	// Check if each light sample is visible from the point
 	for (int i = 0; i < SHADOW_LIGHT_SAMPLE_NUM; i++) {
-		// Generate random point on light 																
-		float lightX = light.pos[0] + ((((float) rand()) / (float) RAND_MAX) - 0.5) * lightWidth;
-		float lightZ = light.pos[2] + ((((float) rand()) / (float) RAND_MAX) - 0.5) * lightWidth;
-		Light sample{VEC3(lightX, light.pos[1], lightZ), light.colour};				// FIX LIGHTS CAN ONLY BE HORIZONTAL!!!!
+		// The samples are spread evenly over the light together (see sampler.h)
+		float u, v, weight;
+		sample2D(path, SHADOW_DIMENSION, SHADOW_STREAM, lightIndex, i, SHADOW_LIGHT_SAMPLE_NUM, u, v);
+		VEC3 lightPoint = sampleLightPoint(light, point, u, v, weight);
+		if (weight <= 0) {
+			continue;
+		}
 
 		// Check if point is visible
-		if (not isOccludedFromLight(point, sample)) {
-			visibility += 1;
+		totalWeight += weight;
+		if (not isOccludedFromLight(point, lightPoint, occluders)) {
+			visibility += weight;
 		}
 	}
 
-	// Return average visibility
-	visibility /= (float) SHADOW_LIGHT_SAMPLE_NUM;
-	return visibility;
+	// Return the visible share of the light
+	return totalWeight > 0 ? visibility / totalWeight : 0;
+}
+
+// Like computeShadowVisibilityIntegral, with as many samples as asked for
+float Shader::estimateLightVisibility(VEC3 point, int lightIndex, int sampleRoot, uint64_t key) const {
+	const Light &light = lights[lightIndex];
+	if (light.shape == POINT_LIGHT) {
+		return isOccludedFromLight(point, light.pos, world) ? 0 : 1;
+	}
+
+	float visibility = 0;
+	float totalWeight = 0;
+	for (int i = 0; i < sampleRoot * sampleRoot; i++) {
+		float u = ((i % sampleRoot) + randomFloat(key, 2 * i)) / sampleRoot;
+		float v = ((i / sampleRoot) + randomFloat(key, 2 * i + 1)) / sampleRoot;
+		float weight;
+		VEC3 lightPoint = sampleLightPoint(light, point, u, v, weight);
+		if (weight <= 0) {
+			continue;
+		}
+		totalWeight += weight;
+		if (not isOccludedFromLight(point, lightPoint, world)) {
+			visibility += weight;
+		}
+	}
+	return totalWeight > 0 ? visibility / totalWeight : 0;
+}
+
+VEC3 Shader::calculateSourceShading(VEC3 point, const Shape *shape, VEC3 normal, VEC3 eyeDir, int lightIndex, int seed, const SamplePath &path) const {
+	const Light &light = lights[lightIndex];
+
+	float fraction;
+	if (lightmaps != NULL and lightmaps->lookup(shape, point, lightIndex, fraction)) {
+		// The static shapes' shadows were baked; only the moving shapes are traced, and
+		//	what they let through is taken to be independent of what the static ones do
+		if (fraction > 0 and movingWorld != NULL) {
+			fraction *= computeShadowVisibilityIntegral(point, light, seed, path, *movingWorld);
+		}
+	} else if (cache != NULL and path.bounce > 0) {
+		// Hits of glossy reflections share their shadows through the cache, once it has enough of them
+		if (not cache->lookup(point, normal, lightIndex, fraction)) {
+			fraction = computeShadowVisibilityIntegral(point, light, seed, path, world);
+
+			// Shadow rays that skipped an out-of-core mesh's pages would share the wrong shadow
+			if (not pagesMissed()) {
+				cache->add(point, normal, lightIndex, fraction);
+			}
+		}
+	} else {
+		fraction = computeShadowVisibilityIntegral(point, light, seed, path, world);
+	}
+	if (fraction == 0) {
+		return VEC3(0, 0, 0);
+	}
+	return fraction * shape->material.calculateDirectShading(shape, point, normal, light, seed, eyeDir, path);
 }
 
 // Calculates full 3-term lighting with shadows
 //  Computes diffuse lighting and specular highligts for all lights
-VEC3 Shader::calculateShading(VEC3 point, const Shape *shape, const Ray &ray) const {
+VEC3 Shader::calculateShading(VEC3 point, const Shape *shape, int part, const Ray &ray) const {
 	// Return black if no intersection
 	if (shape == NULL) {
 		return VEC3(0, 0, 0);
 	}
 
-	VEC3 colour = VEC3(0, 0, 0);
-	VEC3 normal = shape->getNormalAt(point, ray);
+	VEC3 normal = shape->getPartNormalAt(point, ray, part);
 	VEC3 eyeDir = (eye - point).normalized(); 
+
+	// Reflections and the like don't depend on the lights, so are only traced once
+	VEC3 colour = shape->material.calculateIndirectShading(shape, point, normal, eyeDir, ray);
+
+	// Many lights: shade with a few picked from the light tree, each divided by
+	//	its chance of being picked so the average is the sum over all of them
+	if (not lightTree.empty()) {
+		for (int pick = 0; pick < LIGHT_TREE_SAMPLE_NUM; pick++) {
+			float u, v, probability;
+			sample2D(ray.path, LIGHT_DIMENSION, LIGHT_STREAM, 0, pick, LIGHT_TREE_SAMPLE_NUM, u, v);
+			int lightIndex = lightTree.sampleLight(point, normal, u, probability);
+			if (lightIndex < 0 or probability <= 0) {
+				continue;
+			}
+
+			// Each pick gets its own random numbers, even when it picks the same light again
+			VEC3 shading = calculateSourceShading(point, shape, normal, eyeDir, lightIndex, pick, ray.path);
+			colour += shading / (probability * LIGHT_TREE_SAMPLE_NUM);
+		}
+		return colour;
+	}
 	
 	// Sum shading for all lights
-	for (const Light &light : lights) { 
-		/*
-		// If occluder exists, ignore shading
-		bool isOccluded = isOccludedFromLight(point, light);
-		if (isOccluded) {
-			continue;
-		}
-		*/
-		float fraction = computeShadowVisibilityIntegral(point, light);
-		//cout << "asking for shading from material" << endl;
-		colour += fraction * shape->material.calculateShading(shape, point, normal, light, eyeDir);
-		//colour += calculateSourcePhongShading(point, light, shape, normal, eyeDir);
-		//colour += shape->material.calculateShading(shape, point, normal, light, eyeDir);
-
+	for (unsigned int lightIndex = 0; lightIndex < lights.size(); lightIndex++) { 
+		// Each light gets its own random numbers for shadows and glossy reflections
+		colour += calculateSourceShading(point, shape, normal, eyeDir, lightIndex, lightIndex, ray.path);
 	}
 
 	return colour;
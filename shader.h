@@ -6,30 +6,47 @@
 
 #include "shapes.h"
 #include "light.h"
+#include "lightTree.h"
 #include "physicsWorld.h"
+#include "radianceCache.h"
+#include "lightmap.h"
 
 using namespace std;
 
 class Shader {
-	const vector<const Light> &lights;	// List of all the lights in the scene
+	const vector<Light> &lights;	// List of all the lights in the scene
 	const PhysicsWorld &world;	// Ohysics engine handling collisions between rays and shapes
 	VEC3 eye;
+	LightTree lightTree;	// Built only when there are enough lights to sample from it
+	RadianceCache *cache;	// Shadows at the hits of glossy reflections, or NULL to always trace them
+	const Lightmaps *lightmaps;	// Shadows of the static shapes, baked, or NULL to trace them
+	const PhysicsWorld *movingWorld;	// Just the moving shapes, which cast shadows over the baked ones (may be NULL)
 
 	// Calculates the Phong shading for a single source
 	//VEC3 calculateSourcePhongShading(VEC3 point, const Light &light, const Shape *shape, VEC3 normal, VEC3 eyeDir) const;
 	// Calculates the Cook-Torrance shading for a single source
 	//VEC3 calculateSourceCookTorranceShading(VEC3 point, VEC3 normal, const Light &light, VEC3 eyeDir) const;
 
-	// Returns true if a point is blocked from the light
-	bool isOccludedFromLight(VEC3 point, const Light &light) const;
-	// Approximates the shadow visibility integral for soft shadows
-	float computeShadowVisibilityIntegral(VEC3 point, const Light &light) const;
+	// Returns true if a point is blocked from a point on a light by one of the occluders
+	bool isOccludedFromLight(VEC3 point, VEC3 lightPoint, const PhysicsWorld &occluders) const;
+	// Approximates the shadow visibility integral for soft shadows: the fraction of
+	//	the light's solid angle visible from the point
+	//	The points on the light come from the path's sequence (see sampler.h).
+	float computeShadowVisibilityIntegral(VEC3 point, const Light &light, int lightIndex, const SamplePath &path, const PhysicsWorld &occluders) const;
+	// Shading from a single light (lights[lightIndex]), including its shadow
+	//	seed picks the light's random numbers for shadows and glossy reflections
+	VEC3 calculateSourceShading(VEC3 point, const Shape *shape, VEC3 normal, VEC3 eyeDir, int lightIndex, int seed, const SamplePath &path) const;
 
 public:
-	Shader(const vector<const Light> &lights, const PhysicsWorld &world, VEC3 eye);
+	Shader(const vector<Light> &lights, const PhysicsWorld &world, VEC3 eye, RadianceCache *cache = NULL,
+		const Lightmaps *lightmaps = NULL, const PhysicsWorld *movingWorld = NULL);
+
+	// The visible share of lights[lightIndex] from the point, from sampleRoot^2 points
+	//	stratified over the light and jittered by key, for baking lightmaps
+	float estimateLightVisibility(VEC3 point, int lightIndex, int sampleRoot, uint64_t key) const;
 
 	// Calculate the colour at the point given on the shape
-	//	Inputs the ray that lands on that point
-	VEC3 calculateShading(VEC3 point, const Shape *shape, const Ray &ray) const;
+	//	Inputs the ray that lands on that point, and the part of the shape it hit
+	VEC3 calculateShading(VEC3 point, const Shape *shape, int part, const Ray &ray) const;
 };
 #endif
@@ -16,6 +16,15 @@ VEC3 Shape::getColourAt(VEC3 point) const {
 	return baseColour;
 }
 
+bool Shape::intersectsPart(const Ray &ray, float &t, int &part) const {
+	part = -1;
+	return intersects(ray, t);
+}
+
+VEC3 Shape::getPartNormalAt(VEC3 point, const Ray &ray, int part) const {
+	return getNormalAt(point, ray);
+}
+
 // Calculates the component-wise product of two vectors
 VEC3 Shape::hadamard(VEC3 a, VEC3 b) {
 	return VEC3(a[0]*b[0], a[1]*b[1], a[2]*b[2]);
@@ -101,6 +110,11 @@ bool Sphere::intersects(const Ray &ray, float &t) const {
 	return hasSmallestPositiveRoot(roots, t);
 }
 
+AABB Sphere::getBoundingBox() const {
+	VEC3 extent = VEC3::Constant(radius);
+	return AABB(center - extent, center + extent);
+}
+
 
 //////////////////////////////////// TRIANGLE //////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
@@ -148,7 +162,7 @@ VEC3 Triangle::transformToLocal(VEC3 point) const {
 }
 
 Triangle::Triangle(VEC3 a, VEC3 b, VEC3 c, const Material &mat, VEC3 colour)
-	: Shape(mat, colour), a(a), b(b), c(c), material(mat)
+	: Shape(mat, colour), a(a), b(b), c(c), material(mat), baseColour(colour)
 {
 	// Initialise reused values for intersection checking
 	_a = a[0] - b[0];
@@ -224,6 +238,14 @@ bool Triangle::intersects(const Ray &ray, float& t) const {
 	return intersectsWithRay(ray, t);
 }
 
+AABB Triangle::getBoundingBox() const {
+	AABB box;
+	box.expand(a);
+	box.expand(b);
+	box.expand(c);
+	return box;
+}
+
 // Sets mapping of triangle to texture
 //	So vertex a will map to texA, etc, and any point inside
 //	the triangle will find its location on the texture using 
@@ -235,6 +257,18 @@ void Triangle::setTextureCoords(VEC2 _texA, VEC2 _texB, VEC2 _texC) {
 	texC = _texC;
 }
 
+void Triangle::getTextureCoords(VEC2 &_texA, VEC2 &_texB, VEC2 &_texC) const {
+	_texA = texA;
+	_texB = texB;
+	_texC = texC;
+}
+
+VEC2 Triangle::getTextureCoordsAt(VEC3 point) const {
+	VEC3 localPoint = transformToLocal(point);
+	VEC3 params = get_bary_parameters(localPoint[0], localPoint[1]);
+	return params[0] * texA + params[1] * texB + params[2] * texC;
+}
+
 // Calculates the f function needed for barycentric coordinates
 //  Part of the algorithm described on M&S pg. 165
 float Triangle::bary_compute_f(VEC3 fa, VEC3 fb, float x, float y) const {
@@ -450,3 +484,12 @@ bool Cylinder::intersects(const Ray &ray, float& t) const {
 	return true;
 }
 
+// The ends of the cylinder are discs of the radius around center +- w * height/2
+//	A disc with normal w sticks out by radius * sqrt(1 - w_i^2) along axis i
+AABB Cylinder::getBoundingBox() const {
+	VEC3 extent;
+	for (int i = 0; i < 3; i++) {
+		extent[i] = fabs(w[i]) * height / 2 + radius * sqrt(max(0.0, 1.0 - w[i] * w[i]));
+	}
+	return AABB(center - extent, center + extent);
+}
@@ -15,6 +15,7 @@
 
 #include "ray.h"
 #include "texture.h"
+#include "bvh.h"
 
 using namespace std;
 
@@ -29,6 +30,7 @@ public:
 
 	Shape(const Material &mat, VEC3 colour);
 	Shape(const Material &mat, const Texture *texture);
+	virtual ~Shape() {}
 
 	// Gets the component-wise product of two vectors
 	static VEC3 hadamard(VEC3 a, VEC3 b);
@@ -41,6 +43,17 @@ public:
 	//  Sets to be how far along the ray the shape intersects
 	virtual bool intersects(const Ray &ray, float& t) const = 0;
 
+	// Like intersects, but also sets which part of the shape the ray hit (e.g. which
+	//	triangle of a mesh), so getPartNormalAt needn't find it again
+	//	Shapes made of one part set it to -1
+	virtual bool intersectsPart(const Ray &ray, float &t, int &part) const;
+
+	// Like getNormalAt, on the part intersectsPart found
+	virtual VEC3 getPartNormalAt(VEC3 point, const Ray &ray, int part) const;
+
+	// Returns a box containing the whole shape, for the BVH
+	virtual AABB getBoundingBox() const = 0;
+
 	// Get the colour at that point on the shape
 	//	Gets the appropriate colour from the texture,
 	//	or the base colour of the shape if no texture
@@ -66,6 +79,7 @@ public:
 	
 	VEC3 getNormalAt(VEC3 point, const Ray &ray) const;
 	bool intersects(const Ray &ray, float &t) const;
+	AABB getBoundingBox() const;
 };
 
 class Triangle : public Shape {
@@ -105,8 +119,13 @@ public:
 
 	VEC3 getNormalAt(VEC3 point, const Ray &ray) const override;
 	bool intersects(const Ray &ray, float &t) const override;
+	AABB getBoundingBox() const override;
 	// Sets the coordinates on the texture of vertices a, b, and c respectively
 	void setTextureCoords(VEC2 texA, VEC2 texB, VEC2 texC);
+	// Gets them back (all (0, 0) if never set)
+	void getTextureCoords(VEC2 &texA, VEC2 &texB, VEC2 &texC) const;
+	// Gets the coordinates on the texture of the point on the triangle
+	VEC2 getTextureCoordsAt(VEC3 point) const;
 
 	// Get the colour at that point on the shape
 	//	Gets the appropriate colour from the texture,
@@ -139,6 +158,7 @@ public:
 
 	VEC3 getNormalAt(VEC3 point, const Ray &ray) const;
 	bool intersects(const Ray &ray, float &t) const;
+	AABB getBoundingBox() const;
 };
 
 #endif
@@ -0,0 +1,309 @@
+#include "skinnedMesh.h"
+
+#include <algorithm>
+
+// Fraction of a bone's length, from its base, over which it blends into its parent
+const float JOINT_BLEND_LENGTH = 0.25;
+
+// Vertices or triangles per task handed to the pool; fewer cost more to hand out than to do
+const int ITEMS_PER_TASK = 1024;
+
+// Runs work(first, last) over [0, count) in tasks of ITEMS_PER_TASK on the pool
+template <class Work>
+static void runInTasks(ThreadPool &pool, int count, Work work) {
+	int taskNum = (count + ITEMS_PER_TASK - 1) / ITEMS_PER_TASK;
+	pool.run(taskNum, [count, &work](int task) {
+		work(task * ITEMS_PER_TASK, min(count, (task + 1) * ITEMS_PER_TASK));
+	});
+}
+
+// The displayer stores each bone as rotation * scaling (the scaling flattens the
+//	bone's x and y) plus a translation. Normalising the columns removes the
+//	scaling and leaves a rigid frame.
+void SkinnedMesh::computeBoneFrames(DisplaySkeleton &displayer, vector<MATRIX4> &frames) {
+	vector<MATRIX4>& rotations = displayer.rotations();
+	vector<MATRIX4>& scalings  = displayer.scalings();
+	vector<VEC4>& translations = displayer.translations();
+
+	frames.resize(rotations.size());
+	for (unsigned int x = 1; x < rotations.size(); x++) {
+		MATRIX3 linear = (rotations[x] * scalings[x]).topLeftCorner<3, 3>();
+		for (int column = 0; column < 3; column++) {
+			linear.col(column).normalize();
+		}
+
+		frames[x] = MATRIX4::Identity();
+		frames[x].topLeftCorner<3, 3>() = linear;
+		frames[x].block<3, 1>(0, 3) = translations[x].head<3>();
+	}
+}
+
+// Finds the parent of every bone by walking the skeleton's child/sibling tree
+static void findParents(Bone *bone, int parent, vector<int> &parents) {
+	while (bone != NULL) {
+		parents[bone->idx] = parent;
+		findParents(bone->child, bone->idx, parents);
+		bone = bone->sibling;
+	}
+}
+
+SkinnedMesh::SkinnedMesh(DisplaySkeleton &displayer, float radius, const Material &mat, VEC3 colour,
+	int ringsPerBone, int segmentsPerRing)
+	: Shape(mat, colour), ringsPerBone(ringsPerBone), segmentsPerRing(segmentsPerRing)
+{
+	displayer.ComputeBonePositions(DisplaySkeleton::BONES_AND_LOCAL_FRAMES);
+	vector<MATRIX4> bindFrames;
+	computeBoneFrames(displayer, bindFrames);
+	vector<float>& lengths = displayer.lengths();
+
+	vector<int> parents(bindFrames.size(), -1);
+	findParents(displayer.GetSkeleton(0)->getRoot(), -1, parents);
+
+	// The root bone is just the origin, so it gets no skin (like the cylinders)
+	inverseBindFrames.resize(bindFrames.size(), MATRIX4::Identity());
+	for (unsigned int x = 1; x < bindFrames.size(); x++) {
+		inverseBindFrames[x] = bindFrames[x].inverse();
+		if (lengths[x] <= 0) {
+			continue;
+		}
+		// Bones attached to the root have nothing to blend with
+		int parent = parents[x] > 0 ? parents[x] : -1;
+		addBoneTube(x, parent, bindFrames[x], lengths[x], radius);
+	}
+
+	skinMatrices.resize(12 * bindFrames.size(), 0);
+	posX = restX;
+	posY = restY;
+	posZ = restZ;
+
+	// Build the BVH once, in the bind pose; deform() only refits it
+	triangleBoxes.resize(getTriangleCount());
+	computeTriangleBoxes(0, getTriangleCount());
+	bvh.build(triangleBoxes);
+	bounds = bvh.getNodes()[0].box;
+}
+
+int SkinnedMesh::addVertex(VEC3 position, int bone, int parent, float parentWeight) {
+	restX.push_back(position[0]);
+	restY.push_back(position[1]);
+	restZ.push_back(position[2]);
+
+	influenceBone[0].push_back(bone);
+	influenceWeight[0].push_back(1 - parentWeight);
+	influenceBone[1].push_back(parent == -1 ? bone : parent);
+	influenceWeight[1].push_back(parentWeight);
+	return restX.size() - 1;
+}
+
+// The tube is built in the bone's own frame, where the bone runs up the z axis,
+//	then placed in the bind pose by the bone's frame
+void SkinnedMesh::addBoneTube(int bone, int parent, const MATRIX4 &frame, float length, float radius) {
+	int firstVertex = restX.size();
+
+	for (int ring = 0; ring <= ringsPerBone; ring++) {
+		float along = (float) ring / ringsPerBone;
+
+		// Blend half-and-half with the parent at the joint, fading out along the bone
+		float parentWeight = 0;
+		if (parent != -1 and along < JOINT_BLEND_LENGTH) {
+			parentWeight = 0.5 * (1 - along / JOINT_BLEND_LENGTH);
+		}
+
+		for (int segment = 0; segment < segmentsPerRing; segment++) {
+			float angle = 2 * M_PI * segment / segmentsPerRing;
+			VEC4 local(radius * cos(angle), radius * sin(angle), along * length, 1);
+			addVertex((frame * local).head<3>(), bone, parent, parentWeight);
+		}
+	}
+
+	// Join neighbouring rings with two triangles per segment
+	for (int ring = 0; ring < ringsPerBone; ring++) {
+		for (int segment = 0; segment < segmentsPerRing; segment++) {
+			int next = (segment + 1) % segmentsPerRing;
+			int a = firstVertex + ring * segmentsPerRing + segment;
+			int b = firstVertex + ring * segmentsPerRing + next;
+			int c = a + segmentsPerRing;
+			int d = b + segmentsPerRing;
+			indices.insert(indices.end(), { a, b, c });
+			indices.insert(indices.end(), { b, d, c });
+		}
+	}
+
+	// Close both ends
+	int baseCenter = addVertex((frame * VEC4(0, 0, 0, 1)).head<3>(), bone, parent, parent == -1 ? 0 : 0.5);
+	int tipCenter = addVertex((frame * VEC4(0, 0, length, 1)).head<3>(), bone, parent, 0);
+	addCap(baseCenter, firstVertex, true);
+	addCap(tipCenter, firstVertex + ringsPerBone * segmentsPerRing, false);
+}
+
+void SkinnedMesh::addCap(int centerVertex, int firstRingVertex, bool reverse) {
+	for (int segment = 0; segment < segmentsPerRing; segment++) {
+		int a = firstRingVertex + segment;
+		int b = firstRingVertex + (segment + 1) % segmentsPerRing;
+		if (reverse) {
+			swap(a, b);
+		}
+		indices.insert(indices.end(), { centerVertex, a, b });
+	}
+}
+
+// Adds the share of one bone to vertices [first, last), which all have it as the
+//	same influence. With one matrix for the whole run, and no aliasing between the
+//	arrays, the loop vectorizes over vertices.
+static void addBoneShare(const float *__restrict m, const float *__restrict weights,
+	const float *__restrict rx, const float *__restrict ry, const float *__restrict rz,
+	float *__restrict px, float *__restrict py, float *__restrict pz, int first, int last)
+{
+	for (int v = first; v < last; v++) {
+		float w = weights[v];
+		px[v] += w * (m[0] * rx[v] + m[1] * ry[v] + m[2] * rz[v] + m[3]);
+		py[v] += w * (m[4] * rx[v] + m[5] * ry[v] + m[6] * rz[v] + m[7]);
+		pz[v] += w * (m[8] * rx[v] + m[9] * ry[v] + m[10] * rz[v] + m[11]);
+	}
+}
+
+// Linear-blend skinning: each vertex is the weighted sum of its rest position
+//	carried by each of its bones. Every tube's vertices were added together, so an
+//	influence's bone stays the same over long runs of vertices, and each run is
+//	skinned with its bone's matrix held fixed (see addBoneShare).
+void SkinnedMesh::skinVertices(int first, int last) {
+	float *__restrict px = posX.data();
+	float *__restrict py = posY.data();
+	float *__restrict pz = posZ.data();
+	for (int v = first; v < last; v++) {
+		px[v] = 0;
+		py[v] = 0;
+		pz[v] = 0;
+	}
+
+	for (int i = 0; i < MAX_INFLUENCES; i++) {
+		const int *bones = influenceBone[i].data();
+		int runStart = first;
+		while (runStart < last) {
+			int bone = bones[runStart];
+			int runEnd = runStart + 1;
+			while (runEnd < last and bones[runEnd] == bone) {
+				runEnd++;
+			}
+			addBoneShare(&skinMatrices[12 * bone], influenceWeight[i].data(), restX.data(), restY.data(), restZ.data(),
+				px, py, pz, runStart, runEnd);
+			runStart = runEnd;
+		}
+	}
+}
+
+void SkinnedMesh::computeTriangleBoxes(int first, int last) {
+	for (int triangle = first; triangle < last; triangle++) {
+		AABB box;
+		for (int corner = 0; corner < 3; corner++) {
+			int v = indices[3 * triangle + corner];
+			box.expand(VEC3(posX[v], posY[v], posZ[v]));
+		}
+		triangleBoxes[triangle] = box;
+	}
+}
+
+void SkinnedMesh::deform(DisplaySkeleton &displayer, VEC3 offset, ThreadPool &pool) {
+	vector<MATRIX4> frames;
+	computeBoneFrames(displayer, frames);
+
+	// Skin matrix for each bone: out of the bind pose, into the current pose
+	for (unsigned int x = 1; x < frames.size(); x++) {
+		MATRIX4 skin = frames[x] * inverseBindFrames[x];
+		for (int row = 0; row < 3; row++) {
+			for (int column = 0; column < 4; column++) {
+				skinMatrices[12 * x + 4 * row + column] = skin(row, column);
+			}
+			skinMatrices[12 * x + 4 * row + 3] += offset[row];
+		}
+	}
+
+	runInTasks(pool, getVertexCount(), [this](int first, int last) {
+		skinVertices(first, last);
+	});
+	runInTasks(pool, getTriangleCount(), [this](int first, int last) {
+		computeTriangleBoxes(first, last);
+	});
+
+	bvh.refit(triangleBoxes);
+	bounds = bvh.getNodes()[0].box;
+}
+
+bool SkinnedMesh::intersectsTriangle(const Ray &ray, int triangle, float &t) const {
+	int ia = indices[3 * triangle];
+	int ib = indices[3 * triangle + 1];
+	int ic = indices[3 * triangle + 2];
+	VEC3 a(posX[ia], posY[ia], posZ[ia]);
+	VEC3 edge1 = VEC3(posX[ib], posY[ib], posZ[ib]) - a;
+	VEC3 edge2 = VEC3(posX[ic], posY[ic], posZ[ic]) - a;
+
+	VEC3 p = ray.d.cross(edge2);
+	double determinant = edge1.dot(p);
+	if (fabs(determinant) < 1e-12) {
+		return false;	// Ray is parallel to the triangle
+	}
+	double inverse = 1.0 / determinant;
+
+	VEC3 toOrigin = ray.o - a;
+	double beta = toOrigin.dot(p) * inverse;
+	if (beta < 0 or beta > 1) {
+		return false;
+	}
+
+	VEC3 q = toOrigin.cross(edge1);
+	double gamma = ray.d.dot(q) * inverse;
+	if (gamma < 0 or beta + gamma > 1) {
+		return false;
+	}
+
+	t = edge2.dot(q) * inverse;
+	return t > 0;
+}
+
+int SkinnedMesh::closestTriangle(const Ray &ray, float &t) const {
+	const vector<int> &leafOrder = bvh.getLeafOrder();
+	int leaf;
+	bvh.closestHit(ray, [&](int i, float &tTriangle) {
+		return intersectsTriangle(ray, leafOrder[i], tTriangle);
+	}, t, leaf);
+	return leaf == -1 ? -1 : leafOrder[leaf];
+}
+
+bool SkinnedMesh::intersects(const Ray &ray, float &t) const {
+	return closestTriangle(ray, t) != -1;
+}
+
+bool SkinnedMesh::intersectsPart(const Ray &ray, float &t, int &part) const {
+	part = closestTriangle(ray, t);
+	return part != -1;
+}
+
+// Without the part, the triangle is found again by re-tracing the ray
+VEC3 SkinnedMesh::getNormalAt(VEC3 point, const Ray &ray) const {
+	float t;
+	return getPartNormalAt(point, ray, closestTriangle(ray, t));
+}
+
+VEC3 SkinnedMesh::getPartNormalAt(VEC3 point, const Ray &ray, int part) const {
+	if (part < 0 or part >= getTriangleCount()) {
+		return -ray.d;
+	}
+
+	int ia = indices[3 * part];
+	int ib = indices[3 * part + 1];
+	int ic = indices[3 * part + 2];
+	VEC3 a(posX[ia], posY[ia], posZ[ia]);
+	VEC3 b(posX[ib], posY[ib], posZ[ib]);
+	VEC3 c(posX[ic], posY[ic], posZ[ic]);
+	VEC3 normal = ((b - a).cross(c - a)).normalized();
+
+	// Reverse normal if it's pointing away from the ray origin
+	if ((-ray.d).dot(normal) < 0) {
+		normal = -normal;
+	}
+	return normal;
+}
+
+AABB SkinnedMesh::getBoundingBox() const {
+	return bounds;
+}
@@ -0,0 +1,87 @@
+// A skinned mesh is a triangle mesh that follows the bones of a skeleton
+//	Every vertex is attached to a few bones with weights, and each frame it is
+//	moved by linear-blend skinning: the weighted sum of where each of its bones
+//	would carry it. The mesh keeps its own BVH, which is refit after skinning
+//	rather than rebuilt, since the triangles stay connected the same way.
+
+#ifndef _SKINNED_MESH_H
+#define _SKINNED_MESH_H
+
+#include <vector>
+#include "SETTINGS.h"
+#include "shapes.h"
+#include "bvh.h"
+#include "displaySkeleton.h"
+#include "threadPool.h"
+
+using namespace std;
+
+class SkinnedMesh : public Shape {
+public:
+	static const int MAX_INFLUENCES = 2;	// Bones that can move a single vertex
+
+private:
+	// Vertex positions are stored as separate x, y, z arrays (structure of arrays),
+	//	so the skinning loop runs over contiguous floats and vectorizes
+	vector<float> restX, restY, restZ;	// Positions in the bind pose
+	vector<float> posX, posY, posZ;		// Positions after the latest deform()
+
+	int ringsPerBone, segmentsPerRing;	// Resolution of the tube around each bone
+
+	// Influence i of vertex v is bone influenceBone[i][v] with weight influenceWeight[i][v]
+	vector<int> influenceBone[MAX_INFLUENCES];
+	vector<float> influenceWeight[MAX_INFLUENCES];
+
+	vector<int> indices;	// Three vertex indices per triangle
+
+	vector<MATRIX4> inverseBindFrames;	// Undo each bone's bind pose frame
+	vector<float> skinMatrices;		// 12 floats (3x4, row-major) per bone, bind pose to current pose
+
+	vector<AABB> triangleBoxes;
+	AABB bounds;
+	BVH bvh;
+
+	// Gets the orthonormal frame of every bone from the displayer's latest ComputeBonePositions
+	//	The bone runs along the frame's z axis from its origin, like the cylinders did
+	static void computeBoneFrames(DisplaySkeleton &displayer, vector<MATRIX4> &frames);
+
+	// Adds a tube of skin around one bone, in the bind pose
+	void addBoneTube(int bone, int parent, const MATRIX4 &frame, float length, float radius);
+	// Adds a triangle fan closing one end of a tube
+	void addCap(int centerVertex, int firstRingVertex, bool reverse);
+	int addVertex(VEC3 position, int bone, int parent, float parentWeight);
+
+	// Skins vertices [first, last) with the current skinMatrices
+	void skinVertices(int first, int last);
+	// Recomputes the boxes of triangles [first, last)
+	void computeTriangleBoxes(int first, int last);
+
+	// Möller-Trumbore intersection with one triangle
+	bool intersectsTriangle(const Ray &ray, int triangle, float &t) const;
+	// Finds the closest triangle hit by the ray, or -1
+	int closestTriangle(const Ray &ray, float &t) const;
+
+public:
+	// Builds a tube of skin around every bone of the skeleton, in its current (bind) pose
+	//	Vertices near a joint are blended between the bone and its parent, so joints bend smoothly
+	//	Each tube has ringsPerBone + 1 rings of segmentsPerRing vertices
+	SkinnedMesh(DisplaySkeleton &displayer, float radius, const Material &mat, VEC3 colour,
+		int ringsPerBone, int segmentsPerRing);
+
+	// Moves the skin to follow the skeleton's current pose, then refits the BVH
+	//	Call after ComputeBonePositions; offset is added to every vertex
+	//	The vertices and triangle boxes are split into tasks on the pool
+	void deform(DisplaySkeleton &displayer, VEC3 offset, ThreadPool &pool);
+
+	int getVertexCount() const { return restX.size(); }
+	int getTriangleCount() const { return indices.size() / 3; }
+
+	// The part is the triangle hit
+	VEC3 getNormalAt(VEC3 point, const Ray &ray) const override;
+	VEC3 getPartNormalAt(VEC3 point, const Ray &ray, int part) const override;
+	bool intersects(const Ray &ray, float &t) const override;
+	bool intersectsPart(const Ray &ray, float &t, int &part) const override;
+	AABB getBoundingBox() const override;
+};
+
+#endif
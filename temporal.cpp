@@ -0,0 +1,221 @@
+#include "temporal.h"
+
+#include <cmath>
+#include <algorithm>
+
+extern const int TEMPORAL_MAX_FRAMES;	// Most frames a pixel's average is over, so changes fade in
+extern const float TEMPORAL_DEPTH_TOLERANCE;	// How far off the last frame's surface a point can be, per unit of distance
+extern const float TEMPORAL_NORMAL_TOLERANCE;	// Least cosine between the normals of the same surface
+extern const float TEMPORAL_CLAMP_SIGMA;	// Standard deviations around the pixel's neighbours the history is kept within
+
+// Rows blended by each task on the thread pool
+static const int ROWS_PER_TASK = 8;
+
+void HistoryPlanes::resize(int pixelNum) {
+	for (int c = 0; c < 3; c++) {
+		colour[c].resize(pixelNum);
+		position[c].resize(pixelNum);
+		normal[c].resize(pixelNum);
+	}
+	frameNum.resize(pixelNum);
+}
+
+// Weights of the 4 pixels around a point a fraction t of the way between the middle
+//	two, for Catmull-Rom interpolation, which blurs less than bilinear
+static void catmullRomWeights(float t, float weights[4]) {
+	float t2 = t * t;
+	float t3 = t2 * t;
+	weights[0] = 0.5f * (-t3 + 2 * t2 - t);
+	weights[1] = 0.5f * (3 * t3 - 5 * t2 + 2);
+	weights[2] = 0.5f * (-3 * t3 + 4 * t2 + t);
+	weights[3] = 0.5f * (t3 - t2);
+}
+
+TemporalHistory::TemporalHistory()
+	: frame(-1), width(0), height(0), projection(NULL)
+{}
+
+TemporalHistory::~TemporalHistory() {
+	delete projection;
+}
+
+void TemporalHistory::reset() {
+	frame = -1;
+	delete projection;
+	projection = NULL;
+}
+
+bool TemporalHistory::isSameSurface(int x, int y, VEC3 point, VEC3 pointNormal, float depth) const {
+	if (x < 0 or x >= width or y < 0 or y >= height) {
+		return false;
+	}
+	int q = y * width + x;
+	if (planes.frameNum[q] == 0) {
+		return false;
+	}
+	VEC3 seenNormal(planes.normal[0][q], planes.normal[1][q], planes.normal[2][q]);
+	VEC3 seenPoint(planes.position[0][q], planes.position[1][q], planes.position[2][q]);
+	return seenNormal.dot(pointNormal) >= TEMPORAL_NORMAL_TOLERANCE and
+		fabs(seenNormal.dot(point - seenPoint)) <= TEMPORAL_DEPTH_TOLERANCE * depth;
+}
+
+// Interpolates the 4x4 pixels around the point if they all saw its surface, else
+//	the 2x2 around it, leaving out those that saw another
+bool TemporalHistory::findHistory(VEC3 point, VEC3 pointNormal, float depth, VEC3 &colour, float &frameNum) const {
+	float column, row;
+	if (not projection->project(point, column, row)) {
+		return false;
+	}
+	int left = floor(column);
+	int top = floor(row);
+	float fx = column - left;
+	float fy = row - top;
+
+	bool allSame = true;
+	for (int y = top - 1; y <= top + 2 and allSame; y++) {
+		for (int x = left - 1; x <= left + 2 and allSame; x++) {
+			allSame = isSameSurface(x, y, point, pointNormal, depth);
+		}
+	}
+
+	colour = VEC3(0, 0, 0);
+	frameNum = 0;
+	float weightSum = 0;
+	if (allSame) {
+		float weightsX[4], weightsY[4];
+		catmullRomWeights(fx, weightsX);
+		catmullRomWeights(fy, weightsY);
+		for (int dy = 0; dy < 4; dy++) {
+			for (int dx = 0; dx < 4; dx++) {
+				int q = (top - 1 + dy) * width + left - 1 + dx;
+				float weight = weightsX[dx] * weightsY[dy];
+				colour += weight * VEC3(planes.colour[0][q], planes.colour[1][q], planes.colour[2][q]);
+				frameNum += weight * planes.frameNum[q];
+			}
+		}
+		// The negative weights can overshoot
+		colour = colour.cwiseMax(0.0).cwiseMin(1.0);
+		return true;
+	}
+
+	for (int dy = 0; dy <= 1; dy++) {
+		for (int dx = 0; dx <= 1; dx++) {
+			if (not isSameSurface(left + dx, top + dy, point, pointNormal, depth)) {
+				continue;
+			}
+			int q = (top + dy) * width + left + dx;
+			float weight = (dx ? fx : 1 - fx) * (dy ? fy : 1 - fy);
+			colour += weight * VEC3(planes.colour[0][q], planes.colour[1][q], planes.colour[2][q]);
+			frameNum += weight * planes.frameNum[q];
+			weightSum += weight;
+		}
+	}
+	if (weightSum == 0) {
+		return false;
+	}
+	colour /= weightSum;
+	frameNum /= weightSum;
+	return true;
+}
+
+void TemporalHistory::accumulateRows(const DenoiseBuffers &buffers, const Camera &camera, const CameraProjection &current,
+	bool hasHistory, HistoryPlanes &next, int firstRow, int lastRow) const
+{
+	int w = buffers.width;
+	int h = buffers.height;
+
+	for (int row = firstRow; row < lastRow; row++) {
+		for (int column = 0; column < w; column++) {
+			int pixel = row * w + column;
+			float depth = buffers.depth[pixel];
+
+			// Nothing was hit, so there's nothing to follow back
+			if (depth == 0) {
+				for (int c = 0; c < 3; c++) {
+					next.colour[c][pixel] = buffers.colour[c][pixel];
+					next.position[c][pixel] = 0;
+					next.normal[c][pixel] = 0;
+				}
+				next.frameNum[pixel] = 0;
+				continue;
+			}
+
+			VEC3 point = camera.eye + current.direction(column, row) * depth;
+			VEC3 pointNormal(buffers.normal[0][pixel], buffers.normal[1][pixel], buffers.normal[2][pixel]);
+			VEC3 colour = buffers.getColour(pixel);
+
+			VEC3 historyColour;
+			float historyFrameNum;
+			bool found = hasHistory and findHistory(point, pointNormal, depth, historyColour, historyFrameNum);
+
+			float frameNum = 1;
+			if (found) {
+				// Keep the history within the spread of this frame's colours around the pixel
+				if (TEMPORAL_CLAMP_SIGMA > 0) {
+					VEC3 sum(0, 0, 0), squaredSum(0, 0, 0);
+					int neighbourNum = 0;
+					for (int y = max(0, row - 1); y <= min(h - 1, row + 1); y++) {
+						for (int x = max(0, column - 1); x <= min(w - 1, column + 1); x++) {
+							VEC3 neighbour = buffers.getColour(y * w + x);
+							sum += neighbour;
+							squaredSum += neighbour.cwiseProduct(neighbour);
+							neighbourNum++;
+						}
+					}
+					VEC3 mean = sum / (float) neighbourNum;
+					VEC3 variance = (squaredSum / (float) neighbourNum - mean.cwiseProduct(mean)).cwiseMax(0.0);
+					VEC3 spread = TEMPORAL_CLAMP_SIGMA * variance.cwiseSqrt();
+					historyColour = historyColour.cwiseMax(mean - spread).cwiseMin(mean + spread);
+				}
+
+				frameNum = min((float) TEMPORAL_MAX_FRAMES, historyFrameNum + 1);
+				colour = historyColour + (colour - historyColour) / frameNum;
+			}
+
+			for (int c = 0; c < 3; c++) {
+				next.colour[c][pixel] = colour[c];
+				next.position[c][pixel] = point[c];
+				next.normal[c][pixel] = pointNormal[c];
+			}
+			next.frameNum[pixel] = frameNum;
+		}
+	}
+}
+
+void TemporalHistory::accumulate(DenoiseBuffers &buffers, const Camera &camera, int frame, ThreadPool &pool) {
+	int pixelNum = buffers.width * buffers.height;
+	for (int c = 0; c < 3; c++) {
+		for (int p = 0; p < pixelNum; p++) {
+			buffers.colour[c][p] = max(0.0f, min(1.0f, buffers.colour[c][p]));
+		}
+	}
+
+	bool hasHistory = projection != NULL and this->frame == frame - 1 and
+		width == buffers.width and height == buffers.height;
+
+	HistoryPlanes next;
+	next.resize(pixelNum);
+
+	CameraProjection current(camera);
+	int taskNum = (buffers.height + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+	pool.run(taskNum, [&](int task) {
+		int firstRow = task * ROWS_PER_TASK;
+		int lastRow = min(buffers.height, firstRow + ROWS_PER_TASK);
+		accumulateRows(buffers, camera, current, hasHistory, next, firstRow, lastRow);
+	});
+
+	// The blended colours go on to be displayed, and become the history of the next frame
+	swap(planes, next);
+	for (int c = 0; c < 3; c++) {
+		buffers.colour[c] = planes.colour[c];
+	}
+	for (int p = 0; p < pixelNum; p++) {
+		buffers.frameNum[p] = max(1.0f, planes.frameNum[p]);
+	}
+
+	this->frame = frame;
+	width = buffers.width;
+	height = buffers.height;
+	delete projection;
+	projection = new CameraProjection(camera);
+}
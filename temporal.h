@@ -0,0 +1,73 @@
+// Reuses the rays of earlier frames, for frames rendered one after another
+//	The camera moves only a little each frame, through a room that mostly stays
+//	still, so most of what a pixel sees was also seen (and shaded with different
+//	random numbers) the frame before, a few pixels away. Following the pixel's
+//	point back to where the last frame's camera saw it (reprojection) finds that
+//	pixel, whose colour is itself the average of the frames before. Blending the
+//	new colour into it keeps a running average per surface point, so the samples
+//	per pixel grow with every frame the point stays in view, for no more rays.
+//
+//	History is only used where the last frame saw the same surface: the point has
+//	to lie on the plane of the surface seen there, and face the same way. Where
+//	a surface comes out from behind another, or the skeleton has moved away from
+//	where its point was, the pixel starts over. Changes in shading where nothing
+//	moved (e.g. the skeleton's shadow) are limited by keeping the history within
+//	the range of colours around the pixel in the new frame.
+
+#ifndef _TEMPORAL_H
+#define _TEMPORAL_H
+
+#include <vector>
+#include "SETTINGS.h"
+#include "raytracer.h"
+#include "denoiser.h"
+#include "threadPool.h"
+
+using namespace std;
+
+// What the history keeps of a frame, one float per pixel per plane
+struct HistoryPlanes {
+	vector<float> colour[3];	// Average of the frames so far
+	vector<float> position[3];	// Point each pixel saw
+	vector<float> normal[3];	// Its normal
+	vector<float> frameNum;	// Number of frames averaged, as a float (0 where nothing was hit)
+
+	void resize(int pixelNum);
+};
+
+// The accumulated colours of the last frame, and what they were of
+class TemporalHistory {
+	int frame;	// Frame the history is of, or -1 if there is none
+	int width, height;
+	CameraProjection *projection;	// How that frame's camera saw the world (NULL if there is no history)
+	HistoryPlanes planes;
+
+	// Whether pixel (x, y) of the last frame saw the surface at the point
+	bool isSameSurface(int x, int y, VEC3 point, VEC3 pointNormal, float depth) const;
+
+	// Follows the point back to the last frame, and sets the history's colour and
+	//	number of frames there, or returns false if it saw another surface there
+	bool findHistory(VEC3 point, VEC3 pointNormal, float depth, VEC3 &colour, float &frameNum) const;
+
+	// Blends in the history for rows [firstRow, lastRow), writing the next history
+	void accumulateRows(const DenoiseBuffers &buffers, const Camera &camera, const CameraProjection &current,
+		bool hasHistory, HistoryPlanes &next, int firstRow, int lastRow) const;
+
+	// Holds the history of a series of frames, so can't be copied
+	TemporalHistory(const TemporalHistory &);
+	TemporalHistory &operator=(const TemporalHistory &);
+
+public:
+	TemporalHistory();
+	~TemporalHistory();
+
+	// Forgets the frames so far, e.g. when the scene changes
+	void reset();
+
+	// Blends the colours of this frame (with its features, see denoiser.h) with the
+	//	history, if it's of the frame before, then keeps them as the history
+	//	Colours are clamped to [0, 1], as displayed, first.
+	void accumulate(DenoiseBuffers &buffers, const Camera &camera, int frame, ThreadPool &pool);
+};
+
+#endif
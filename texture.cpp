@@ -1,4 +1,7 @@
 #include "texture.h"
+#include "numa.h"
+
+#include <cstring>
 
 // From M&S, page 244
 VEC3 Texture::texture_lookup(float u, float v) const {
@@ -12,7 +15,13 @@ VEC3 Texture::texture_lookup(float u, float v) const {
 	if (pixel >=xRes * yRes * 3 or pixel < 0)									// FIX THIS ERROR!!!!
 		return VEC3(0, 1, 0);
 
-	VEC3 colour(pixelValues[pixel], pixelValues[pixel + 1], pixelValues[pixel + 2]);
+	// Read this thread's node's copy, if there are copies
+	const float *values = pixelValues;
+	int node = currentNumaNode();
+	if (node < (int) nodePixelValues.size())
+		values = nodePixelValues[node];
+
+	VEC3 colour(values[pixel], values[pixel + 1], values[pixel + 2]);
 	//cout << colour << endl; 
 	return colour;
 }
@@ -62,3 +71,28 @@ Texture::Texture(const string& filename, int _xRes, int _yRes)
 	// Load the texture
 	readPPM(filename, xRes, yRes, pixelValues);
 }
+
+void Texture::replicatePerNode() const {
+	int nodeNum = getNumaNodeNum();
+	if (nodeNum < 2 or not nodePixelValues.empty()) {
+		return;
+	}
+
+	// Leave at least half of each node's free memory alone
+	size_t bytes = 3 * (size_t) xRes * yRes * sizeof(float);
+	for (int node = 0; node < nodeNum; node++) {
+		long long freeBytes = getNumaNodeFreeBytes(node);
+		if (freeBytes >= 0 and (long long) bytes > freeBytes / 2) {
+			return;
+		}
+	}
+
+	// Each copy is written by a thread on its node, so its pages are placed there
+	nodePixelValues.resize(nodeNum);
+	for (int node = 0; node < nodeNum; node++) {
+		runOnNumaNode(node, [&] {
+			nodePixelValues[node] = new float[3 * xRes * yRes];
+			memcpy(nodePixelValues[node], pixelValues, bytes);
+		});
+	}
+}
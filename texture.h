@@ -8,6 +8,7 @@
 #include <cstdlib>
 #include <iostream>
 #include <float.h>
+#include <vector>
 #include "SETTINGS.h"
 
 using namespace std;
@@ -17,6 +18,10 @@ public:
 	int xRes, yRes;
 	float *pixelValues;	// The pixels in the image, one component at a time (r, g, b)
 
+	// Copies of pixelValues placed on each NUMA node, empty if not replicated.
+	//	Set up once before rendering, so can be filled in on const textures.
+	mutable vector<float *> nodePixelValues;
+
 	// Defines a texture from a ppm file
 	//	Takes the name of the file and its resolution
 	Texture(const string& filename, int xRes, int yRes);
@@ -24,6 +29,10 @@ public:
 	// Gets the texture colour at tex_coords (u, v)
 	//	u, v are between 0 and 1
 	VEC3 texture_lookup(float u, float v) const;
+
+	// Gives each NUMA node its own copy of the pixels, read by threads pinned there
+	//	Does nothing on a single node, or if a node hasn't the memory to spare.
+	void replicatePerNode() const;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,137 @@
+#include "threadPool.h"
+#include "numa.h"
+
+static thread_local int workerIndexOfThread = -1;
+
+ThreadPool::ThreadPool(int threadNum, bool pinThreads)
+	: queues(threadNum > 0 ? threadNum : max(1u, thread::hardware_concurrency())),
+	pinThreads(pinThreads), queuedTaskNum(0), stopping(false)
+{
+	for (unsigned int i = 0; i < queues.size(); i++) {
+		workers.push_back(thread(&ThreadPool::workerLoop, this, i));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		lock_guard<mutex> guard(wakeMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (thread &worker : workers) {
+		worker.join();
+	}
+}
+
+int ThreadPool::currentWorker() {
+	return workerIndexOfThread;
+}
+
+bool ThreadPool::takeTask(int preferred, QueuedTask &taken) {
+	int queueNum = queues.size();
+
+	// Own queue: take from the front, continuing the contiguous run
+	{
+		WorkQueue &own = queues[preferred];
+		lock_guard<mutex> guard(own.lock);
+		if (not own.tasks.empty()) {
+			taken = own.tasks.front();
+			own.tasks.pop_front();
+			queuedTaskNum--;
+			return true;
+		}
+	}
+
+	// Steal from the back of the others, furthest from where their owner is working
+	for (int offset = 1; offset < queueNum; offset++) {
+		WorkQueue &victim = queues[(preferred + offset) % queueNum];
+		lock_guard<mutex> guard(victim.lock);
+		if (not victim.tasks.empty()) {
+			taken = victim.tasks.back();
+			victim.tasks.pop_back();
+			queuedTaskNum--;
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::runTask(const QueuedTask &queued) {
+	Batch *batch = queued.batch;
+	(*batch->task)(queued.index);
+
+	// The last task to finish wakes the thread waiting in run(). The count is
+	//	changed under the lock, so run() cannot return and free the batch while
+	//	this thread is still using it.
+	lock_guard<mutex> guard(batch->doneMutex);
+	if (--batch->remaining == 0) {
+		batch->done.notify_all();
+	}
+}
+
+void ThreadPool::workerLoop(int workerIndex) {
+	workerIndexOfThread = workerIndex;
+
+	// Workers are split into one contiguous group per node, and take that node's cores in turn
+	if (pinThreads) {
+		const vector<NumaNode> &nodes = getNumaNodes();
+		int workerNum = queues.size();
+		int node = (long) workerIndex * nodes.size() / workerNum;
+		int firstInNode = (workerNum * node + nodes.size() - 1) / nodes.size();
+		const vector<int> &cpus = nodes[node].cpus;
+		pinThreadToCpu(cpus[(workerIndex - firstInNode) % cpus.size()]);
+	}
+
+	while (true) {
+		QueuedTask queued;
+		if (takeTask(workerIndex, queued)) {
+			runTask(queued);
+			continue;
+		}
+
+		// Nothing to do anywhere: sleep until run() queues more tasks
+		unique_lock<mutex> guard(wakeMutex);
+		wake.wait(guard, [this] { return stopping or queuedTaskNum > 0; });
+		if (stopping) {
+			return;
+		}
+	}
+}
+
+void ThreadPool::run(int taskNum, const function<void(int)> &task) {
+	if (taskNum <= 0) {
+		return;
+	}
+
+	Batch batch;
+	batch.task = &task;
+	batch.remaining = taskNum;
+
+	// Deal contiguous blocks of tasks, one per worker
+	int queueNum = queues.size();
+	for (int q = 0; q < queueNum; q++) {
+		int first = (long) taskNum * q / queueNum;
+		int last = (long) taskNum * (q + 1) / queueNum;
+		lock_guard<mutex> guard(queues[q].lock);
+		for (int i = first; i < last; i++) {
+			queues[q].tasks.push_back(QueuedTask{ &batch, i });
+		}
+	}
+	{
+		lock_guard<mutex> guard(wakeMutex);
+		queuedTaskNum += taskNum;
+	}
+	wake.notify_all();
+
+	// Help out until the queues are empty; tasks taken this way may belong to
+	//	other batches, which is fine since all batches are being waited on
+	int helpFrom = workerIndexOfThread >= 0 ? workerIndexOfThread : 0;
+	QueuedTask queued;
+	while (batch.remaining > 0 and takeTask(helpFrom, queued)) {
+		runTask(queued);
+	}
+
+	// Wait for tasks that are still running on the workers
+	unique_lock<mutex> guard(batch.doneMutex);
+	batch.done.wait(guard, [&batch] { return batch.remaining == 0; });
+}
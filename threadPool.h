@@ -0,0 +1,80 @@
+// A persistent pool of worker threads, used to render tiles in parallel
+//	Work is handed to the pool in batches of numbered tasks. Every worker has
+//	its own deque of tasks: it works through its own deque from the front, and
+//	when that runs dry it steals from the back of another worker's deque. This
+//	keeps each worker on a contiguous run of tasks, while expensive tasks (e.g.
+//	tiles covering the glossy cube) are balanced out by the stealing.
+//
+//	Workers can be pinned to cores. Neighbouring workers go on the same NUMA
+//	node, so thieves, which try their neighbours first, steal within their
+//	node before crossing to another.
+
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+using namespace std;
+
+class ThreadPool {
+	// A set of tasks handed to run(), shared by all of its queued tasks
+	struct Batch {
+		const function<void(int)> *task;
+		atomic<int> remaining;	// Tasks not yet finished
+		mutex doneMutex;
+		condition_variable done;
+	};
+
+	struct QueuedTask {
+		Batch *batch;
+		int index;
+	};
+
+	// One worker's deque of tasks; the owner pops the front, thieves pop the back
+	struct WorkQueue {
+		mutex lock;
+		deque<QueuedTask> tasks;
+	};
+
+	vector<thread> workers;
+	vector<WorkQueue> queues;
+	bool pinThreads;
+
+	// Sleeping workers wait here until new tasks arrive
+	mutex wakeMutex;
+	condition_variable wake;
+	atomic<int> queuedTaskNum;
+	bool stopping;
+
+	void workerLoop(int workerIndex);
+
+	// Takes a task, trying queue `preferred` first and then stealing from the others
+	bool takeTask(int preferred, QueuedTask &taken);
+	void runTask(const QueuedTask &queued);
+
+public:
+	// Starts threadNum workers; 0 means one per hardware thread
+	//	pinThreads pins each worker to a core, spreading them evenly over the NUMA nodes
+	ThreadPool(int threadNum = 0, bool pinThreads = false);
+	~ThreadPool();
+
+	int getThreadNum() const { return workers.size(); }
+
+	// Runs task(i) for every i in [0, taskNum) and returns when all have finished
+	//	Worker k's deque gets the kth contiguous block of task numbers, so tasks that
+	//	are numbered in a cache-friendly order stay that way. The calling thread
+	//	helps with the work while it waits. run() can be called from several threads
+	//	at once; their batches share the workers.
+	void run(int taskNum, const function<void(int)> &task);
+
+	// Index of the pool worker running the current thread, or -1 for other threads
+	static int currentWorker();
+};
+
+#endif
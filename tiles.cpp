@@ -0,0 +1,57 @@
+#include "tiles.h"
+
+#include <algorithm>
+
+// Converts a distance along the Hilbert curve filling an n x n grid to (x, y)
+//	n must be a power of two. This is the standard iterative conversion:
+//	each step places the point in one quadrant and rotates/flips it to match.
+static void hilbertToGrid(int n, int distance, int &x, int &y) {
+	x = 0;
+	y = 0;
+	for (int size = 1; size < n; size *= 2) {
+		int right = 1 & (distance / 2);
+		int up = 1 & (distance ^ right);
+
+		// Rotate the quadrant
+		if (up == 0) {
+			if (right == 1) {
+				x = size - 1 - x;
+				y = size - 1 - y;
+			}
+			swap(x, y);
+		}
+
+		x += size * right;
+		y += size * up;
+		distance /= 4;
+	}
+}
+
+vector<Tile> createTiles(int width, int height, int tileSize) {
+	int columns = (width + tileSize - 1) / tileSize;
+	int rows = (height + tileSize - 1) / tileSize;
+
+	// The curve needs a square, power of two grid; cells outside the image are skipped
+	int gridSize = 1;
+	while (gridSize < columns or gridSize < rows) {
+		gridSize *= 2;
+	}
+
+	vector<Tile> tiles;
+	tiles.reserve(columns * rows);
+	for (int distance = 0; distance < gridSize * gridSize; distance++) {
+		int column, row;
+		hilbertToGrid(gridSize, distance, column, row);
+		if (column >= columns or row >= rows) {
+			continue;
+		}
+
+		Tile tile;
+		tile.firstColumn = column * tileSize;
+		tile.firstRow = row * tileSize;
+		tile.lastColumn = min(width, tile.firstColumn + tileSize);
+		tile.lastRow = min(height, tile.firstRow + tileSize);
+		tiles.push_back(tile);
+	}
+	return tiles;
+}
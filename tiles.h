@@ -0,0 +1,23 @@
+// Splits an image into square tiles for parallel rendering
+//	Tiles are ordered along a Hilbert curve, so consecutive tiles are always
+//	neighbours and a worker rendering a run of them keeps touching nearby
+//	parts of the scene and of the image.
+
+#ifndef _TILES_H
+#define _TILES_H
+
+#include <vector>
+
+using namespace std;
+
+// A rectangle of pixels, in image rows and columns (row 0 is the top of the image)
+struct Tile {
+	int firstColumn, firstRow;
+	int lastColumn, lastRow;	// Exclusive
+};
+
+// Covers a width x height image with tiles of tileSize pixels, in Hilbert curve order
+//	Tiles on the right and bottom edges are cut short to fit the image
+vector<Tile> createTiles(int width, int height, int tileSize);
+
+#endif